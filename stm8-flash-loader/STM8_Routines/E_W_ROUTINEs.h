@@ -0,0 +1,10 @@
+// generated by tools/s19toh -r, don't edit. Requires Routine_t from flash.h
+
+#include "E_W_ROUTINEs_32K_ver_1.3.h"
+
+// E_W routine variants: flash size [kB], family ('L'=low density), BSL version
+static const Routine_t E_W_ROUTINES[1] = {
+  {  32, 'S', 0x13, "32K_ver_1.3", &STM8_Routines_E_W_ROUTINEs_32K_ver_1_3 },
+};
+
+#define NUM_E_W_ROUTINES  1
@@ -1,77 +1,39 @@
-unsigned char STM8_Routines_E_W_ROUTINEs_32K_ver_1_3_s19[] = {
-  0x53, 0x30, 0x30, 0x46, 0x30, 0x30, 0x30, 0x30, 0x34, 0x34, 0x36, 0x35,
-  0x36, 0x32, 0x37, 0x35, 0x36, 0x37, 0x35, 0x43, 0x36, 0x32, 0x36, 0x43,
-  0x32, 0x45, 0x37, 0x33, 0x36, 0x44, 0x33, 0x38, 0x39, 0x39, 0x0d, 0x0a,
-  0x53, 0x31, 0x31, 0x33, 0x30, 0x30, 0x41, 0x30, 0x35, 0x46, 0x33, 0x46,
-  0x39, 0x30, 0x33, 0x46, 0x39, 0x36, 0x37, 0x32, 0x30, 0x39, 0x30, 0x30,
-  0x38, 0x45, 0x31, 0x36, 0x43, 0x44, 0x36, 0x30, 0x36, 0x35, 0x42, 0x36,
-  0x39, 0x30, 0x45, 0x37, 0x36, 0x42, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33,
-  0x30, 0x30, 0x42, 0x30, 0x30, 0x30, 0x35, 0x43, 0x34, 0x43, 0x42, 0x37,
-  0x39, 0x30, 0x41, 0x31, 0x32, 0x31, 0x32, 0x36, 0x46, 0x31, 0x41, 0x36,
-  0x32, 0x30, 0x42, 0x37, 0x38, 0x38, 0x35, 0x46, 0x33, 0x46, 0x39, 0x30,
-  0x34, 0x31, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33, 0x30, 0x30, 0x43, 0x30,
-  0x45, 0x36, 0x30, 0x30, 0x41, 0x31, 0x32, 0x30, 0x32, 0x36, 0x30, 0x37,
-  0x33, 0x46, 0x38, 0x41, 0x41, 0x45, 0x34, 0x30, 0x30, 0x30, 0x32, 0x30,
-  0x30, 0x43, 0x33, 0x46, 0x38, 0x41, 0x41, 0x45, 0x46, 0x45, 0x0d, 0x0a,
-  0x53, 0x31, 0x31, 0x33, 0x30, 0x30, 0x44, 0x30, 0x30, 0x30, 0x38, 0x30,
-  0x34, 0x32, 0x35, 0x38, 0x35, 0x38, 0x35, 0x38, 0x31, 0x43, 0x38, 0x30,
-  0x30, 0x30, 0x39, 0x30, 0x35, 0x46, 0x43, 0x44, 0x36, 0x30, 0x36, 0x35,
-  0x39, 0x45, 0x42, 0x37, 0x45, 0x30, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33,
-  0x30, 0x30, 0x45, 0x30, 0x38, 0x42, 0x39, 0x46, 0x42, 0x37, 0x38, 0x43,
-  0x41, 0x36, 0x32, 0x30, 0x43, 0x37, 0x35, 0x30, 0x35, 0x42, 0x34, 0x33,
-  0x43, 0x37, 0x35, 0x30, 0x35, 0x43, 0x34, 0x46, 0x39, 0x32, 0x42, 0x44,
-  0x31, 0x33, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33, 0x30, 0x30, 0x46, 0x30,
-  0x30, 0x30, 0x38, 0x41, 0x35, 0x43, 0x39, 0x46, 0x42, 0x37, 0x38, 0x43,
-  0x34, 0x46, 0x39, 0x32, 0x42, 0x44, 0x30, 0x30, 0x38, 0x41, 0x35, 0x43,
-  0x39, 0x46, 0x42, 0x37, 0x38, 0x43, 0x34, 0x46, 0x37, 0x46, 0x0d, 0x0a,
-  0x53, 0x31, 0x31, 0x33, 0x30, 0x31, 0x30, 0x30, 0x39, 0x32, 0x42, 0x44,
-  0x30, 0x30, 0x38, 0x41, 0x35, 0x43, 0x39, 0x46, 0x42, 0x37, 0x38, 0x43,
-  0x34, 0x46, 0x39, 0x32, 0x42, 0x44, 0x30, 0x30, 0x38, 0x41, 0x37, 0x32,
-  0x30, 0x30, 0x35, 0x30, 0x45, 0x41, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33,
-  0x30, 0x31, 0x31, 0x30, 0x35, 0x46, 0x30, 0x37, 0x37, 0x32, 0x30, 0x35,
-  0x35, 0x30, 0x35, 0x46, 0x46, 0x42, 0x32, 0x30, 0x30, 0x34, 0x37, 0x32,
-  0x31, 0x30, 0x30, 0x30, 0x39, 0x36, 0x39, 0x30, 0x41, 0x33, 0x30, 0x30,
-  0x45, 0x35, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33, 0x30, 0x31, 0x32, 0x30,
-  0x30, 0x37, 0x32, 0x37, 0x30, 0x41, 0x39, 0x30, 0x35, 0x43, 0x31, 0x44,
-  0x30, 0x30, 0x30, 0x33, 0x31, 0x43, 0x30, 0x30, 0x38, 0x30, 0x32, 0x30,
-  0x41, 0x45, 0x42, 0x36, 0x39, 0x30, 0x42, 0x31, 0x32, 0x36, 0x0d, 0x0a,
-  0x53, 0x31, 0x31, 0x33, 0x30, 0x31, 0x33, 0x30, 0x38, 0x38, 0x32, 0x37,
-  0x31, 0x43, 0x35, 0x46, 0x33, 0x43, 0x39, 0x30, 0x42, 0x36, 0x39, 0x30,
-  0x39, 0x37, 0x43, 0x43, 0x30, 0x30, 0x43, 0x30, 0x39, 0x44, 0x39, 0x44,
-  0x39, 0x44, 0x39, 0x44, 0x45, 0x38, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33,
-  0x30, 0x31, 0x34, 0x30, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44,
-  0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44,
-  0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x38, 0x31,
-  0x46, 0x37, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33, 0x30, 0x31, 0x35, 0x30,
-  0x43, 0x44, 0x36, 0x30, 0x36, 0x35, 0x35, 0x46, 0x33, 0x46, 0x39, 0x37,
-  0x37, 0x32, 0x30, 0x44, 0x30, 0x30, 0x38, 0x45, 0x31, 0x38, 0x37, 0x32,
-  0x30, 0x30, 0x30, 0x30, 0x39, 0x34, 0x30, 0x42, 0x39, 0x45, 0x0d, 0x0a,
-  0x53, 0x31, 0x31, 0x33, 0x30, 0x31, 0x36, 0x30, 0x41, 0x36, 0x30, 0x31,
-  0x43, 0x37, 0x35, 0x30, 0x35, 0x42, 0x34, 0x33, 0x43, 0x37, 0x35, 0x30,
-  0x35, 0x43, 0x32, 0x30, 0x30, 0x38, 0x33, 0x35, 0x38, 0x31, 0x35, 0x30,
-  0x35, 0x42, 0x33, 0x35, 0x46, 0x45, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33,
-  0x30, 0x31, 0x37, 0x30, 0x37, 0x45, 0x35, 0x30, 0x35, 0x43, 0x33, 0x46,
-  0x39, 0x34, 0x46, 0x36, 0x39, 0x32, 0x41, 0x37, 0x30, 0x30, 0x38, 0x41,
-  0x37, 0x32, 0x30, 0x43, 0x30, 0x30, 0x38, 0x45, 0x31, 0x33, 0x37, 0x32,
-  0x33, 0x34, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33, 0x30, 0x31, 0x38, 0x30,
-  0x30, 0x30, 0x35, 0x30, 0x35, 0x46, 0x30, 0x37, 0x37, 0x32, 0x30, 0x35,
-  0x35, 0x30, 0x35, 0x46, 0x46, 0x42, 0x32, 0x30, 0x30, 0x34, 0x37, 0x32,
-  0x31, 0x30, 0x30, 0x30, 0x39, 0x37, 0x43, 0x44, 0x38, 0x41, 0x0d, 0x0a,
-  0x53, 0x31, 0x31, 0x33, 0x30, 0x31, 0x39, 0x30, 0x36, 0x30, 0x36, 0x35,
-  0x39, 0x46, 0x42, 0x31, 0x38, 0x38, 0x32, 0x37, 0x30, 0x33, 0x35, 0x43,
-  0x32, 0x30, 0x44, 0x42, 0x37, 0x32, 0x30, 0x44, 0x30, 0x30, 0x38, 0x45,
-  0x31, 0x30, 0x37, 0x32, 0x41, 0x45, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33,
-  0x30, 0x31, 0x41, 0x30, 0x30, 0x30, 0x35, 0x30, 0x35, 0x46, 0x30, 0x37,
-  0x37, 0x32, 0x30, 0x35, 0x35, 0x30, 0x35, 0x46, 0x46, 0x42, 0x32, 0x30,
-  0x32, 0x34, 0x37, 0x32, 0x31, 0x30, 0x30, 0x30, 0x39, 0x37, 0x32, 0x30,
-  0x46, 0x37, 0x0d, 0x0a, 0x53, 0x31, 0x31, 0x33, 0x30, 0x31, 0x42, 0x30,
-  0x31, 0x45, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44,
-  0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44,
-  0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x45, 0x41, 0x0d, 0x0a,
-  0x53, 0x31, 0x31, 0x33, 0x30, 0x31, 0x43, 0x30, 0x39, 0x44, 0x39, 0x44,
-  0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44,
-  0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44, 0x39, 0x44,
-  0x39, 0x44, 0x38, 0x31, 0x37, 0x37, 0x0d, 0x0a, 0x53, 0x39, 0x30, 0x33,
-  0x46, 0x46, 0x46, 0x46, 0x46, 0x45
+// generated from STM8_Routines/E_W_ROUTINEs_32K_ver_1.3.s19 by tools/s19toh, don't edit
+
+static const char STM8_Routines_E_W_ROUTINEs_32K_ver_1_3_data0[304] = {
+  0x5f, 0x3f, 0x90, 0x3f, 0x96, 0x72, 0x09, 0x00, 0x8e, 0x16, 0xcd, 0x60,
+  0x65, 0xb6, 0x90, 0xe7, 0x00, 0x5c, 0x4c, 0xb7, 0x90, 0xa1, 0x21, 0x26,
+  0xf1, 0xa6, 0x20, 0xb7, 0x88, 0x5f, 0x3f, 0x90, 0xe6, 0x00, 0xa1, 0x20,
+  0x26, 0x07, 0x3f, 0x8a, 0xae, 0x40, 0x00, 0x20, 0x0c, 0x3f, 0x8a, 0xae,
+  0x00, 0x80, 0x42, 0x58, 0x58, 0x58, 0x1c, 0x80, 0x00, 0x90, 0x5f, 0xcd,
+  0x60, 0x65, 0x9e, 0xb7, 0x8b, 0x9f, 0xb7, 0x8c, 0xa6, 0x20, 0xc7, 0x50,
+  0x5b, 0x43, 0xc7, 0x50, 0x5c, 0x4f, 0x92, 0xbd, 0x00, 0x8a, 0x5c, 0x9f,
+  0xb7, 0x8c, 0x4f, 0x92, 0xbd, 0x00, 0x8a, 0x5c, 0x9f, 0xb7, 0x8c, 0x4f,
+  0x92, 0xbd, 0x00, 0x8a, 0x5c, 0x9f, 0xb7, 0x8c, 0x4f, 0x92, 0xbd, 0x00,
+  0x8a, 0x72, 0x00, 0x50, 0x5f, 0x07, 0x72, 0x05, 0x50, 0x5f, 0xfb, 0x20,
+  0x04, 0x72, 0x10, 0x00, 0x96, 0x90, 0xa3, 0x00, 0x07, 0x27, 0x0a, 0x90,
+  0x5c, 0x1d, 0x00, 0x03, 0x1c, 0x00, 0x80, 0x20, 0xae, 0xb6, 0x90, 0xb1,
+  0x88, 0x27, 0x1c, 0x5f, 0x3c, 0x90, 0xb6, 0x90, 0x97, 0xcc, 0x00, 0xc0,
+  0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d,
+  0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x81, 0xcd, 0x60, 0x65, 0x5f,
+  0x3f, 0x97, 0x72, 0x0d, 0x00, 0x8e, 0x18, 0x72, 0x00, 0x00, 0x94, 0x0b,
+  0xa6, 0x01, 0xc7, 0x50, 0x5b, 0x43, 0xc7, 0x50, 0x5c, 0x20, 0x08, 0x35,
+  0x81, 0x50, 0x5b, 0x35, 0x7e, 0x50, 0x5c, 0x3f, 0x94, 0xf6, 0x92, 0xa7,
+  0x00, 0x8a, 0x72, 0x0c, 0x00, 0x8e, 0x13, 0x72, 0x00, 0x50, 0x5f, 0x07,
+  0x72, 0x05, 0x50, 0x5f, 0xfb, 0x20, 0x04, 0x72, 0x10, 0x00, 0x97, 0xcd,
+  0x60, 0x65, 0x9f, 0xb1, 0x88, 0x27, 0x03, 0x5c, 0x20, 0xdb, 0x72, 0x0d,
+  0x00, 0x8e, 0x10, 0x72, 0x00, 0x50, 0x5f, 0x07, 0x72, 0x05, 0x50, 0x5f,
+  0xfb, 0x20, 0x24, 0x72, 0x10, 0x00, 0x97, 0x20, 0x1e, 0x9d, 0x9d, 0x9d,
+  0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d,
+  0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d, 0x9d,
+  0x9d, 0x9d, 0x9d, 0x81,
 };
-unsigned int STM8_Routines_E_W_ROUTINEs_32K_ver_1_3_s19_len = 882;
+
+static const MemSegment_t STM8_Routines_E_W_ROUTINEs_32K_ver_1_3_segment[1] = {
+  { 0x00a0, 304, 304, (char*) STM8_Routines_E_W_ROUTINEs_32K_ver_1_3_data0 },
+};
+
+static const MemImage_t STM8_Routines_E_W_ROUTINEs_32K_ver_1_3 = { 1, 1, (MemSegment_t*) STM8_Routines_E_W_ROUTINEs_32K_ver_1_3_segment };
+
+// CRC16 of segments in memory, see bsl_memCrc()
+static const uint16_t STM8_Routines_E_W_ROUTINEs_32K_ver_1_3_crc16[1] = { 0x8cee };
@@ -0,0 +1,20 @@
+// generated from STM8_Routines/crc16_routine.s19 by tools/s19toh, don't edit
+
+static const char STM8_Routines_crc16_routine_data0[75] = {
+  0xce, 0x01, 0xf0, 0x90, 0xce, 0x01, 0xf2, 0x35, 0xff, 0x01, 0xf4, 0x35,
+  0xff, 0x01, 0xf5, 0xf6, 0xc8, 0x01, 0xf4, 0x88, 0x4e, 0xa4, 0x0f, 0x18,
+  0x01, 0x6b, 0x01, 0x4e, 0xa4, 0xf0, 0xc8, 0x01, 0xf5, 0xc7, 0x01, 0xf4,
+  0x7b, 0x01, 0x44, 0x44, 0x44, 0xc8, 0x01, 0xf4, 0xc7, 0x01, 0xf4, 0x7b,
+  0x01, 0x4e, 0xa4, 0xf0, 0x48, 0x18, 0x01, 0xc7, 0x01, 0xf5, 0x84, 0x35,
+  0xaa, 0x50, 0xe0, 0x5c, 0x90, 0x5a, 0x26, 0xcb, 0x35, 0xa5, 0x01, 0xf6,
+  0xcc, 0x60, 0x00,
+};
+
+static const MemSegment_t STM8_Routines_crc16_routine_segment[1] = {
+  { 0x0200, 75, 75, (char*) STM8_Routines_crc16_routine_data0 },
+};
+
+static const MemImage_t STM8_Routines_crc16_routine = { 1, 1, (MemSegment_t*) STM8_Routines_crc16_routine_segment };
+
+// CRC16 of segments in memory, see bsl_memCrc()
+static const uint16_t STM8_Routines_crc16_routine_crc16[1] = { 0xbf84 };
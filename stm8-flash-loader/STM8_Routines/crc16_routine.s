@@ -0,0 +1,57 @@
+; CRC16 routine for STM8 RAM, used for fast verify via ROM bootloader (BSL).
+; Computes CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) over a memory range
+; <64kB, stores the result in RAM and re-enters the BSL at 0x6000. The host
+; then re-synchronizes and reads back the result.
+;
+; Parameter block (written by host via BSL WRITE, big endian):
+;   0x01F0  start address (16b)
+;   0x01F2  number of bytes (16b), 0 means 64kB
+;   0x01F4  result CRC (16b)
+;   0x01F6  done marker, set to 0xA5 after completion
+;
+; Byte update without table (x = (crc>>8)^data; x ^= x>>4):
+;   crc_hi = crc_lo ^ ((x<<4) & 0xF0) ^ (x>>3)
+;   crc_lo = ((x<<5) & 0xE0) ^ x
+;
+; Assembled by hand (see crc16_routine.s19), syntax as for sdasstm8.
+; Address  Code         Instruction
+
+        .area   CRC16 (ABS)
+        .org    0x0200
+
+crc16:                                  ; 0200
+        ldw     x, 0x01F0               ; 0200  CE 01 F0     X = address
+        ldw     y, 0x01F2               ; 0203  90 CE 01 F2  Y = byte counter
+        mov     0x01F4, #0xFF           ; 0207  35 FF 01 F4  init CRC
+        mov     0x01F5, #0xFF           ; 020B  35 FF 01 F5
+loop:
+        ld      a, (x)                  ; 020F  F6           data byte
+        xor     a, 0x01F4               ; 0210  C8 01 F4     x = crc_hi ^ data
+        push    a                       ; 0213  88
+        swap    a                       ; 0214  4E
+        and     a, #0x0F                ; 0215  A4 0F
+        xor     a, (1, sp)              ; 0217  18 01        x ^= x>>4
+        ld      (1, sp), a              ; 0219  6B 01
+        swap    a                       ; 021B  4E
+        and     a, #0xF0                ; 021C  A4 F0        (x<<4) & 0xF0
+        xor     a, 0x01F5               ; 021E  C8 01 F5     ^ crc_lo
+        ld      0x01F4, a               ; 0221  C7 01 F4
+        ld      a, (1, sp)              ; 0224  7B 01
+        srl     a                       ; 0226  44
+        srl     a                       ; 0227  44
+        srl     a                       ; 0228  44           x>>3
+        xor     a, 0x01F4               ; 0229  C8 01 F4
+        ld      0x01F4, a               ; 022C  C7 01 F4     new crc_hi
+        ld      a, (1, sp)              ; 022F  7B 01
+        swap    a                       ; 0231  4E
+        and     a, #0xF0                ; 0232  A4 F0
+        sll     a                       ; 0234  48           (x<<5) & 0xE0
+        xor     a, (1, sp)              ; 0235  18 01        ^ x
+        ld      0x01F5, a               ; 0237  C7 01 F5     new crc_lo
+        pop     a                       ; 023A  84
+        mov     0x50E0, #0xAA           ; 023B  35 AA 50 E0  refresh IWDG (if enabled by BSL)
+        incw    x                       ; 023F  5C
+        decw    y                       ; 0240  90 5A
+        jrne    loop                    ; 0242  26 CB
+        mov     0x01F6, #0xA5           ; 0244  35 A5 01 F6  set done marker
+        jp      0x6000                  ; 0248  CC 60 00     re-enter BSL
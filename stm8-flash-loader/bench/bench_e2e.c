@@ -0,0 +1,326 @@
+/**
+  end-to-end benchmark: run the loader (stm8gal) against the BSL emulator
+  (tools/bsl_emu with wire time emulation) for a matrix of image sizes, sparsity
+  patterns, baudrates, UART modes, verify and erase strategies. Reports wall time,
+  bytes on the wire and round trips (from the emulator) per configuration and
+  compares them to a stored baseline. A configuration is flagged as regression if
+  it is more than TIME_TOLERANCE slower, or needs more bytes or round trips.
+  By default each factor is varied separately around a base configuration, -a runs
+  the full matrix. -u stores the results as new baseline.
+  Run from the directory of the Makefile (make bench-e2e). Exit code 1 on regression
+  or failure
+*/
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "misc.h"
+
+#define LOADER            "./stm8gal"
+#define EMULATOR          "./tools/bsl_emu"
+#define BASELINE          "bench/bench_e2e.baseline"
+#define FLASH_START       0x8000
+#define FLASH_KB          32          // flash size of emulated device
+#define TIME_TOLERANCE    0.20        // allowed slowdown vs. baseline
+#define TIME_SLACK        50          // allowed slowdown vs. baseline [ms]
+#define EMU_TIMEOUT       2000        // max. wait for emulator output [ms]
+#define MAX_RUNS          1000
+
+// configuration of one run
+typedef struct {
+  int       sizeKB;                   // data in image [kB]
+  char      pattern;                  // 'c'=contiguous, 's'=sparse 1kB chunks, 'f'=16B fragments
+  int       baudrate;
+  int       mode;                     // 0=duplex, 1=reply
+  int       verify;                   // 0=off, 1=CRC, 2=read back
+  char      erase;                    // 's'=sectors, 'm'=mass erase, 'n'=none, 'd'=differential
+} Config_t;
+
+// result of one run
+typedef struct {
+  char      name[100];
+  int       ok;
+  double    timeMs;                   // wall time of loader
+  unsigned  bytes;                    // bytes on wire (both directions)
+  unsigned  turns;                    // round trips
+} Result_t;
+
+// values of factors. First value is the base configuration
+static const int  SIZES[]     = {8, 1, 28};
+static const char PATTERNS[]  = {'c', 's', 'f'};
+static const int  BAUDS[]     = {115200, 230400, 921600};
+static const int  MODES[]     = {0, 1};
+static const int  VERIFIES[]  = {0, 1, 2};
+static const char ERASES[]    = {'s', 'm', 'n', 'd'};
+#define NUM(a)    ((int) (sizeof(a)/sizeof(a[0])))
+
+static char   g_dirTmp[50];           // directory for images and loader cache
+
+
+/**
+  name of configuration
+*/
+static void config_name(const Config_t *cfg, char *name) {
+  sprintf(name, "%dK-%c-%d-%s-v%d-%c", cfg->sizeKB, cfg->pattern, cfg->baudrate, cfg->mode ? "reply" : "duplex", cfg->verify, cfg->erase);
+}
+
+/**
+  span of image in flash [bytes]
+*/
+static int image_span(const Config_t *cfg) {
+  return(cfg->sizeKB * 1024 * ((cfg->pattern == 'c') ? 1 : ((cfg->pattern == 's') ? 2 : 4)));
+}
+
+/**
+  write Intel hex file with random data in given pattern
+*/
+static void write_image(const Config_t *cfg, const char *filename) {
+  FILE      *fp;
+  uint32_t  addr, numData, lenChunk, lenRec, i;
+  uint8_t   chk, data;
+
+  if ((fp = fopen(filename, "w")) == NULL) {
+    fprintf(stderr, "\n\nerror in 'bench_e2e': cannot write '%s', exit!\n\n", filename);
+    exit(1);
+  }
+  srand(cfg->sizeKB * 256 + cfg->pattern);
+  lenChunk = (cfg->pattern == 'c') ? cfg->sizeKB*1024 : ((cfg->pattern == 's') ? 1024 : 16);
+  addr = FLASH_START + ((cfg->pattern == 'f') ? 5 : 0);
+  for (numData=0; numData < (uint32_t) cfg->sizeKB*1024; numData+=lenChunk) {
+    for (i=0; i<lenChunk; i+=lenRec) {
+      lenRec = (lenChunk-i < 32) ? lenChunk-i : 32;
+      chk = lenRec + (uint8_t) ((addr+i) >> 8) + (uint8_t) (addr+i);
+      fprintf(fp, ":%02X%04X00", (unsigned) lenRec, (unsigned) ((addr+i) & 0xFFFF));
+      for (uint32_t j=0; j<lenRec; j++) {
+        data = (uint8_t) rand();
+        chk += data;
+        fprintf(fp, "%02X", data);
+      }
+      fprintf(fp, "%02X\n", (uint8_t) (-chk));
+    }
+    addr += lenChunk * ((cfg->pattern == 's') ? 2 : 4);
+  }
+  fprintf(fp, ":00000001FF\n");
+  fclose(fp);
+}
+
+/**
+  read line from emulator with timeout. Return 0 on timeout or end
+*/
+static int read_line(int fd, char *line, int len) {
+  struct pollfd   pfd;
+  int             num = 0;
+  char            c;
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+  while (num < len-1) {
+    if ((poll(&pfd, 1, EMU_TIMEOUT) <= 0) || (read(fd, &c, 1) != 1))
+      return(0);
+    if (c == '\n')
+      break;
+    line[num++] = c;
+  }
+  line[num] = '\0';
+  return(1);
+}
+
+/**
+  run loader against fresh emulator for configuration
+*/
+static void run(const Config_t *cfg, int idx, Result_t *res) {
+  char      fileImage[200], dirHome[200], port[100], line[1000], baud[20], mode[20];
+  char      *args[20];
+  int       fdPipe[2], numArgs, status;
+  pid_t     pidEmu, pidLoader;
+  uint64_t  t;
+  unsigned  rx, tx, turns;
+  char      *p;
+
+  config_name(cfg, res->name);
+  res->ok = 0;
+
+  // image and empty loader cache
+  sprintf(fileImage, "%s/image%d.ihx", g_dirTmp, idx);
+  sprintf(dirHome, "%s/home%d", g_dirTmp, idx);
+  write_image(cfg, fileImage);
+  mkdir(dirHome, 0700);
+  setenv("HOME", dirHome, 1);
+
+  // start emulator, read name of pty
+  sprintf(mode, "%d", cfg->mode);
+  if (pipe(fdPipe) != 0)
+    return;
+  if ((pidEmu = fork()) == 0) {
+    dup2(fdPipe[1], STDOUT_FILENO);
+    close(fdPipe[0]);
+    execl(EMULATOR, EMULATOR, "-c", "-m", mode, (char*) NULL);
+    _exit(1);
+  }
+  close(fdPipe[1]);
+  if (!read_line(fdPipe[0], port, sizeof(port))) {
+    fprintf(stderr, "\n\nerror in 'bench_e2e': cannot start '%s' (make tools), exit!\n\n", EMULATOR);
+    exit(1);
+  }
+
+  // run loader
+  sprintf(baud, "%d", cfg->baudrate);
+  numArgs = 0;
+  args[numArgs++] = LOADER;
+  args[numArgs++] = "-p";
+  args[numArgs++] = port;
+  args[numArgs++] = "-b";
+  args[numArgs++] = baud;
+  args[numArgs++] = "-u";
+  args[numArgs++] = mode;
+  args[numArgs++] = "-f";
+  args[numArgs++] = fileImage;
+  if (cfg->verify == 1)
+    args[numArgs++] = "-v";
+  if (cfg->verify == 2)
+    args[numArgs++] = "-V";
+  if (cfg->erase == 'm')
+    args[numArgs++] = "-m";
+  if (cfg->erase == 'n')
+    args[numArgs++] = "-n";
+  if (cfg->erase == 'd')
+    args[numArgs++] = "-d";
+  args[numArgs] = NULL;
+  t = micros();
+  if ((pidLoader = fork()) == 0) {
+    int fdNull = open("/dev/null", O_WRONLY);
+    dup2(fdNull, STDOUT_FILENO);
+    dup2(fdNull, STDERR_FILENO);
+    execv(LOADER, args);
+    _exit(127);
+  }
+  waitpid(pidLoader, &status, 0);
+  res->timeMs = (micros() - t) * 1e-3;
+  if (WIFEXITED(status) && (WEXITSTATUS(status) == 127)) {
+    fprintf(stderr, "\n\nerror in 'bench_e2e': cannot start '%s' (make), exit!\n\n", LOADER);
+    exit(1);
+  }
+
+  // wire statistics from emulator, see cmd_go() in bsl_emu.c
+  while (read_line(fdPipe[0], line, sizeof(line))) {
+    if ((strncmp(line, "GO ", 3) == 0) && ((p = strstr(line, "wire ")) != NULL) &&
+        (sscanf(p, "wire %u rx, %u tx, %u turns", &rx, &tx, &turns) == 3)) {
+      res->bytes = rx + tx;
+      res->turns = turns;
+      res->ok    = WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+      break;
+    }
+  }
+  kill(pidEmu, SIGTERM);
+  waitpid(pidEmu, NULL, 0);
+  close(fdPipe[0]);
+}
+
+
+int main(int argc, char **argv) {
+  static Config_t cfg[MAX_RUNS];
+  static Result_t res[MAX_RUNS], base[MAX_RUNS];
+  Config_t  c;
+  FILE      *fp;
+  int       numRuns, numBase, numFailed, i, j, a, b, d, e, f, g;
+  uint8_t   all = 0, update = 0;
+  char      flag[100];
+
+  for (i=1; i<argc; i++) {
+    if (!strcmp(argv[i], "-a"))
+      all = 1;
+    else if (!strcmp(argv[i], "-u"))
+      update = 1;
+    else {
+      fprintf(stderr, "usage: %s [-a] [-u]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  // configurations: full matrix, or base and each factor varied separately
+  numRuns = 0;
+  for (a=0; a<NUM(SIZES); a++)
+  for (b=0; b<NUM(PATTERNS); b++)
+  for (d=0; d<NUM(BAUDS); d++)
+  for (e=0; e<NUM(MODES); e++)
+  for (f=0; f<NUM(VERIFIES); f++)
+  for (g=0; g<NUM(ERASES); g++) {
+    if ((!all) && ((a>0) + (b>0) + (d>0) + (e>0) + (f>0) + (g>0) > 1))
+      continue;
+    c.sizeKB   = SIZES[a];
+    c.pattern  = PATTERNS[b];
+    c.baudrate = BAUDS[d];
+    c.mode     = MODES[e];
+    c.verify   = VERIFIES[f];
+    c.erase    = ERASES[g];
+    if (image_span(&c) > FLASH_KB*1024)
+      continue;
+    cfg[numRuns++] = c;
+  }
+
+  // baseline
+  numBase = 0;
+  if ((!update) && ((fp = fopen(BASELINE, "r")) != NULL)) {
+    while ((numBase < MAX_RUNS) && (fscanf(fp, "%99s %lf %u %u", base[numBase].name, &base[numBase].timeMs, &base[numBase].bytes, &base[numBase].turns) == 4))
+      numBase++;
+    fclose(fp);
+  }
+
+  strcpy(g_dirTmp, "/tmp/bench_e2e.XXXXXX");
+  if (mkdtemp(g_dirTmp) == NULL) {
+    fprintf(stderr, "\n\nerror in 'bench_e2e': cannot create temporary directory, exit!\n\n");
+    exit(1);
+  }
+
+  printf("e2e: %d configurations (size-pattern-baud-mode-verify-erase), baseline %s\n", numRuns, numBase ? BASELINE : "none");
+  printf("  %-32s %10s %8s %7s  %s\n", "configuration", "time [ms]", "bytes", "turns", "vs. baseline");
+  numFailed = 0;
+  for (i=0; i<numRuns; i++) {
+    run(&cfg[i], i, &res[i]);
+    flag[0] = '\0';
+    if (!res[i].ok) {
+      strcpy(flag, "FAIL");
+      numFailed++;
+    }
+    else {
+      for (j=0; (j<numBase) && strcmp(base[j].name, res[i].name); j++);
+      if (j < numBase) {
+        sprintf(flag, "%+5.1f%%", (res[i].timeMs / base[j].timeMs - 1) * 100);
+        if ((res[i].timeMs > base[j].timeMs * (1 + TIME_TOLERANCE) + TIME_SLACK) || (res[i].bytes > base[j].bytes) || (res[i].turns > base[j].turns)) {
+          strcat(flag, "  REGRESSION");
+          numFailed++;
+        }
+      }
+    }
+    printf("  %-32s %10.1f %8u %7u  %s\n", res[i].name, res[i].timeMs, res[i].bytes, res[i].turns, flag);
+    fflush(stdout);
+  }
+
+  // store baseline
+  if (update) {
+    if ((fp = fopen(BASELINE, "w")) == NULL) {
+      fprintf(stderr, "\n\nerror in 'bench_e2e': cannot write '%s', exit!\n\n", BASELINE);
+      exit(1);
+    }
+    for (i=0; i<numRuns; i++) {
+      if (res[i].ok)
+        fprintf(fp, "%s %.1f %u %u\n", res[i].name, res[i].timeMs, res[i].bytes, res[i].turns);
+    }
+    fclose(fp);
+    printf("  baseline stored in %s\n", BASELINE);
+  }
+
+  sprintf(flag, "rm -rf %s", g_dirTmp);
+  if (system(flag) != 0)
+    fprintf(stderr, "cannot remove %s\n", g_dirTmp);
+
+  return(numFailed ? 1 : 0);
+}
@@ -0,0 +1,247 @@
+/**
+  microbenchmark for hexfile.c. Generates an Intel hex and a Motorola S19 file
+  with NUM_DATA bytes of random data (NUM_RECORD bytes per record) in memory,
+  decodes them with convert_hex() and convert_s19() and checks the resulting
+  memory images. For comparison the Intel hex file is also decoded with the
+  previous two-pass sprintf/sscanf decoder (see legacy_convert_hex() below).
+  Reports time and throughput per file
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "misc.h"
+#include "memimage.h"
+#include "hexfile.h"
+
+#define NUM_DATA          (4*1024*1024)
+#define NUM_RECORD        32
+#define ADDR_START        0x8000
+#define NUM_RUNS          3
+
+/**
+  read line from RAM buffer and advance buffer pointer (previous get_line())
+*/
+static char *legacy_get_line(char **buf, char *line) {
+  char  *p = line;
+
+  while ((**buf!=10) && (**buf!=13) && (**buf!=0)) {
+    *line = **buf;
+    line++;
+    (*buf)++;
+  }
+  while ((**buf==10) || (**buf==13))
+    (*buf)++;
+  *line = '\0';
+  if (p == line)
+    return(NULL);
+  return(p);
+}
+
+/**
+  previous Intel hex decoder: 1st pass checks syntax, 2nd pass stores data, each
+  byte is decoded via sprintf/strncpy/sscanf. Requires 0-terminated buffer (see
+  generate_hex()), numBytes is ignored. Error messages removed
+*/
+static uint8_t legacy_convert_hex(const char *buf, uint32_t numBytes, MemImage_t *image, char *error) {
+  char      line[1000], tmp[1000], data[256], *p;
+  int       idx, i;
+  uint8_t   type, len, chkCalc;
+  uint32_t  addrOff, val;
+
+  // 1st run: check syntax
+  p = (char*) buf;
+  while (legacy_get_line(&p, line)) {
+    chkCalc = 0x00;
+    sprintf(tmp,"0x00");
+    strncpy(tmp+2, line+1, 2);
+    sscanf(tmp, "%x", &val);
+    len = val;
+    chkCalc += len;
+    sprintf(tmp,"0x0000");
+    strncpy(tmp+2, line+3, 4);
+    sscanf(tmp, "%x", &val);
+    chkCalc += (uint8_t) (val >> 8);
+    chkCalc += (uint8_t)  val;
+    sprintf(tmp,"0x00");
+    strncpy(tmp+2, line+7, 2);
+    sscanf(tmp, "%x", &val);
+    type = val;
+    chkCalc += type;
+    if (type==0) {
+      idx = 9;
+      for (i=0; i<len; i++) {
+        sprintf(tmp,"0x00");
+        strncpy(tmp+2, line+idx, 2);
+        sscanf(tmp, "%x", &val);
+        chkCalc += val;
+        idx+=2;
+      }
+    }
+    else if (type==4) {
+      sprintf(tmp,"0x0000");
+      strncpy(tmp+2, line+9, 4);
+      sscanf(tmp, "%x", &val);
+      chkCalc += (uint8_t) (val >> 8);
+      chkCalc += (uint8_t)  val;
+    }
+    sprintf(tmp,"0x00");
+    strncpy(tmp+2, line+9+2*len, 2);
+    sscanf(tmp, "%x", &val);
+    chkCalc = 255 - chkCalc + 1;
+    if (chkCalc != val)
+      printf("wrong checksum");
+  }
+
+  // 2nd run: store data to image
+  addrOff = 0x00000000;
+  p = (char*) buf;
+  while (legacy_get_line(&p, line)) {
+    sprintf(tmp,"0x00");
+    strncpy(tmp+2, line+1, 2);
+    sscanf(tmp, "%x", &val);
+    len = val;
+    sprintf(tmp,"0x0000");
+    strncpy(tmp+2, line+3, 4);
+    sscanf(tmp, "%x", &val);
+    idx = val;
+    sprintf(tmp,"0x00");
+    strncpy(tmp+2, line+7, 2);
+    sscanf(tmp, "%x", &val);
+    type = val;
+    if (type==0) {
+      uint32_t addr = idx;
+      idx = 9;
+      for (i=0; i<len; i++) {
+        sprintf(tmp,"0x00");
+        strncpy(tmp+2, line+idx, 2);
+        sscanf(tmp, "%x", &val);
+        data[i] = val;
+        idx+=2;
+      }
+      image_setData(image, addr+addrOff, len, data);
+    }
+    else if (type==4) {
+      sprintf(tmp,"0x0000");
+      strncpy(tmp+2, line+9, 4);
+      sscanf(tmp, "%x", &val);
+      addrOff = val << 16;
+    }
+  }
+  return(0);
+}
+
+/**
+  generate Intel hex file from data. Return length of file
+*/
+static uint32_t generate_hex(const uint8_t *data, char *buf) {
+  char      *p = buf;
+  uint32_t  addr, i, j;
+  uint8_t   chk;
+
+  for (i=0; i<NUM_DATA; i+=NUM_RECORD) {
+    addr = ADDR_START + i;
+
+    // extended linear address at 64kB boundaries
+    if ((i == 0) || ((addr & 0xFFFF) == 0)) {
+      chk = 2 + 4 + (uint8_t) (addr >> 24) + (uint8_t) (addr >> 16);
+      p += sprintf(p, ":02000004%04X%02X\n", (unsigned) (addr >> 16), (uint8_t) (-chk));
+    }
+    chk = NUM_RECORD + (uint8_t) (addr >> 8) + (uint8_t) addr;
+    p += sprintf(p, ":%02X%04X00", NUM_RECORD, (unsigned) (addr & 0xFFFF));
+    for (j=0; j<NUM_RECORD; j++) {
+      p += sprintf(p, "%02X", data[i+j]);
+      chk += data[i+j];
+    }
+    p += sprintf(p, "%02X\n", (uint8_t) (-chk));
+  }
+  p += sprintf(p, ":00000001FF\n");
+  return(p - buf);
+}
+
+/**
+  generate Motorola S19 file (S3 records) from data. Return length of file
+*/
+static uint32_t generate_s19(const uint8_t *data, char *buf) {
+  char      *p = buf;
+  uint32_t  addr, i, j;
+  uint8_t   chk;
+
+  for (i=0; i<NUM_DATA; i+=NUM_RECORD) {
+    addr = ADDR_START + i;
+    chk = (NUM_RECORD+5) + (uint8_t) (addr >> 24) + (uint8_t) (addr >> 16) + (uint8_t) (addr >> 8) + (uint8_t) addr;
+    p += sprintf(p, "S3%02X%08X", NUM_RECORD+5, (unsigned) addr);
+    for (j=0; j<NUM_RECORD; j++) {
+      p += sprintf(p, "%02X", data[i+j]);
+      chk += data[i+j];
+    }
+    p += sprintf(p, "%02X\n", (uint8_t) (~chk));
+  }
+  p += sprintf(p, "S705000080007A\n");
+  return(p - buf);
+}
+
+/**
+  check that image contains exactly the generated data
+*/
+static void check_image(const char *name, const MemImage_t *image, const uint8_t *data) {
+  if ((image->numSegments != 1) || (image->segment[0].addrStart != ADDR_START) ||
+      (image->segment[0].numBytes != NUM_DATA) || memcmp(image->segment[0].data, data, NUM_DATA)) {
+    fprintf(stderr, "\n\nerror in 'bench_hexfile': wrong image for %s, exit!\n\n", name);
+    exit(1);
+  }
+}
+
+/**
+  decode file NUM_RUNS times, check image and print best time
+*/
+static double run(const char *name, uint8_t (*convert)(const char*, uint32_t, MemImage_t*, char*), char *buf, uint32_t len, const uint8_t *data) {
+  MemImage_t  image;
+  char        error[HEXFILE_ERRLEN];
+  uint64_t    t, tBest = 0;
+  int         i;
+
+  for (i=0; i<NUM_RUNS; i++) {
+    image_init(&image);
+    t = micros();
+    convert(buf, len, &image, error);
+    t = micros() - t;
+    check_image(name, &image, data);
+    image_free(&image);
+    if ((i == 0) || (t < tBest))
+      tBest = t;
+  }
+  printf("  %-22s %9.1f ms %8.1f MB/s\n", name, tBest*1e-3, len/(double) tBest);
+  return(tBest);
+}
+
+
+int main(int argc, char **argv) {
+  uint8_t   *data;
+  char      *bufHex, *bufS19;
+  uint32_t  lenHex, lenS19, i;
+  double    tLegacy, tNew;
+
+  // random data and files (max. 3 chars per byte + record overhead)
+  data   = (uint8_t*) malloc(NUM_DATA);
+  bufHex = (char*) malloc(3*NUM_DATA);
+  bufS19 = (char*) malloc(3*NUM_DATA);
+  srand(1);
+  for (i=0; i<NUM_DATA; i++)
+    data[i] = (uint8_t) rand();
+  lenHex = generate_hex(data, bufHex);
+  lenS19 = generate_s19(data, bufS19);
+
+  printf("hexfile: decode %d kB data (%.1f MB hex, %.1f MB s19)\n", NUM_DATA/1024, lenHex*1e-6, lenS19*1e-6);
+  tLegacy = run("hex, sscanf (legacy)", legacy_convert_hex, bufHex, lenHex, data);
+  tNew    = run("hex, table", convert_hex, bufHex, lenHex, data);
+  run("s19, table", convert_s19, bufS19, lenS19, data);
+  printf("  speedup hex: %.1fx\n", tLegacy/tNew);
+
+  free(data);
+  free(bufHex);
+  free(bufS19);
+
+  return(0);
+}
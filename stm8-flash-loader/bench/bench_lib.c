@@ -0,0 +1,320 @@
+/**
+  library benchmark: per-board overhead of an in-process BSL session (libstm8bsl.a)
+  compared to spawning a process per board. All variants flash the same image to
+  the BSL emulator (tools/bsl_emu without wire time emulation and flash programming
+  time, i.e. the protocol cost is small and the overhead is visible):
+    library     open port, sync, GET, E_W routine check, sector erase, write, GO in-process
+    spawn       the same session in a child process (fork/exec of this benchmark with -x),
+                i.e. process creation, image load and exit on top of the library session
+    stm8gal     complete loader per board for reference (incl. reset via UART command
+                and baudrate switch, ~0.25s of fixed waits)
+  The device stays in the BSL after GO (emulator), so each board starts a new session.
+  Reports wall and CPU time per board. Run from the directory of the Makefile
+  (make bench-lib)
+*/
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "misc.h"
+#include "memimage.h"
+#include "hexfile.h"
+#include "serial_comm.h"
+#include "bootloader.h"
+#include "flash.h"
+#include "E_W_ROUTINEs.h"
+
+#define LOADER            "./stm8gal"
+#define EMULATOR          "./tools/bsl_emu"
+#define ROUTINE           "32K_ver_1.3"   // E_W routine of emulated device
+#define NUM_DATA          8192            // bytes in image
+#define NUM_BOARDS        20              // default boards per variant
+#define BAUDRATE          115200
+#define EMU_TIMEOUT       2000            // max. wait for emulator output [ms]
+
+static char   g_dirTmp[50];               // directory for image and loader cache
+
+
+/**
+  write Intel hex file with NUM_DATA random bytes at start of flash
+*/
+static void write_image(const char *filename) {
+  char        *buf, data[NUM_DATA];
+  uint32_t    len, addrUpper = 0;
+  FILE        *fp;
+  int         i;
+
+  srand(1);
+  for (i=0; i<NUM_DATA; i++)
+    data[i] = (char) rand();
+  len = encode_hex(NULL, PFLASH_START, data, NUM_DATA, &addrUpper) + encode_hexEnd(NULL);
+  buf = (char*) malloc(len+1);
+  addrUpper = 0;
+  len = encode_hex(buf, PFLASH_START, data, NUM_DATA, &addrUpper);
+  len += encode_hexEnd(buf+len);
+  if (((fp = fopen(filename, "w")) == NULL) || (fwrite(buf, 1, len, fp) != len)) {
+    fprintf(stderr, "\n\nerror in 'bench_lib': cannot write '%s', exit!\n\n", filename);
+    exit(1);
+  }
+  fclose(fp);
+  free(buf);
+}
+
+/**
+  flash image to one board via library session on port. Return status (BSL_OK on success)
+*/
+static uint8_t board(const char *port, const MemImage_t *image, const MemImage_t *routine) {
+  Bsl_t     bsl;
+  HANDLE    ptrPort;
+  uint8_t   codes[256], resident, status;
+  int       numSectors;
+
+  if (!(ptrPort = init_port(port, BAUDRATE, 1000, 8, 0, 1, 0, 0)))
+    return(BSL_ERR_PORT);
+  bsl_init(&bsl, ptrPort, UART_MODE_DUPLEX);
+  if (((status = bsl_sync(&bsl)) == BSL_OK) &&
+      ((status = bsl_getInfo(&bsl)) == BSL_OK) &&
+      ((status = bsl_memResident(&bsl, routine, ROUTINE_SIGNATURE, &resident)) == BSL_OK) &&
+      (resident || ((status = bsl_memWriteImage(&bsl, routine)) == BSL_OK)) &&
+      ((numSectors = bsl_getSectors(image, codes)) > 0) &&
+      ((status = bsl_flashSectorErase(&bsl, codes, numSectors)) == BSL_OK) &&
+      ((status = bsl_flashWriteImage(&bsl, image, ERASE_SECTORS, NULL, NULL)) == BSL_OK))
+    status = bsl_jumpTo(&bsl, PFLASH_START);
+  if (status != BSL_OK)
+    fprintf(stderr, "%s\n", bsl.error);
+  close_port(&bsl.port);
+
+  return(status);
+}
+
+/**
+  get E_W routine of emulated device from registry
+*/
+static const MemImage_t *get_routine(void) {
+  int   i;
+
+  for (i=0; i<NUM_E_W_ROUTINES; i++) {
+    if (!strcmp(E_W_ROUTINES[i].name, ROUTINE))
+      return(E_W_ROUTINES[i].image);
+  }
+  fprintf(stderr, "\n\nerror in 'bench_lib': no E_W routine %s, exit!\n\n", ROUTINE);
+  exit(1);
+}
+
+/**
+  child mode (-x port file): load image and flash one board. Exit code 0 on success
+*/
+static int run_child(const char *port, const char *file) {
+  MemImage_t  image;
+  char        error[HEXFILE_ERRLEN];
+  uint8_t     status;
+
+  image_init(&image);
+  if (load_image(file, &image, error)) {
+    fprintf(stderr, "%s\n", error);
+    return(1);
+  }
+  status = board(port, &image, get_routine());
+  image_free(&image);
+  return(status != BSL_OK);
+}
+
+/**
+  discard pending emulator output, i.e. the statistics line printed on each GO
+*/
+static void drain(int fd) {
+  struct pollfd   pfd;
+  char            buf[1000];
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+  while ((poll(&pfd, 1, 0) > 0) && (read(fd, buf, sizeof(buf)) > 0));
+}
+
+/**
+  spawn program with arguments, output discarded. Return exit code
+*/
+static int spawn(char **args) {
+  pid_t     pid;
+  int       status, fdNull;
+
+  if ((pid = fork()) == 0) {
+    fdNull = open("/dev/null", O_WRONLY);
+    dup2(fdNull, STDOUT_FILENO);
+    dup2(fdNull, STDERR_FILENO);
+    execv(args[0], args);
+    _exit(127);
+  }
+  waitpid(pid, &status, 0);
+  return(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
+
+/**
+  CPU time (user + system) of this process and its terminated children [us]
+*/
+static uint64_t cpu_time(void) {
+  struct rusage   self, child;
+
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &child);
+  return((uint64_t) (self.ru_utime.tv_sec + self.ru_stime.tv_sec + child.ru_utime.tv_sec + child.ru_stime.tv_sec) * 1000000 +
+    self.ru_utime.tv_usec + self.ru_stime.tv_usec + child.ru_utime.tv_usec + child.ru_stime.tv_usec);
+}
+
+/**
+  flash numBoards boards with variant (0=library, 1=spawn, 2=stm8gal). Print time per board,
+  return wall time per board [ms], or -1 on failure. CPU time per board [ms] in cpu
+*/
+static double run(int variant, const char *name, const char *port, const char *file, const MemImage_t *image, int numBoards, int fdEmu, const char *self, double *cpu) {
+  char      *args[20];
+  uint64_t  t, tCpu;
+  int       i, numArgs, result = 0;
+  double    ms;
+
+  // arguments of spawned process
+  numArgs = 0;
+  if (variant == 1) {
+    args[numArgs++] = (char*) self;
+    args[numArgs++] = "-x";
+  }
+  else {
+    args[numArgs++] = LOADER;
+    args[numArgs++] = "-b";
+    args[numArgs++] = "115200";
+    args[numArgs++] = "-u";
+    args[numArgs++] = "0";
+    args[numArgs++] = "-f";
+    args[numArgs++] = (char*) file;
+    args[numArgs++] = "-p";
+  }
+  args[numArgs++] = (char*) port;
+  if (variant == 1)
+    args[numArgs++] = (char*) file;
+  args[numArgs] = NULL;
+
+  t    = micros();
+  tCpu = cpu_time();
+  for (i=0; (i<numBoards) && (result == 0); i++) {
+    if (variant == 0)
+      result = board(port, image, get_routine());
+    else
+      result = spawn(args);
+    drain(fdEmu);
+  }
+  t    = micros() - t;
+  tCpu = cpu_time() - tCpu;
+  if (result != 0) {
+    printf("  %-10s FAIL (board %d, code %d)\n", name, i, result);
+    return(-1);
+  }
+
+  ms   = t * 1e-3 / numBoards;
+  *cpu = tCpu * 1e-3 / numBoards;
+  printf("  %-10s %9.2f ms %9.2f ms\n", name, ms, *cpu);
+  fflush(stdout);
+  return(ms);
+}
+
+/**
+  read line from emulator with timeout. Return 0 on timeout or end
+*/
+static int read_line(int fd, char *line, int len) {
+  struct pollfd   pfd;
+  int             num = 0;
+  char            c;
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+  while (num < len-1) {
+    if ((poll(&pfd, 1, EMU_TIMEOUT) <= 0) || (read(fd, &c, 1) != 1))
+      return(0);
+    if (c == '\n')
+      break;
+    line[num++] = c;
+  }
+  line[num] = '\0';
+  return(1);
+}
+
+
+int main(int argc, char **argv) {
+  char        file[200], port[100], error[HEXFILE_ERRLEN], cmd[100];
+  MemImage_t  image;
+  int         fdPipe[2], numBoards = NUM_BOARDS, numFailed = 0;
+  pid_t       pidEmu;
+  double      tLib, tSpawn, tLoader, cpuLib, cpuSpawn, cpuLoader;
+
+  if ((argc == 4) && (!strcmp(argv[1], "-x")))
+    return(run_child(argv[2], argv[3]));
+  if ((argc == 3) && (!strcmp(argv[1], "-n")))
+    numBoards = atoi(argv[2]);
+  else if (argc != 1) {
+    fprintf(stderr, "usage: %s [-n boards]\n", argv[0]);
+    exit(1);
+  }
+  if (numBoards < 1)
+    numBoards = 1;
+
+  // image and empty loader cache
+  strcpy(g_dirTmp, "/tmp/bench_lib.XXXXXX");
+  if (mkdtemp(g_dirTmp) == NULL) {
+    fprintf(stderr, "\n\nerror in 'bench_lib': cannot create temporary directory, exit!\n\n");
+    exit(1);
+  }
+  setenv("HOME", g_dirTmp, 1);
+  sprintf(file, "%s/image.ihx", g_dirTmp);
+  write_image(file);
+  image_init(&image);
+  if (load_image(file, &image, error)) {
+    fprintf(stderr, "\n\n%s, exit!\n\n", error);
+    exit(1);
+  }
+
+  // start emulator (in BSL, duplex mode), read name of pty
+  if (pipe(fdPipe) != 0)
+    exit(1);
+  if ((pidEmu = fork()) == 0) {
+    dup2(fdPipe[1], STDOUT_FILENO);
+    close(fdPipe[0]);
+    execl(EMULATOR, EMULATOR, "-m", "0", "-w", "0", "-e", "0", (char*) NULL);
+    _exit(1);
+  }
+  close(fdPipe[1]);
+  if (!read_line(fdPipe[0], port, sizeof(port))) {
+    fprintf(stderr, "\n\nerror in 'bench_lib': cannot start '%s' (make tools), exit!\n\n", EMULATOR);
+    exit(1);
+  }
+
+  // warm up: E_W routine is resident for all variants
+  if (board(port, &image, get_routine()) != BSL_OK)
+    exit(1);
+  drain(fdPipe[0]);
+
+  printf("lib: %d boards per variant, %d kB image via %s\n", numBoards, NUM_DATA/1024, port);
+  printf("  %-10s %12s %12s\n", "variant", "wall/board", "CPU/board");
+  tLib    = run(0, "library", port, file, &image, numBoards, fdPipe[0], argv[0], &cpuLib);
+  tSpawn  = run(1, "spawn", port, file, &image, numBoards, fdPipe[0], argv[0], &cpuSpawn);
+  tLoader = run(2, "stm8gal", port, file, &image, numBoards, fdPipe[0], argv[0], &cpuLoader);
+  numFailed = (tLib < 0) + (tSpawn < 0) + (tLoader < 0);
+  if ((tLib > 0) && (tSpawn > 0))
+    printf("  process overhead per board: wall %+.2f ms, CPU %+.2f ms (%.1fx library)\n", tSpawn - tLib, cpuSpawn - cpuLib, cpuSpawn / cpuLib);
+
+  kill(pidEmu, SIGTERM);
+  waitpid(pidEmu, NULL, 0);
+  close(fdPipe[0]);
+  image_free(&image);
+  sprintf(cmd, "rm -rf %s", g_dirTmp);
+  if (system(cmd) != 0)
+    fprintf(stderr, "cannot remove %s\n", g_dirTmp);
+
+  return(numFailed ? 1 : 0);
+}
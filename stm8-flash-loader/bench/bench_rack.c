@@ -0,0 +1,397 @@
+/**
+  rack benchmark: flash a rack of boards in parallel, one BSL emulator per port (tools/bsl_emu
+  incl. flash programming and erase times). Each board runs the same sequence: SYNCH,
+  upload E_W routine to RAM, erase sectors, write image, read back and compare, GO.
+    threads   one blocking session per port in its own thread (bsl_sync() etc.)
+    rack      all ports in one thread, non-blocking sessions advanced by one epoll loop
+              as their bytes arrive (bsl_opSync() etc., see rack.c)
+  Reports total rack time and CPU time (user + system) of the loader, i.e. this process,
+  and its context switches. The emulators are separate processes and not counted. The
+  sessions don't record statistics or trace (see Bsl_t), i.e. the threads share no state.
+  Run from the directory of the Makefile (make bench-rack)
+  Usage: bench_rack [-n ports] [-k kB] [-m mode] [-c]
+    -n ports    number of ports/emulators (default 64)
+    -k kB       image size per board (default 8)
+    -m mode     UART mode: 0=duplex, 1=reply (default 0)
+    -c          emulate wire time (bsl_emu -c)
+*/
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "misc.h"
+#include "memimage.h"
+#include "serial_comm.h"
+#include "bootloader.h"
+#include "rack.h"
+#include "flash.h"
+#include "E_W_ROUTINEs.h"
+
+#define EMULATOR          "./tools/bsl_emu"
+#define ROUTINE           "32K_ver_1.3"   // E_W routine of emulated device
+#define NUM_PORTS         64              // default number of ports
+#define NUM_KB            8               // default image size [kB]
+#define BAUDRATE          115200
+#define TIMEOUT           1000            // response timeout [ms]
+#define EMU_TIMEOUT       2000            // max. wait for emulator output [ms]
+
+// steps of a board, see board_next()
+#define STEP_SYNC         0
+#define STEP_ROUTINE      1
+#define STEP_ERASE        2
+#define STEP_WRITE        3
+#define STEP_READ         4
+#define STEP_GO           5
+#define STEP_DONE         6
+
+// board on one port
+typedef struct {
+  char              port[100];            // name of pty
+  pid_t             pidEmu;               // emulator
+  int               fdEmu;                // output of emulator
+  uint8_t           mode;                 // UART mode
+  const MemImage_t  *image;               // image to flash (one segment)
+  const MemImage_t  *routine;             // E_W routine
+  const uint8_t     *codes;               // sectors to erase
+  int               numSectors;
+  char              *buf;                 // image read back
+  int               step;                 // current step (rack)
+  int               segment;              // current routine segment (rack)
+  uint8_t           status;               // result, see BSL_OK
+  char              error[200];           // message on failure
+} Board_t;
+
+
+/**
+  get E_W routine of emulated device from registry
+*/
+static const MemImage_t *get_routine(void) {
+  int   i;
+
+  for (i=0; i<NUM_E_W_ROUTINES; i++) {
+    if (!strcmp(E_W_ROUTINES[i].name, ROUTINE))
+      return(E_W_ROUTINES[i].image);
+  }
+  fprintf(stderr, "\n\nerror in 'bench_rack': no E_W routine %s, exit!\n\n", ROUTINE);
+  exit(1);
+}
+
+/**
+  compare image read back. Return status
+*/
+static uint8_t board_compare(Board_t *board) {
+  const MemSegment_t  *seg = board->image->segment;
+
+  if (memcmp(board->buf, seg->data, seg->numBytes) == 0)
+    return(BSL_OK);
+  snprintf(board->error, sizeof(board->error), "error in 'board_compare()': memory differs from image");
+  return(BSL_ERR_VERIFY);
+}
+
+/**
+  thread of variant 'threads': flash board via blocking session
+*/
+static void *board_thread(void *arg) {
+  Board_t             *board = (Board_t*) arg;
+  const MemSegment_t  *seg = board->image->segment;
+  Bsl_t               bsl;
+  HANDLE              ptrPort;
+  uint8_t             status;
+
+  if (!(ptrPort = init_port(board->port, BAUDRATE, TIMEOUT, 8, 0, 1, 0, 0))) {
+    board->status = BSL_ERR_PORT;
+    snprintf(board->error, sizeof(board->error), "error in 'board_thread()': cannot open port '%s'", board->port);
+    return(NULL);
+  }
+  bsl_init(&bsl, ptrPort, board->mode);
+  if (((status = bsl_sync(&bsl)) == BSL_OK) &&
+      ((status = bsl_memWriteImage(&bsl, board->routine)) == BSL_OK) &&
+      ((status = bsl_flashSectorErase(&bsl, board->codes, board->numSectors)) == BSL_OK) &&
+      ((status = bsl_memWriteImage(&bsl, board->image)) == BSL_OK) &&
+      ((status = bsl_memRead(&bsl, seg->addrStart, seg->numBytes, board->buf)) == BSL_OK) &&
+      ((status = board_compare(board)) == BSL_OK))
+    status = bsl_jumpTo(&bsl, PFLASH_START);
+  if ((status != BSL_OK) && (status != BSL_ERR_VERIFY))
+    strcpy(board->error, bsl.error);
+  board->status = status;
+  close_port(&bsl.port);
+
+  return(NULL);
+}
+
+/**
+  start operation of current step of board in rack
+*/
+static void board_start(RackPort_t *port, Board_t *board) {
+  const MemSegment_t  *seg = board->image->segment;
+  const MemSegment_t  *routine;
+
+  switch (board->step) {
+    case STEP_SYNC:
+      bsl_opSync(&(port->op));
+      break;
+    case STEP_ROUTINE:
+      routine = board->routine->segment + board->segment;
+      bsl_opWrite(&(port->op), routine->addrStart, routine->numBytes, routine->data);
+      break;
+    case STEP_ERASE:
+      bsl_opErase(&(port->op), board->codes, board->numSectors);
+      break;
+    case STEP_WRITE:
+      bsl_opWrite(&(port->op), seg->addrStart, seg->numBytes, seg->data);
+      break;
+    case STEP_READ:
+      bsl_opRead(&(port->op), seg->addrStart, seg->numBytes, board->buf);
+      break;
+    case STEP_GO:
+      bsl_opGo(&(port->op), PFLASH_START);
+      break;
+  }
+}
+
+/**
+  done callback of variant 'rack': check result of operation and start next step
+*/
+static void board_next(RackPort_t *port, void *arg) {
+  Board_t   *board = (Board_t*) arg;
+
+  if (port->op.status != BSL_OK) {
+    board->status = port->op.status;
+    strcpy(board->error, port->bsl.error);
+    return;
+  }
+  if ((board->step == STEP_READ) && ((board->status = board_compare(board)) != BSL_OK))
+    return;
+
+  // next routine segment, else next step
+  if ((board->step == STEP_ROUTINE) && (++board->segment < board->routine->numSegments)) {
+    board_start(port, board);
+    return;
+  }
+  if (++board->step < STEP_DONE)
+    board_start(port, board);
+}
+
+/**
+  discard pending emulator output, i.e. the statistics line printed on each GO
+*/
+static void drain(int fd) {
+  struct pollfd   pfd;
+  char            buf[1000];
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+  while ((poll(&pfd, 1, 0) > 0) && (read(fd, buf, sizeof(buf)) > 0));
+}
+
+/**
+  read line from emulator with timeout. Return 0 on timeout or end
+*/
+static int read_line(int fd, char *line, int len) {
+  struct pollfd   pfd;
+  int             num = 0;
+  char            c;
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+  while (num < len-1) {
+    if ((poll(&pfd, 1, EMU_TIMEOUT) <= 0) || (read(fd, &c, 1) != 1))
+      return(0);
+    if (c == '\n')
+      break;
+    line[num++] = c;
+  }
+  line[num] = '\0';
+  return(1);
+}
+
+/**
+  start emulator of board (in BSL), read name of its pty. Return 0 on failure
+*/
+static int start_emulator(Board_t *board, uint8_t wireTime) {
+  int       fdPipe[2];
+  char      mode[4];
+
+  if (pipe(fdPipe) != 0)
+    return(0);
+  sprintf(mode, "%d", (int) board->mode);
+  if ((board->pidEmu = fork()) == 0) {
+    dup2(fdPipe[1], STDOUT_FILENO);
+    close(fdPipe[0]);
+    close(fdPipe[1]);
+    if (wireTime)
+      execl(EMULATOR, EMULATOR, "-m", mode, "-c", (char*) NULL);
+    else
+      execl(EMULATOR, EMULATOR, "-m", mode, (char*) NULL);
+    _exit(1);
+  }
+  close(fdPipe[1]);
+  board->fdEmu = fdPipe[0];
+
+  return(read_line(board->fdEmu, board->port, sizeof(board->port)));
+}
+
+/**
+  CPU time (user + system) of this process incl. all threads [us], and number of context switches
+*/
+static uint64_t cpu_time(long *numSwitch) {
+  struct rusage   self;
+
+  getrusage(RUSAGE_SELF, &self);
+  *numSwitch = self.ru_nvcsw + self.ru_nivcsw;
+  return((uint64_t) (self.ru_utime.tv_sec + self.ru_stime.tv_sec) * 1000000 + self.ru_utime.tv_usec + self.ru_stime.tv_usec);
+}
+
+/**
+  flash all boards with variant (0=threads, 1=rack). Print rack time, CPU time and context
+  switches. Return rack time [ms], or -1 on failure. CPU time [ms] in cpu
+*/
+static double run(int variant, const char *name, Board_t *board, int numPorts, double *cpu) {
+  pthread_t   thread[RACK_MAXPORTS];
+  Rack_t      rack;
+  RackPort_t  *port;
+  uint64_t    t, tCpu;
+  long        numSwitch, numSwitchStart;
+  int         i, numFailed = 0;
+
+  for (i=0; i<numPorts; i++) {
+    board[i].status  = BSL_OK;
+    board[i].step    = STEP_SYNC;
+    board[i].segment = 0;
+    board[i].error[0] = '\0';
+  }
+
+  t    = micros();
+  tCpu = cpu_time(&numSwitchStart);
+  if (variant == 0) {
+    for (i=0; i<numPorts; i++)
+      pthread_create(&thread[i], NULL, board_thread, board+i);
+    for (i=0; i<numPorts; i++)
+      pthread_join(thread[i], NULL);
+  }
+  else {
+    if (rack_init(&rack)) {
+      fprintf(stderr, "%s\n", rack.error);
+      return(-1);
+    }
+    for (i=0; i<numPorts; i++) {
+      if ((port = rack_open(&rack, board[i].port, BAUDRATE, board[i].mode, TIMEOUT, board_next, board+i)) == NULL) {
+        board[i].status = BSL_ERR_PORT;
+        strcpy(board[i].error, rack.error);
+        continue;
+      }
+      board_start(port, board+i);
+    }
+    if (rack_run(&rack))
+      fprintf(stderr, "%s\n", rack.error);
+    rack_close(&rack);
+  }
+  t    = micros() - t;
+  tCpu = cpu_time(&numSwitch) - tCpu;
+
+  for (i=0; i<numPorts; i++) {
+    drain(board[i].fdEmu);
+    if (board[i].status != BSL_OK) {
+      if (numFailed++ == 0)
+        fprintf(stderr, "%s: %s\n", board[i].port, board[i].error);
+    }
+  }
+  if (numFailed) {
+    printf("  %-10s FAIL (%d boards)\n", name, numFailed);
+    return(-1);
+  }
+
+  *cpu = tCpu * 1e-3;
+  printf("  %-10s %9.1f ms %9.1f ms %9.2f ms %9ld\n", name, t * 1e-3, *cpu, *cpu / numPorts, numSwitch - numSwitchStart);
+  fflush(stdout);
+  return(t * 1e-3);
+}
+
+
+int main(int argc, char **argv) {
+  Board_t     *board;
+  MemImage_t  image;
+  char        *data;
+  uint8_t     codes[256], mode = UART_MODE_DUPLEX, wireTime = 0;
+  int         i, numPorts = NUM_PORTS, numKB = NUM_KB, numSectors, numFailed;
+  double      tThreads, tRack, cpuThreads, cpuRack;
+
+  for (i=1; i<argc; i++) {
+    if ((!strcmp(argv[i], "-n")) && (i+1 < argc))
+      numPorts = atoi(argv[++i]);
+    else if ((!strcmp(argv[i], "-k")) && (i+1 < argc))
+      numKB = atoi(argv[++i]);
+    else if ((!strcmp(argv[i], "-m")) && (i+1 < argc))
+      mode = (uint8_t) atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-c"))
+      wireTime = 1;
+    else {
+      fprintf(stderr, "usage: %s [-n ports] [-k kB] [-m mode] [-c]\n", argv[0]);
+      exit(1);
+    }
+  }
+  if ((numPorts < 1) || (numPorts > RACK_MAXPORTS) || (numKB < 1) || (numKB > 24) || (mode > UART_MODE_REPLY)) {
+    fprintf(stderr, "\n\nerror in 'bench_rack': 1..%d ports, 1..24kB, mode 0 or 1, exit!\n\n", RACK_MAXPORTS);
+    exit(1);
+  }
+
+  // random image at start of flash, and its sectors
+  srand(1);
+  data = (char*) malloc(numKB * 1024);
+  image_init(&image);
+  if (data == NULL) {
+    fprintf(stderr, "\n\nerror in 'bench_rack': cannot allocate image, exit!\n\n");
+    exit(1);
+  }
+  for (i=0; i<numKB*1024; i++)
+    data[i] = (char) rand();
+  if (!image_setData(&image, PFLASH_START, numKB * 1024, data)) {
+    fprintf(stderr, "\n\nerror in 'bench_rack': cannot allocate image, exit!\n\n");
+    exit(1);
+  }
+  free(data);
+  numSectors = bsl_getSectors(&image, codes);
+
+  // emulator per board
+  board = (Board_t*) calloc(numPorts, sizeof(Board_t));
+  for (i=0; i<numPorts; i++) {
+    board[i].mode       = mode;
+    board[i].image      = &image;
+    board[i].routine    = get_routine();
+    board[i].codes      = codes;
+    board[i].numSectors = numSectors;
+    board[i].buf        = (char*) malloc(numKB * 1024);
+    if (!start_emulator(board+i, wireTime)) {
+      fprintf(stderr, "\n\nerror in 'bench_rack': cannot start '%s' (make tools), exit!\n\n", EMULATOR);
+      exit(1);
+    }
+  }
+
+  printf("rack: %d ports, %d kB image per board, %s mode%s\n", numPorts, numKB, (mode == UART_MODE_DUPLEX) ? "duplex" : "reply",
+    wireTime ? ", wire time" : "");
+  printf("  %-10s %12s %12s %12s %9s\n", "variant", "rack time", "CPU", "CPU/port", "switches");
+  tThreads = run(0, "threads", board, numPorts, &cpuThreads);
+  tRack    = run(1, "rack", board, numPorts, &cpuRack);
+  numFailed = (tThreads < 0) + (tRack < 0);
+  if ((tThreads > 0) && (tRack > 0))
+    printf("  rack vs. threads: rack time %+.1f%%, CPU %+.1f%%\n", (tRack / tThreads - 1) * 100, (cpuRack / cpuThreads - 1) * 100);
+
+  for (i=0; i<numPorts; i++) {
+    kill(board[i].pidEmu, SIGTERM);
+    waitpid(board[i].pidEmu, NULL, 0);
+    close(board[i].fdEmu);
+    free(board[i].buf);
+  }
+  free(board);
+  image_free(&image);
+
+  return(numFailed ? 1 : 0);
+}
@@ -0,0 +1,198 @@
+/**
+  microbenchmark for serial_comm.c (POSIX backend). The loader side opens the
+  slave of a pseudo terminal pair, a thread on the master side plays the STM8 BSL
+  in duplex or reply mode for GET and READ of 256 bytes (cmd -> ACK, addr -> ACK,
+  num -> ACK+data). Checks UART mode detection, then reports syscalls, latency
+  and throughput per transaction.
+  Syscalls are counted via linker wrapping of read()/write() (-Wl,--wrap=...)
+*/
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "misc.h"
+#include "serial_comm.h"
+#include "bootloader.h"
+
+#define NUM_TRANSACTIONS  2000
+#define NUM_DATA          256
+#define BAUDRATE          230400
+
+// handle of loader side, its file descriptor and syscall counters for it
+static HANDLE     g_ptrHost;
+static int        g_fdHost = -1;
+static uint64_t   g_numRead, g_numWrite;
+
+// UART mode played by target
+static volatile uint8_t g_targetMode;
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+
+ssize_t __wrap_read(int fd, void *buf, size_t count) {
+  if (fd == g_fdHost)
+    g_numRead++;
+  return(__real_read(fd, buf, count));
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+  if (fd == g_fdHost)
+    g_numWrite++;
+  return(__real_write(fd, buf, count));
+}
+
+/**
+  read exactly num bytes on target side. Return 0 if host side was closed
+*/
+static int target_read(int fd, uint8_t *buf, int num) {
+  int   len = 0, tmp;
+
+  while (len < num) {
+    tmp = __real_read(fd, buf+len, num-len);
+    if (tmp <= 0)
+      return(0);
+    len += tmp;
+  }
+  return(1);
+}
+
+/**
+  send response from target side. In reply mode wait for echo of each byte
+*/
+static void target_send(int fd, uint8_t *buf, int num) {
+  uint8_t   echo;
+  int       i;
+
+  if (g_targetMode == UART_MODE_DUPLEX) {
+    __real_write(fd, buf, num);
+    return;
+  }
+  for (i=0; i<num; i++) {
+    __real_write(fd, buf+i, 1);
+    target_read(fd, &echo, 1);
+  }
+}
+
+/**
+  BSL stand-in for GET and READ transactions
+*/
+static void *target(void *arg) {
+  int       fd = *((int*) arg);
+  uint8_t   Rx[8], Tx[NUM_DATA+1];
+  uint8_t   get[] = {ACK, 5, 0x10, GET, READ, GO, WRITE, ERASE, ACK};
+  uint8_t   ack = ACK;
+  int       i;
+
+  for (i=0; i<NUM_DATA+1; i++)
+    Tx[i] = (uint8_t) i;
+  Tx[0] = ACK;
+  Tx[1] = 1;
+
+  while (target_read(fd, Rx, 2)) {          // command
+    if (Rx[0] == GET) {
+      target_send(fd, get, sizeof(get));
+      continue;
+    }
+    target_send(fd, &ack, 1);               // ACK1
+    target_read(fd, Rx, 5);                 // address + checksum
+    target_send(fd, &ack, 1);               // ACK2
+    target_read(fd, Rx, 2);                 // number of bytes
+    target_send(fd, Tx, NUM_DATA+1);        // ACK3 + data
+  }
+
+  return(NULL);
+}
+
+/**
+  run READ transactions from host side. bytewise=1 receives 1 byte per receive_port() call
+*/
+static void run(const char *name, uint8_t mode, int bytewise) {
+  char      Tx[8], Rx[NUM_DATA+1];
+  int       i, j;
+  uint64_t  tStart, tDur;
+  double    wire;
+
+  g_targetMode = mode;
+
+  g_numRead = g_numWrite = 0;
+  tStart = micros();
+  for (i=0; i<NUM_TRANSACTIONS; i++) {
+    Tx[0] = READ; Tx[1] = READ ^ 0xFF;
+    send_port(g_ptrHost, NULL, 2, Tx);
+    receive_port(g_ptrHost, NULL, mode, 1, Rx);
+    Tx[0] = 0x00; Tx[1] = 0x00; Tx[2] = 0x80; Tx[3] = 0x00; Tx[4] = 0x80;
+    send_port(g_ptrHost, NULL, 5, Tx);
+    receive_port(g_ptrHost, NULL, mode, 1, Rx);
+    Tx[0] = NUM_DATA-1; Tx[1] = Tx[0] ^ 0xFF;
+    send_port(g_ptrHost, NULL, 2, Tx);
+    if (bytewise) {
+      for (j=0; j<NUM_DATA+1; j++) {
+        if (receive_port(g_ptrHost, NULL, mode, 1, Rx+j) != 1)
+          break;
+      }
+    }
+    else
+      j = receive_port(g_ptrHost, NULL, mode, NUM_DATA+1, Rx);
+    if ((j != NUM_DATA+1) || (Rx[0] != ACK) || (Rx[1] != 1)) {
+      fprintf(stderr, "\n\nerror in 'bench_serial': wrong response in transaction %d, exit!\n\n", i);
+      exit(1);
+    }
+  }
+  tDur = micros() - tStart;
+
+  // bytes on wire per transaction (9 sent, 3+256 received, echoes in reply mode)
+  wire = 9 + (NUM_DATA+3);
+  if (mode == UART_MODE_REPLY)
+    wire += NUM_DATA+3;
+
+  printf("  %-16s %7.1f syscalls %7.1f us %8.0f kB/s pty %6.1f kB/s @%d (%.0f B on wire)\n", name,
+    (double) (g_numRead + g_numWrite) / NUM_TRANSACTIONS, (double) tDur / NUM_TRANSACTIONS,
+    (double) NUM_DATA * NUM_TRANSACTIONS / tDur * 1000.0,
+    (double) NUM_DATA / (wire * 10.0 / BAUDRATE) / 1000.0, BAUDRATE, wire);
+}
+
+int main(int argc, char **argv) {
+  int         fdTarget;
+  pthread_t   thread;
+  Bsl_t       bsl;
+
+  // create pseudo terminal pair
+  fdTarget = posix_openpt(O_RDWR | O_NOCTTY);
+  if ((fdTarget < 0) || grantpt(fdTarget) || unlockpt(fdTarget)) {
+    fprintf(stderr, "\n\nerror in 'bench_serial': cannot create pty, exit!\n\n");
+    exit(1);
+  }
+  if (!(g_ptrHost = init_port(ptsname(fdTarget), BAUDRATE, 1000, 8, 0, 1, 0, 0))) {
+    fprintf(stderr, "\n\nerror in 'bench_serial': cannot open pty, exit!\n\n");
+    exit(1);
+  }
+  g_fdHost = g_ptrHost->fd;
+  bsl_init(&bsl, g_ptrHost, UART_MODE_REPLY);
+  pthread_create(&thread, NULL, target, &fdTarget);
+
+  // check UART mode detection
+  printf("serial_comm: UART mode detection\n");
+  g_targetMode = UART_MODE_DUPLEX;
+  if ((bsl_getUartMode(&bsl) != BSL_OK) || (bsl.uartMode != UART_MODE_DUPLEX))
+    exit(1);
+  g_targetMode = UART_MODE_REPLY;
+  if ((bsl_getUartMode(&bsl) != BSL_OK) || (bsl.uartMode != UART_MODE_REPLY))
+    exit(1);
+
+  printf("serial_comm: %d x READ(%d) over pty\n", NUM_TRANSACTIONS, NUM_DATA);
+  run("reply, bytewise", UART_MODE_REPLY, 1);
+  run("reply", UART_MODE_REPLY, 0);
+  run("duplex", UART_MODE_DUPLEX, 0);
+
+  // stop target and clean up
+  close_port(&g_ptrHost);
+  pthread_join(thread, NULL);
+  close(fdTarget);
+
+  return(0);
+}
@@ -1,251 +1,409 @@
+#include <stdarg.h>
 #include "bootloader.h"
 #include "serial_comm.h"
+#include "misc.h"
+#include "stats.h"
+
+// single BSL transactions, see below
+static uint8_t bsl_readRequest(Bsl_t *bsl, uint32_t addr, uint32_t numBytes);
+static uint8_t bsl_readReply(Bsl_t *bsl, uint32_t numBytes, char *buf);
+static uint8_t bsl_readBlock(Bsl_t *bsl, uint32_t addr, uint32_t numBytes, char *buf);
+static uint8_t bsl_writeFrame(Bsl_t *bsl, uint32_t addr, uint32_t numBytes, const char *buf);
+static uint8_t bsl_writeBlock(Bsl_t *bsl, uint32_t addr, uint32_t numBytes, const char *buf);
 
 /**
-  synchronize to microcontroller BSL, e.g. baudrate. If already synchronized
-  checks for NACK
+  init BSL session on an open port (0: not open) with known UART mode, or detect it later
+  via bsl_getUartMode(). Statistics, trace and output callbacks are cleared, set them in
+  the struct if required
+*/
+void bsl_init(Bsl_t *bsl, HANDLE port, uint8_t uartMode) {
+
+  memset(bsl, 0, sizeof(Bsl_t));
+  bsl->port     = port;
+  bsl->uartMode = uartMode;
+}
+
+/**
+  pass message to log callback of session, if any
+*/
+static void bsl_log(Bsl_t *bsl, const char *fmt, ...) {
+  va_list   args;
+  char      msg[200];
+
+  if (bsl->log == NULL)
+    return;
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+  bsl->log(msg, bsl->arg);
+}
+
+/**
+  report progress to callback of session, if any, whenever numDone (bytes of current
+  operation) passes a 1kB boundary with the last numStep bytes
+*/
+static void bsl_progress(Bsl_t *bsl, uint32_t numDone, uint32_t numStep) {
+
+  if ((bsl->progress != NULL) && (((numDone - numStep) / 1024) != (numDone / 1024)))
+    bsl->progress(numDone, bsl->arg);
+}
+
+/**
+  keep error message "error in 'func': ..." in session. Return status
+*/
+static uint8_t bsl_fail(Bsl_t *bsl, uint8_t status, const char *func, const char *fmt, ...) {
+  va_list   args;
+  int       len;
+
+  len = snprintf(bsl->error, sizeof(bsl->error), "error in '%s': ", func);
+  va_start(args, fmt);
+  vsnprintf(bsl->error+len, sizeof(bsl->error)-len, fmt, args);
+  va_end(args);
+
+  return(status);
+}
+
+/**
+  store GET response (ACK, N, version, N commands, ACK) as BSL capabilities
+*/
+static void bsl_setInfo(Bsl_t *bsl, const char *Rx) {
+  int   i;
+
+  bsl->info.version = (uint8_t) Rx[2];
+  bsl->info.numCmd  = 0;
+  for (i=0; (i<(uint8_t) Rx[1]) && (i<(int) sizeof(bsl->info.cmd)); i++)
+    bsl->info.cmd[bsl->info.numCmd++] = (uint8_t) Rx[3+i];
+  bsl->info.valid = 1;
+}
+
+/**
+  send SYNCH until BSL responds with ACK or NACK or maxRetry is reached. Uses a short
+  receive timeout and an exponential backoff between tries, i.e. a BSL ready early is
+  found fast without flooding a slow one. Return last response byte, or -1 if BSL
+  didn't respond
 */
-uint8_t bsl_sync(HANDLE ptrPort) {
+int bsl_syncRetry(Bsl_t *bsl, int maxRetry) {
 
-  int   i, count;
-  int   lenTx, lenRx, len;
-  char  Tx[1000], Rx[1000];
+  int       count;
+  int       lenTx, lenRx, len;
+  char      Tx[1000], Rx[1000];
+  uint32_t  timeout, baudrate, wait;
+  uint8_t   numBits, parity, numStop, RTS, DTR;
 
   // init receive buffer
   memset(Rx, 0, 1000);
 
-  if (!ptrPort) {
-    //Port not open
-    exit(1);
-  }
-
   // purge UART input buffer
-  flush_port(ptrPort);
+  flush_port(bsl->port, bsl->trace);
 
   // construct SYNC command
   lenTx = 1;
   Tx[0] = SYNCH;
   lenRx = 1;
 
+  // short timeout for early exit (response takes <1ms)
+  if (get_port_attribute(bsl->port, &baudrate, &timeout, &numBits, &parity, &numStop, &RTS, &DTR) || set_timeout(bsl->port, SYNC_TIMEOUT))
+    return(-1);
+
   count = 0;
+  wait  = 1;
   do {
-    send_port(ptrPort, lenTx, Tx);
-    len = receive_port(ptrPort, lenRx, Rx);
+    stats_begin(bsl->stats, STAT_SYNC);
+    send_port(bsl->port, bsl->trace, lenTx, Tx);
+    stats_phase(bsl->stats, PHASE_SEND);
+
+    // receive without echo, the SYNCH response is not replied in any mode
+    len = receive_port(bsl->port, bsl->trace, UART_MODE_DUPLEX, lenRx, Rx);
+    stats_phase(bsl->stats, PHASE_ACK1);
 
     // increase retry counter
     count++;
 
-    // avoid flooding the STM8
-    Sleep(10);
+    // done on ACK or NACK. ACK starts a new session (NACK: already synchronized)
+    if ((len == lenRx) && ((Rx[0] == ACK) || (Rx[0] == NACK))) {
+      if (Rx[0] == ACK)
+        bsl->info.valid = 0;
+      break;
+    }
+
+    // exponential backoff, avoid flooding the STM8. Discard garbage, e.g. from framing errors
+    stats_retry(bsl->stats, RETRY_SYNC);
+    SLEEP(wait);
+    if (wait < SYNC_MAXWAIT)
+      wait *= 2;
+    flush_port(bsl->port, bsl->trace);
+
+  } while (count < maxRetry);
+
+  // restore timeout
+  set_timeout(bsl->port, timeout);
+
+  if (len != lenRx)
+    return(-1);
+  return((uint8_t) (Rx[0]));
+}
+
+/**
+  synchronize to microcontroller BSL, e.g. baudrate. If already synchronized
+  checks for NACK
+*/
+uint8_t bsl_sync(Bsl_t *bsl) {
 
-  } while ((count < 15) && ((len != lenRx) || ((Rx[0] != ACK) && (Rx[0] != NACK))));
+  int     response;
+
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_sync()", "port not open"));
+
+  // send SYNCH with retries
+  response = bsl_syncRetry(bsl, 15);
 
   // check if ok
-  if ((len == lenRx) && (Rx[0] == ACK)) {
-    printf("ok (ACK)\n");
-    fflush(stdout);
-  } else if ((len == lenRx) && (Rx[0] == NACK)) {
-    printf("ok (NACK)\n");
-    fflush(stdout);
-  } else if (len == lenRx) {
-    fprintf(stderr, "\n\nerror in 'bsl_sync()': wrong response 0x%02x from BSL, exit!\n\n", (uint8_t) (Rx[0]));
-    exit(1);
-  } else {
-    fprintf(stderr, "\n\nerror in 'bsl_sync()': no response from BSL, exit!\n\n");
-    exit(1);
-  }
+  if (response == ACK)
+    bsl_log(bsl, "ok (ACK)\n");
+  else if (response == NACK)
+    bsl_log(bsl, "ok (NACK)\n");
+  else if (response >= 0)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_sync()", "wrong response 0x%02x from BSL", (uint8_t) response));
+  else
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_sync()", "no response from BSL"));
 
   // return success
-  return(0);
+  return(BSL_OK);
 }
 
 /**
-  read from microcontroller memory via READ command
+  recover from failed READ or WRITE frame with status (retry: number of previous retries).
+  Return status after BLOCK_RETRY retries, else bring BSL back to wait for a command and
+  return BSL_OK. After a lost byte the BSL still waits for the remainder of the frame,
+  which is completed by a burst of BLOCK_FILL bytes (rejected with NACKs). Then resynchronize.
+  The caller resends the frame
 */
-uint8_t bsl_memRead(HANDLE ptrPort, uint32_t addrStart, uint32_t numBytes, char *buf) {
+static uint8_t bsl_recover(Bsl_t *bsl, int retry, uint8_t status) {
+  char      burst[FLASH_BLOCKSIZE+3];   // longest frame: N, data and checksum
+  uint32_t  timeout, baudrate;
+  uint8_t   numBits, parity, numStop, RTS, DTR;
+  int       len;
+
+  if (retry >= BLOCK_RETRY) {
+    len = strlen(bsl->error);
+    snprintf(bsl->error+len, sizeof(bsl->error)-len, " (after %d retries)", retry);
+    return(status);
+  }
+  stats_retry(bsl->stats, RETRY_BLOCK);
+  bsl_log(bsl, "r");
+
+  // complete pending frame, discard responses, then wait for ACK or NACK to SYNCH
+  memset(burst, BLOCK_FILL, sizeof(burst));
+  flush_port(bsl->port, bsl->trace);
+  send_port(bsl->port, bsl->trace, sizeof(burst), burst);
+  if (get_port_attribute(bsl->port, &baudrate, &timeout, &numBits, &parity, &numStop, &RTS, &DTR) || (baudrate == 0))
+    return(status);
+  SLEEP(sizeof(burst) * 10000 / baudrate + BLOCK_SETTLE);
+  bsl_syncRetry(bsl, 15);
+  flush_port(bsl->port, bsl->trace);
+
+  return(BSL_OK);
+}
 
-  int       i, lenTx, lenRx, len;
+/**
+  detect UART mode of BSL after bsl_sync() via GET command. In duplex mode the
+  BSL sends the complete response at once, in reply mode it waits for the echo
+  of the first ACK. Sets the detected mode in the session
+*/
+uint8_t bsl_getUartMode(Bsl_t *bsl) {
+
+  int       lenTx, lenRx, len;
   char      Tx[1000], Rx[1000];
-  uint32_t  addrTmp, addrStep, idx=0;
+  uint32_t  timeout, baudrate;
+  uint8_t   numBits, parity, numStop, RTS, DTR;
 
   // print message
-  printf("  read ");
-  fflush(stdout);
+  bsl_log(bsl, "  detect UART mode ... ");
 
   // init receive buffer
   memset(Rx, 0, 1000);
 
-  if (!ptrPort) {
-    //port not open
-    exit(1);
-  }
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_getUartMode()", "port not open"));
 
-  // init data buffer
-  memset(buf, 0, numBytes);
+  // receive without echo until mode is known
+  bsl->uartMode = UART_MODE_DUPLEX;
 
-  // loop over addresses in <=256B steps
-  idx = 0;
-  addrStep = 256;
-  for (addrTmp = addrStart; addrTmp < addrStart + numBytes; addrTmp += addrStep) {
-    // if addr too close to end of range reduce stepsize
-    if (addrTmp+256 > addrStart+numBytes)
-      addrStep = addrStart+numBytes-addrTmp;
+  // send GET command
 
-    // READ command
+  // construct command
+  lenTx = 2;
+  Tx[0] = GET;
+  Tx[1] = (Tx[0] ^ 0xFF);
+  lenRx = 1;
 
-    lenTx = 2;
-    Tx[0] = READ;
-    Tx[1] = (Tx[0] ^ 0xFF);
-    lenRx = 1;
+  // send command
+  stats_begin(bsl->stats, STAT_GET);
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
 
-    // send command
-    len = send_port(ptrPort, lenTx, Tx);
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_getUartMode()", "sending command failed (expect %d, sent %d)", lenTx, len));
 
-    if (len != lenTx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memRead()': sending command failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-      exit(1);
-    }
+  // receive response
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK1);
 
-    // receive response
-    len = receive_port(ptrPort, lenRx, Rx);
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_getUartMode()", "ACK1 timeout (expect %d, received %d)", lenRx, len));
 
-    if (len != lenRx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memRead()': ACK1 timeout, exit!\n\n");
-      exit(1);
-    }
+  // check acknowledge
+  if (Rx[0] != ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_getUartMode()", "ACK1 failure 0x%02x", (uint8_t) (Rx[0])));
 
-    // check acknowledge
-    if (Rx[0]!=ACK) {
-      fprintf(stderr, "\n\nerror in 'bsl_memRead()': ACK1 failure 0x%2x, exit!\n\n", Rx[0]);
-      exit(1);
-    }
+  // wait shortly for next byte. If none arrives, BSL waits for echo -> reply mode
+  if (get_port_attribute(bsl->port, &baudrate, &timeout, &numBits, &parity, &numStop, &RTS, &DTR) || set_timeout(bsl->port, 50))
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_getUartMode()", "cannot set port timeout"));
+  lenRx = 1;
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx+1);
+  stats_phase(bsl->stats, PHASE_DATA);
+  set_timeout(bsl->port, timeout);
+  if (len != lenRx) {
+    bsl->uartMode = UART_MODE_REPLY;
+    send_port(bsl->port, bsl->trace, 1, Rx);        // echo ACK1
+    len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx+1);
+    stats_phase(bsl->stats, PHASE_DATA);
+    if (len != lenRx)
+      return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_getUartMode()", "data timeout"));
+  }
 
-    // Send address
+  // receive remainder of response: (N+1) bytes version & commands, then ACK2
+  lenRx = (uint8_t) (Rx[1]) + 2;
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx+2);
+  stats_phase(bsl->stats, PHASE_DATA);
 
-    // construct address + checksum (XOR over address)
-    lenTx = 5;
-    Tx[0] = (char) (addrTmp >> 24);
-    Tx[1] = (char) (addrTmp >> 16);
-    Tx[2] = (char) (addrTmp >> 8);
-    Tx[3] = (char) (addrTmp);
-    Tx[4] = (Tx[0] ^ Tx[1] ^ Tx[2] ^ Tx[3]);
-    lenRx = 1;
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_getUartMode()", "data timeout (expect %d, received %d)", lenRx, len));
 
-    // send command
-    len = send_port(ptrPort, lenTx, Tx);
+  // check acknowledge
+  if (Rx[lenRx+1] != ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_getUartMode()", "ACK2 failure"));
 
-    if (len != lenTx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memRead()': sending address failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-      exit(1);
-    }
+  // keep response, see bsl_getInfo()
+  bsl_setInfo(bsl, Rx);
 
-    // receive response
-    len = receive_port(ptrPort, lenRx, Rx);
+  if (bsl->uartMode == UART_MODE_DUPLEX)
+    bsl_log(bsl, "ok (duplex)\n");
+  else
+    bsl_log(bsl, "ok (reply)\n");
 
-    if (len != lenRx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memRead()': ACK2 timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-      exit(1);
-    }
+  return(BSL_OK);
+}
 
-    // check acknowledge
-    if (Rx[0]!=ACK) {
-      fprintf(stderr, "\n\nerror in 'bsl_memRead()': ACK2 failure, exit!\n\n");
-      exit(1);
-    }
+/**
+  get BSL version and supported commands via GET command (UART mode must be known) into
+  the session. The response is kept until the next synchronization with ACK (new session),
+  i.e. GET is sent only once per session, also if the UART mode was detected via GET
+*/
+uint8_t bsl_getInfo(Bsl_t *bsl) {
+
+  int       lenTx, lenRx, len;
+  char      Tx[1000], Rx[1000];
 
-    // Send number of bytes
+  // GET response of this session is known
+  if (bsl->info.valid)
+    return(BSL_OK);
 
-    // construct number of bytes + checksum
-    lenTx = 2;
-    Tx[0] = addrStep-1;     // -1 from BSL
-    Tx[1] = (Tx[0] ^ 0xFF);
-    lenRx = addrStep + 1;
+  // init receive buffer
+  memset(Rx, 0, 1000);
 
-    // send command
-    len = send_port(ptrPort, lenTx, Tx);
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_getInfo()", "port not open"));
 
-    if (len != lenTx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memRead()': sending range failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-      exit(1);
-    }
+  // construct command
+  lenTx = 2;
+  Tx[0] = GET;
+  Tx[1] = (Tx[0] ^ 0xFF);
+  lenRx = 2;
 
-    // receive response
-    len = receive_port(ptrPort, lenRx, Rx);
+  // send command
+  stats_begin(bsl->stats, STAT_GET);
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
 
-    if (len != lenRx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memRead()': data timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-      exit(1);
-    }
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_getInfo()", "sending command failed (expect %d, sent %d)", lenTx, len));
 
-    // check acknowledge
-    if (Rx[0]!=ACK) {
-      fprintf(stderr, "\n\nerror in 'bsl_memRead()': ACK3 failure, exit!\n\n");
-      exit(1);
-    }
+  // receive ACK1 and number of following bytes N
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK1);
 
-    // copy data to buffer
-    for (i=1; i<lenRx; i++) {
-      buf[idx++] = Rx[i];
-    }
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_getInfo()", "ACK1 timeout (expect %d, received %d)", lenRx, len));
 
-    // print progress
-    if ((idx % 1024) == 0) {
-      printf(".");
-      fflush(stdout);
-    }
-  }
+  // check acknowledge
+  if (Rx[0] != ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_getInfo()", "ACK1 failure 0x%02x", (uint8_t) (Rx[0])));
 
-  printf(" ok\n");
-  fflush(stdout);
+  // receive (N+1) bytes version & commands, then ACK2
+  lenRx = (uint8_t) (Rx[1]) + 2;
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx+2);
+  stats_phase(bsl->stats, PHASE_DATA);
 
-  return(0);
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_getInfo()", "data timeout (expect %d, received %d)", lenRx, len));
+
+  // check acknowledge
+  if (Rx[lenRx+1] != ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_getInfo()", "ACK2 failure"));
+
+  bsl_setInfo(bsl, Rx);
+
+  return(BSL_OK);
 }
 
 /**
-  check if microcontroller address exists. Specifically read 1B from microcontroller
-  memory via READ command. If it fails, memory doesn't exist. Used to get STM8 type
+  check if BSL supports command according to GET response (see bsl_getInfo())
 */
-uint8_t bsl_memCheck(HANDLE ptrPort, uint32_t addr) {
-  int       i, lenTx, lenRx, len;
-  char      Tx[1000], Rx[1000];
+uint8_t bsl_hasCommand(const Bsl_t *bsl, uint8_t cmd) {
+  int   i;
 
-  // init receive buffer
-  memset(Rx, 0, 1000);
-
-  if (!ptrPort) {
-    // port not open
-    exit(1);
+  for (i=0; i<bsl->info.numCmd; i++) {
+    if (bsl->info.cmd[i] == cmd)
+      return(1);
   }
+  return(0);
+}
+
+/**
+  request up to 256 bytes from microcontroller memory via READ command, i.e. the BSL
+  starts sending the data. Receive it with bsl_readReply(). Return status, see BSL_OK
+*/
+static uint8_t bsl_readRequest(Bsl_t *bsl, uint32_t addr, uint32_t numBytes) {
+
+  int       lenTx, lenRx, len;
+  char      Tx[1000], Rx[1000];
 
   // READ command
 
-  // construct command
   lenTx = 2;
   Tx[0] = READ;
   Tx[1] = (Tx[0] ^ 0xFF);
   lenRx = 1;
 
   // send command
-  len = send_port(ptrPort, lenTx, Tx);
+  stats_begin(bsl->stats, STAT_READ);
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
 
-  if (len != lenTx) {
-    fprintf(stderr, "\n\nerror in 'bsl_memCheck()': sending command failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-    exit(1);
-  }
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_readRequest()", "sending command failed (expect %d, sent %d)", lenTx, len));
 
   // receive response
-  len = receive_port(ptrPort, lenRx, Rx);
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK1);
 
-  if (len != lenRx) {
-    fprintf(stderr, "\n\nerror in 'bsl_memCheck()': ACK1 timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-    exit(1);
-  }
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_readRequest()", "ACK1 timeout"));
 
   // check acknowledge
-  if (Rx[0] != ACK) {
-    fprintf(stderr, "\n\nerror in 'bsl_memCheck()': ACK1 failure 0x%2x, exit!\n\n", Rx[0]);
-    exit(1);
-  }
+  if (Rx[0]!=ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_readRequest()", "ACK1 failure 0x%02x", (uint8_t) Rx[0]));
 
   // Send address
 
@@ -259,310 +417,1030 @@ uint8_t bsl_memCheck(HANDLE ptrPort, uint32_t addr) {
   lenRx = 1;
 
   // send command
-  len = send_port(ptrPort, lenTx, Tx);
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
 
-  if (len != lenTx) {
-    fprintf(stderr, "\n\nerror in 'bsl_memCheck()': sending address failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-    exit(1);
-  }
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_readRequest()", "sending address failed (expect %d, sent %d)", lenTx, len));
 
   // receive response
-  len = receive_port(ptrPort, lenRx, Rx);
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK2);
 
-  if (len != lenRx) {
-    fprintf(stderr, "\n\nerror in 'bsl_memCheck()': ACK2 timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-    exit(1);
-  }
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_readRequest()", "ACK2 timeout (expect %d, received %d)", lenRx, len));
 
-  // check acknowledge -> on NACK memory cannot be read -> return 0
-  if (Rx[0]!=ACK) {
-    return(0);
-  }
+  // check acknowledge
+  if (Rx[0]!=ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_readRequest()", "ACK2 failure"));
 
-  // send number of bytes to read
+  // Send number of bytes
 
   // construct number of bytes + checksum
   lenTx = 2;
-  Tx[0] = 1-1;            // -1 from BSL
+  Tx[0] = numBytes-1;     // -1 from BSL
   Tx[1] = (Tx[0] ^ 0xFF);
-  lenRx = 2;
 
   // send command
-  len = send_port(ptrPort, lenTx, Tx);
-
-  if (len != lenTx) {
-    fprintf(stderr, "\n\nerror in 'bsl_memCheck()': sending range failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-    exit(1);
-  }
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
 
-  // receive response
-  len = receive_port(ptrPort, lenRx, Rx);
-
-  if (len != lenRx) {
-    fprintf(stderr, "\n\nerror in 'bsl_memCheck()': data timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-    exit(1);
-  }
-
-  // check acknowledge
-  if (Rx[0]!=ACK) {
-    fprintf(stderr, "\n\nerror in 'bsl_memCheck()': ACK3 failure, exit!\n\n");
-    exit(1);
-  }
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_readRequest()", "sending range failed (expect %d, sent %d)", lenTx, len));
 
-  // memory read succeeded -> memory exists
-  return(1);
+  return(BSL_OK);
 }
 
 /**
-  mass erase microcontroller P-flash and D-flash/EEPROM
+  receive data requested by bsl_readRequest(). Return status, see BSL_OK
 */
-uint8_t bsl_flashMassErase(HANDLE ptrPort) {
-
-  int       i, lenTx, lenRx, len;
-  char      Tx[1000], Rx[1000];
+static uint8_t bsl_readReply(Bsl_t *bsl, uint32_t numBytes, char *buf) {
 
-  // print message
-  printf("  mass erase flash ... ");
-  fflush(stdout);
+  int       lenRx, len;
+  char      Rx[1000];
 
-  // init receive buffer
-  memset(Rx, 0, 1000);
+  lenRx = numBytes + 1;
 
-  if (!ptrPort) {
-    // port not open
-    exit(1);
-  }
+  // receive response
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_DATA);
 
-  // send erase command
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_readReply()", "data timeout (expect %d, received %d)", lenRx, len));
 
-  // construct command
-  lenTx = 2;
-  Tx[0] = ERASE;
-  Tx[1] = (Tx[0] ^ 0xFF);
-  lenRx = 1;
+  // check acknowledge
+  if (Rx[0]!=ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_readReply()", "ACK3 failure"));
 
-  // send command
-  len = send_port(ptrPort, lenTx, Tx);
+  // copy data to buffer
+  memcpy(buf, Rx+1, numBytes);
+  stats_payload(bsl->stats, numBytes);
 
-  if (len != lenTx) {
-    fprintf(stderr, "\n\nerror in 'bsl_flashMassErase()': sending command failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-    exit(1);
-  }
+  return(BSL_OK);
+}
 
-  // receive response
-  len = receive_port(ptrPort, lenRx, Rx);
+/**
+  read up to 256 bytes from microcontroller memory via a single READ command. The frame
+  is resent up to BLOCK_RETRY times. Return status
+*/
+static uint8_t bsl_readBlock(Bsl_t *bsl, uint32_t addr, uint32_t numBytes, char *buf) {
 
-  if (len != lenRx) {
-    fprintf(stderr, "\n\nerror in 'bsl_flashMassErase()': ACK1 timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-    exit(1);
-  }
+  uint8_t   status;
+  int       retry;
 
-  // check acknowledge
-  if (Rx[0] != ACK) {
-    fprintf(stderr, "\n\nerror in 'bsl_flashMassErase()': ACK1 failure, exit!\n\n");
-    exit(1);
+  // resend frame after NACK or timeout, see bsl_recover()
+  for (retry=0; ; retry++) {
+    if (((status = bsl_readRequest(bsl, addr, numBytes)) == BSL_OK) && ((status = bsl_readReply(bsl, numBytes, buf)) == BSL_OK))
+      return(BSL_OK);
+    if (bsl_recover(bsl, retry, status) != BSL_OK)
+      return(status);
   }
+}
 
-  // send 0xFF+0x00 to trigger mass erase
-
-  // construct pattern
-  lenTx = 2;
-  Tx[0] = 0xFF;
-  Tx[1] = 0x00;
-  lenRx = 1;
+/**
+  read from microcontroller memory via READ command
+*/
+uint8_t bsl_memRead(Bsl_t *bsl, uint32_t addrStart, uint32_t numBytes, char *buf) {
 
-  // send command
-  len = send_port(ptrPort, lenTx, Tx);
+  uint32_t  addrTmp, addrStep, idx=0;
+  uint8_t   status;
 
-  if (len != lenTx) {
-    fprintf(stderr, "\n\nerror in 'bsl_flashMassErase()': sending trigger failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-    exit(1);
-  }
+  // print message
+  bsl_log(bsl, "  read ");
 
-  // receive response
-  len = receive_port(ptrPort, lenRx, Rx);
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memRead()", "port not open"));
 
-  if (len != lenRx) {
-    fprintf(stderr, "\n\nerror in 'bsl_flashMassErase()': ACK2 timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-    exit(1);
-  }
+  // loop over addresses in <=256B steps. Each step overwrites buffer
+  idx = 0;
+  addrStep = 256;
+  for (addrTmp = addrStart; addrTmp < addrStart + numBytes; addrTmp += addrStep) {
+    // if addr too close to end of range reduce stepsize
+    if (addrTmp+256 > addrStart+numBytes)
+      addrStep = addrStart+numBytes-addrTmp;
 
-  // check acknowledge
-  if (Rx[0] != ACK) {
-    fprintf(stderr, "\n\nerror in 'bsl_flashMassErase()': ACK2 failure, exit!\n\n");
-    exit(1);
+    // read block
+    if ((status = bsl_readBlock(bsl, addrTmp, addrStep, buf+idx)) != BSL_OK)
+      return(status);
+    idx += addrStep;
+    bsl_progress(bsl, idx, addrStep);
   }
 
-  printf("ok\n");
-  fflush(stdout);
+  bsl_log(bsl, " ok\n");
 
-  return(0);
+  return(BSL_OK);
 }
 
 /**
-  upload data to microcontroller memory via WRITE command
+  stream microcontroller memory to callback chunk by chunk, e.g. to encode and write it to
+  a file or compare it. Chunks are <=256B and aligned to 256B addresses. Reads are double
+  buffered: the READ of the next chunk is requested before the callback processes the
+  current chunk, i.e. the processing overlaps the transfer of the next chunk (duplex mode).
+  Reports progress only. Return status, BSL_STOPPED if stopped by the callback
 */
-uint8_t bsl_memWrite(HANDLE ptrPort, uint32_t addrStart, uint32_t numBytes, char *buf, int verbose) {
-
-  int       i, lenTx, lenRx, len;
-  char      Tx[1000], Rx[1000];
-  uint32_t  addrTmp, addrStep, idx=0, idx2=0;
-  uint8_t   chk, flagEmpty;
-
-  printf("  write ");
-  fflush(stdout);
+uint8_t bsl_memReadStream(Bsl_t *bsl, uint32_t addrStart, uint32_t numBytes, BslChunk_t callback, void *arg) {
 
-  // init receive buffer
-  memset(Rx, 0, 1000);
+  char      buf[2][256];          // chunk in transfer and chunk in processing
+  uint32_t  addrTmp, addrStep, addrLast = 0, numLast = 0, numRead = 0;
+  uint8_t   status, stop;
+  int       idx;
 
-  // check if port is open
-  if (!ptrPort) {
-    // port not open
-    exit(1);
-  }
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memReadStream()", "port not open"));
 
-  // loop over addresses in <=128B steps
+  // loop over addresses in <=256B steps aligned to 256B
   idx = 0;
-  idx2 = 0;
-  addrStep = 128;
-  for (addrTmp=addrStart; addrTmp<addrStart+numBytes; addrTmp+=addrStep) {
-
-    // if addr too close to end of range reduce stepsize
-    if (addrTmp+128 > addrStart+numBytes)
+  for (addrTmp = addrStart; addrTmp < addrStart + numBytes; addrTmp += addrStep) {
+    addrStep = 256 - (addrTmp % 256);
+    if (addrTmp+addrStep > addrStart+numBytes)
       addrStep = addrStart+numBytes-addrTmp;
 
-    // check if next block contains data. If not, skip complete block
-    flagEmpty = 1;
-    for (i=0; i<addrStep; i++) {
-      if (buf[idx+i]) {
-        flagEmpty = 0;
-        break;
-      }
-    }
-    if (flagEmpty) {
-      idx += addrStep;
-      continue;
+    // request next chunk, process previous one during transfer. The requested chunk
+    // is received also on stop to keep the BSL in sync. On failure read it again
+    // with retries (see bsl_readBlock())
+    status = bsl_readRequest(bsl, addrTmp, addrStep);
+    stop = (numLast > 0) && callback(addrLast, buf[idx^1], numLast, arg);
+    if ((status != BSL_OK) || ((status = bsl_readReply(bsl, addrStep, buf[idx])) != BSL_OK)) {
+      if (((status = bsl_recover(bsl, 0, status)) != BSL_OK) || ((status = bsl_readBlock(bsl, addrTmp, addrStep, buf[idx])) != BSL_OK))
+        return(status);
     }
+    if (stop)
+      return(bsl_fail(bsl, BSL_STOPPED, "bsl_memReadStream()", "stopped at 0x%04x", (unsigned) addrLast));
+    addrLast = addrTmp;
+    numLast  = addrStep;
+    idx ^= 1;
+    numRead += addrStep;
+    bsl_progress(bsl, numRead, addrStep);
+  }
+  if ((numLast > 0) && callback(addrLast, buf[idx^1], numLast, arg))
+    return(bsl_fail(bsl, BSL_STOPPED, "bsl_memReadStream()", "stopped at 0x%04x", (unsigned) addrLast));
 
-    // send write command
+  return(BSL_OK);
+}
 
-    // construct command
-    lenTx = 2;
-    Tx[0] = WRITE;
-    Tx[1] = (Tx[0] ^ 0xFF);
-    lenRx = 1;
+/**
+  read microcontroller memory for all segments of a memory image, i.e. segment
+  data is overwritten with memory content. Gaps between segments are not read
+*/
+uint8_t bsl_memReadImage(Bsl_t *bsl, MemImage_t *image) {
 
-    // send command
-    len = send_port(ptrPort, lenTx, Tx);
+  MemSegment_t  *seg;
+  uint32_t      addrTmp, addrStep, numRead=0;
+  uint8_t       status;
+  int           i;
 
-    if (len != lenTx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memWrite()': sending command failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-      exit(1);
+  // print message
+  bsl_log(bsl, "  read ");
+
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memReadImage()", "port not open"));
+
+  // loop over segments, and each segment in <=256B steps
+  for (i=0; i<image->numSegments; i++) {
+    seg = image->segment + i;
+    addrStep = 256;
+    for (addrTmp = seg->addrStart; addrTmp < seg->addrStart + seg->numBytes; addrTmp += addrStep) {
+      // if addr too close to end of segment reduce stepsize
+      if (addrTmp+256 > seg->addrStart+seg->numBytes)
+        addrStep = seg->addrStart+seg->numBytes-addrTmp;
+
+      // read block
+      if ((status = bsl_readBlock(bsl, addrTmp, addrStep, seg->data + (addrTmp - seg->addrStart))) != BSL_OK)
+        return(status);
+      numRead += addrStep;
+      bsl_progress(bsl, numRead, addrStep);
     }
+  }
 
-    // receive response
-    len = receive_port(ptrPort, lenRx, Rx);
+  bsl_log(bsl, " ok\n");
 
-    if (len != lenRx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memWrite()': ACK1 timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-      exit(1);
-    }
+  return(BSL_OK);
+}
 
-    // check acknowledge
-    if (Rx[0] != ACK) {
-      fprintf(stderr, "\n\nerror in 'bsl_memWrite()': ACK1 failure, exit!\n\n");
-      exit(1);
-    }
+// segment compared by bsl_verifyChunk()
+typedef struct {
+  Bsl_t               *bsl;       // session for log output
+  const MemSegment_t  *seg;       // reference data
+} Verify_t;
 
-    // send address
+/**
+  compare chunk read by bsl_memReadStream() with image segment (arg: Verify_t). On mismatch
+  log all differing address ranges of the chunk and stop
+*/
+static uint8_t bsl_verifyChunk(uint32_t addr, const char *data, uint32_t numBytes, void *arg) {
 
-    // construct address + checksum (XOR over address)
-    lenTx = 5;
-    Tx[0] = (char) (addrTmp >> 24);
-    Tx[1] = (char) (addrTmp >> 16);
-    Tx[2] = (char) (addrTmp >> 8);
-    Tx[3] = (char) (addrTmp);
-    Tx[4] = (Tx[0] ^ Tx[1] ^ Tx[2] ^ Tx[3]);
-    lenRx = 1;
+  const Verify_t      *verify = (const Verify_t*) arg;
+  const char          *ref = verify->seg->data + (addr - verify->seg->addrStart);
+  uint32_t            j, start;
 
-    // send command
-    len = send_port(ptrPort,  lenTx, Tx);
+  // fast path: wide compare of whole chunk
+  if (memcmp(ref, data, numBytes) == 0)
+    return(0);
 
-    if (len != lenTx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memWrite()': sending address failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-      exit(1);
+  // list ranges of differing bytes
+  for (j=0; j<numBytes; ) {
+    if (ref[j] == data[j]) {
+      j++;
+      continue;
     }
+    start = j;
+    while ((j < numBytes) && (ref[j] != data[j]))
+      j++;
+    bsl_log(verify->bsl, "\n  mismatch 0x%04x-0x%04x (first 0x%02x vs 0x%02x)", (unsigned) (addr+start), (unsigned) (addr+j-1),
+      (uint8_t) ref[start], (uint8_t) data[start]);
+  }
+  bsl_log(verify->bsl, "\n");
 
-    // receive response
-    len = receive_port(ptrPort, lenRx, Rx);
+  return(1);
+}
 
-    if (len != lenRx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memWrite()': ACK2 timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-      exit(1);
-    }
+/**
+  verify microcontroller memory against one image segment by reading back, see
+  bsl_memVerifyImage(). Logs only mismatches. Return status
+*/
+static uint8_t bsl_verifySegment(Bsl_t *bsl, const MemSegment_t *seg, const char *func) {
 
-    // check acknowledge
-    if (Rx[0] != ACK) {
-      fprintf(stderr, "\n\nerror in 'bsl_memWrite()': ACK2 failure, exit!\n\n");
-      exit(1);
+  Verify_t      verify;
+  uint8_t       status;
+
+  verify.bsl = bsl;
+  verify.seg = seg;
+  status = bsl_memReadStream(bsl, seg->addrStart, seg->numBytes, bsl_verifyChunk, &verify);
+  if (status == BSL_STOPPED)
+    return(bsl_fail(bsl, BSL_ERR_VERIFY, func, "memory differs from image"));
+
+  return(status);
+}
+
+/**
+  verify microcontroller memory against all segments of a memory image. Only
+  memory contained in the image is read. Each chunk is compared while the next one
+  is transferred (see bsl_memReadStream()). Stops after the first chunk with a
+  mismatch (BSL_ERR_VERIFY), listing all differing ranges of that chunk
+*/
+uint8_t bsl_memVerifyImage(Bsl_t *bsl, const MemImage_t *image) {
+
+  uint8_t       status;
+  int           i;
+
+  // print message
+  bsl_log(bsl, "  verify memory ");
+
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memVerifyImage()", "port not open"));
+
+  // stream segments and compare, stop at first bad chunk
+  for (i=0; i<image->numSegments; i++) {
+    if ((status = bsl_verifySegment(bsl, image->segment + i, "bsl_memVerifyImage()")) != BSL_OK)
+      return(status);
+  }
+
+  bsl_log(bsl, " ok\n");
+
+  return(BSL_OK);
+}
+
+/**
+  check if memory image is resident in microcontroller memory by comparing the first
+  and last numSig bytes of each segment (short READs instead of reading all). Doesn't
+  log. Store result in resident (1=resident) and return status
+*/
+uint8_t bsl_memResident(Bsl_t *bsl, const MemImage_t *image, uint32_t numSig, uint8_t *resident) {
+
+  MemSegment_t  *seg;
+  char          buf[256];
+  uint32_t      num;
+  uint8_t       status;
+  int           i;
+
+  *resident = 0;
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memResident()", "port not open"));
+
+  if (numSig > 256)
+    numSig = 256;
+  for (i=0; i<image->numSegments; i++) {
+    seg = image->segment + i;
+
+    // first bytes of segment
+    num = (seg->numBytes < numSig) ? seg->numBytes : numSig;
+    if ((status = bsl_readBlock(bsl, seg->addrStart, num, buf)) != BSL_OK)
+      return(status);
+    if (memcmp(buf, seg->data, num))
+      return(BSL_OK);
+
+    // last bytes of segment
+    if (seg->numBytes > numSig) {
+      if ((status = bsl_readBlock(bsl, seg->addrStart+seg->numBytes-num, num, buf)) != BSL_OK)
+        return(status);
+      if (memcmp(buf, seg->data+seg->numBytes-num, num))
+        return(BSL_OK);
     }
+  }
 
-    // send number of bytes and data
-
-    // construct number of bytes + data + checksum
-    lenTx = 0;
-    Tx[lenTx++] = addrStep-1;     // -1 from BSL
-    chk         = addrStep-1;
-    for (i=0; i<addrStep; i++) {
-      Tx[lenTx] = buf[idx++];
-      idx2++;                     // only used for printing
-      chk ^= Tx[lenTx];
-      lenTx++;
+  *resident = 1;
+  return(BSL_OK);
+}
+
+/**
+  calculate CRC16 of microcontroller memory via routine in RAM (see STM8_Routines/crc16_routine.s),
+  which has to be uploaded before. The routine re-enters the BSL when done, so the BSL
+  is re-synchronized before the result is read. Range must be <64kB and below 0x10000
+  (else BSL_ERR_PARAM). Return status
+*/
+uint8_t bsl_memCrc(Bsl_t *bsl, uint32_t addrStart, uint32_t numBytes, uint16_t *crc) {
+
+  char      buf[8];
+  int       response;
+  uint8_t   status;
+
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memCrc()", "port not open"));
+
+  // check range
+  if ((numBytes == 0) || (numBytes > 0xFFFF) || (addrStart + numBytes > 0x10000))
+    return(bsl_fail(bsl, BSL_ERR_PARAM, "bsl_memCrc()", "range 0x%04x-0x%04x not supported", (unsigned) addrStart, (unsigned) (addrStart+numBytes-1)));
+
+  // write parameters: address, number of bytes, result, marker
+  buf[0] = (char) (addrStart >> 8);
+  buf[1] = (char) (addrStart);
+  buf[2] = (char) (numBytes >> 8);
+  buf[3] = (char) (numBytes);
+  buf[4] = buf[5] = buf[6] = 0x00;
+  if ((status = bsl_writeBlock(bsl, CRC_PARAM, 7, buf)) != BSL_OK)
+    return(status);
+
+  // start routine. Wait for calculation (approx. 3us/byte @16MHz), then re-synchronize
+  if ((status = bsl_jumpTo(bsl, CRC_ROUTINE)) != BSL_OK)
+    return(status);
+  SLEEP(5 + numBytes/300);
+  response = bsl_syncRetry(bsl, 15);
+  if ((response != ACK) && (response != NACK))
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_memCrc()", "no response from BSL after CRC routine"));
+
+  // read result and check marker
+  if ((status = bsl_readBlock(bsl, CRC_PARAM+4, 3, buf)) != BSL_OK)
+    return(status);
+  if ((uint8_t) (buf[2]) != 0xA5)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_memCrc()", "CRC routine didn't finish"));
+  *crc = ((uint16_t) (uint8_t) (buf[0]) << 8) | (uint8_t) (buf[1]);
+
+  return(BSL_OK);
+}
+
+/**
+  verify microcontroller memory against all segments of a memory image via CRC16
+  calculated on STM8 (see bsl_memCrc()). Only the CRC is transferred. Segments the
+  routine can't handle, or with CRC mismatch, are verified by reading back
+*/
+uint8_t bsl_memVerifyImageCrc(Bsl_t *bsl, const MemImage_t *image) {
+
+  MemSegment_t  *seg;
+  uint16_t      crcCalc, crcRead;
+  uint8_t       status;
+  int           i;
+
+  // print message
+  bsl_log(bsl, "  verify memory via CRC ... ");
+
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memVerifyImageCrc()", "port not open"));
+
+  for (i=0; i<image->numSegments; i++) {
+    seg = image->segment + i;
+    crcCalc = crc16(seg->data, seg->numBytes, 0xFFFF);
+
+    // get CRC from STM8
+    if (bsl_memCrc(bsl, seg->addrStart, seg->numBytes, &crcRead) == BSL_OK) {
+      if (crcRead == crcCalc)
+        continue;
+      bsl_log(bsl, "\n  CRC mismatch for 0x%04x-0x%04x (0x%04x vs 0x%04x), read back ", (int) seg->addrStart,
+        (int) (seg->addrStart+seg->numBytes-1), crcCalc, crcRead);
     }
-    Tx[lenTx++] = chk;
+    else
+      bsl_log(bsl, "\n  no CRC for 0x%04x-0x%04x, read back ", (int) seg->addrStart, (int) (seg->addrStart+seg->numBytes-1));
+
+    // fallback: compare segment bytewise
+    if ((status = bsl_verifySegment(bsl, seg, "bsl_memVerifyImageCrc()")) != BSL_OK)
+      return(status);
+    bsl_log(bsl, " ");
+  }
+
+  bsl_log(bsl, "ok\n");
+
+  return(BSL_OK);
+}
+
+/**
+  single attempt of bsl_memCheck(): read 1B via READ command and store in *exists whether
+  the BSL accepted the address. Return status
+*/
+static uint8_t bsl_checkFrame(Bsl_t *bsl, uint32_t addr, uint8_t *exists) {
+  int       lenTx, lenRx, len;
+  char      Tx[1000], Rx[1000];
+
+  // init receive buffer
+  memset(Rx, 0, 1000);
+
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memCheck()", "port not open"));
+
+  // READ command
+
+  // construct command
+  lenTx = 2;
+  Tx[0] = READ;
+  Tx[1] = (Tx[0] ^ 0xFF);
+  lenRx = 1;
+
+  // send command
+  stats_begin(bsl->stats, STAT_READ);
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
+
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memCheck()", "sending command failed (expect %d, sent %d)", lenTx, len));
+
+  // receive response
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK1);
+
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_memCheck()", "ACK1 timeout (expect %d, received %d)", lenRx, len));
+
+  // check acknowledge
+  if (Rx[0] != ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_memCheck()", "ACK1 failure 0x%02x", (uint8_t) Rx[0]));
+
+  // Send address
+
+  // construct address + checksum (XOR over address)
+  lenTx = 5;
+  Tx[0] = (char) (addr >> 24);
+  Tx[1] = (char) (addr >> 16);
+  Tx[2] = (char) (addr >> 8);
+  Tx[3] = (char) (addr);
+  Tx[4] = (Tx[0] ^ Tx[1] ^ Tx[2] ^ Tx[3]);
+  lenRx = 1;
+
+  // send command
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
+
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memCheck()", "sending address failed (expect %d, sent %d)", lenTx, len));
+
+  // receive response
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK2);
+
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_memCheck()", "ACK2 timeout (expect %d, received %d)", lenRx, len));
+
+  // check acknowledge -> on NACK memory cannot be read
+  if (Rx[0]!=ACK) {
+    *exists = 0;
+    return(BSL_OK);
+  }
+
+  // send number of bytes to read
+
+  // construct number of bytes + checksum
+  lenTx = 2;
+  Tx[0] = 1-1;            // -1 from BSL
+  Tx[1] = (Tx[0] ^ 0xFF);
+  lenRx = 2;
+
+  // send command
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
+
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memCheck()", "sending range failed (expect %d, sent %d)", lenTx, len));
+
+  // receive response
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_DATA);
+
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_memCheck()", "data timeout (expect %d, received %d)", lenRx, len));
+
+  // check acknowledge
+  if (Rx[0]!=ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_memCheck()", "ACK3 failure"));
+
+  // memory read succeeded -> memory exists
+  *exists = 1;
+  return(BSL_OK);
+}
+
+
+/**
+  check if microcontroller address exists. Specifically read 1B from microcontroller
+  memory via READ command. If it fails, memory doesn't exist (exists=0). Used to get
+  STM8 type. Transmission errors are retried via bsl_recover(). Return status
+*/
+uint8_t bsl_memCheck(Bsl_t *bsl, uint32_t addr, uint8_t *exists) {
+  uint8_t   status;
+  int       retry;
+
+  *exists = 0;
+  for (retry=0; (status = bsl_checkFrame(bsl, addr, exists)) != BSL_OK; retry++) {
+    if (bsl_recover(bsl, retry, status) != BSL_OK)
+      return(status);
+  }
+
+  return(BSL_OK);
+}
+
+/**
+  mass erase microcontroller P-flash and D-flash/EEPROM
+*/
+uint8_t bsl_flashMassErase(Bsl_t *bsl) {
+
+  int       lenTx, lenRx, len;
+  char      Tx[1000], Rx[1000];
+
+  // print message
+  bsl_log(bsl, "  mass erase flash ... ");
+
+  // init receive buffer
+  memset(Rx, 0, 1000);
+
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_flashMassErase()", "port not open"));
+
+  // send erase command
+
+  // construct command
+  lenTx = 2;
+  Tx[0] = ERASE;
+  Tx[1] = (Tx[0] ^ 0xFF);
+  lenRx = 1;
+
+  // send command
+  stats_begin(bsl->stats, STAT_ERASE);
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
+
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_flashMassErase()", "sending command failed (expect %d, sent %d)", lenTx, len));
+
+  // receive response
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK1);
+
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_flashMassErase()", "ACK1 timeout (expect %d, received %d)", lenRx, len));
+
+  // check acknowledge
+  if (Rx[0] != ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_flashMassErase()", "ACK1 failure"));
+
+  // send 0xFF+0x00 to trigger mass erase
+
+  // construct pattern
+  lenTx = 2;
+  Tx[0] = 0xFF;
+  Tx[1] = 0x00;
+  lenRx = 1;
+
+  // send command
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
+
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_flashMassErase()", "sending trigger failed (expect %d, sent %d)", lenTx, len));
+
+  // receive response
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK2);
+
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_flashMassErase()", "ACK2 timeout (expect %d, received %d)", lenRx, len));
+
+  // check acknowledge
+  if (Rx[0] != ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_flashMassErase()", "ACK2 failure"));
+
+  bsl_log(bsl, "ok\n");
+
+  return(BSL_OK);
+}
+
+/**
+  get erase sector codes of all P-flash and D-flash sectors touched by memory image,
+  sorted ascending: 0x00.. P-flash sectors of 1kB from PFLASH_START, 0x80.. D-flash
+  sectors of 1kB from DFLASH_START. Other memory (e.g. option bytes) is ignored.
+  Return number of sectors, or -1 if a sector has no code (P-flash beyond 128kB)
+*/
+int bsl_getSectors(const MemImage_t *image, uint8_t *codes) {
+
+  uint8_t   touched[256];
+  uint32_t  addr, addrEnd;
+  int       i, numSectors;
+
+  memset(touched, 0, sizeof(touched));
+  for (i=0; i<image->numSegments; i++) {
+    addrEnd = image->segment[i].addrStart + image->segment[i].numBytes - 1;
+    for (addr=image->segment[i].addrStart; addr<=addrEnd; addr=(addr - addr % PFLASH_BLOCKSIZE) + PFLASH_BLOCKSIZE) {
+      if (addr >= PFLASH_START) {
+        if ((addr - PFLASH_START) / PFLASH_BLOCKSIZE >= 0x80)
+          return(-1);
+        touched[(addr - PFLASH_START) / PFLASH_BLOCKSIZE] = 1;
+      }
+      else if ((addr >= DFLASH_START) && (addr <= DFLASH_END))
+        touched[0x80 + (addr - DFLASH_START) / PFLASH_BLOCKSIZE] = 1;
+    }
+  }
+
+  numSectors = 0;
+  for (i=0; i<256; i++) {
+    if (touched[i])
+      codes[numSectors++] = (uint8_t) i;
+  }
+
+  return(numSectors);
+}
+
+/**
+  erase microcontroller P-flash and D-flash sectors (codes see bsl_getSectors()). Sectors
+  are erased with as few ERASE commands as possible, i.e. up to ERASE_MAXSECTORS each
+*/
+uint8_t bsl_flashSectorErase(Bsl_t *bsl, const uint8_t *codes, int numSectors) {
+
+  int       i, lenTx, lenRx, len, numBatch;
+  char      Tx[1000], Rx[1000];
+  uint8_t   chk;
+  uint32_t  timeout, baudrate;
+  uint8_t   numBits, parity, numStop, RTS, DTR;
+
+  // print message
+  bsl_log(bsl, "  erase %d sector%s ... ", numSectors, (numSectors == 1) ? "" : "s");
+
+  // init receive buffer
+  memset(Rx, 0, 1000);
+
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_flashSectorErase()", "port not open"));
+
+  // erase takes longer than other commands
+  if (get_port_attribute(bsl->port, &baudrate, &timeout, &numBits, &parity, &numStop, &RTS, &DTR))
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_flashSectorErase()", "cannot get port timeout"));
+
+  for (; numSectors > 0; codes += numBatch, numSectors -= numBatch) {
+    numBatch = (numSectors > ERASE_MAXSECTORS) ? ERASE_MAXSECTORS : numSectors;
+
+    // send erase command
+
+    // construct command
+    lenTx = 2;
+    Tx[0] = ERASE;
+    Tx[1] = (Tx[0] ^ 0xFF);
     lenRx = 1;
 
     // send command
-    len = send_port(ptrPort, lenTx, Tx);
+    stats_begin(bsl->stats, STAT_ERASE);
+    len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+    stats_phase(bsl->stats, PHASE_SEND);
 
-    if (len != lenTx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memWrite()': sending data failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-      exit(1);
-    }
+    if (len != lenTx)
+      return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_flashSectorErase()", "sending command failed (expect %d, sent %d)", lenTx, len));
 
     // receive response
-    len = receive_port(ptrPort, lenRx, Rx);
+    len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+    stats_phase(bsl->stats, PHASE_ACK1);
 
-    if (len != lenRx) {
-      fprintf(stderr, "\n\nerror in 'bsl_memWrite()': ACK3 timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-      exit(1);
-    }
+    if (len != lenRx)
+      return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_flashSectorErase()", "ACK1 timeout (expect %d, received %d)", lenRx, len));
 
     // check acknowledge
-    if (Rx[0] != ACK) {
-      fprintf(stderr, "\n\nerror in 'bsl_memWrite()': ACK3 failure, exit!\n\n");
-      exit(1);
+    if (Rx[0] != ACK)
+      return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_flashSectorErase()", "ACK1 failure"));
+
+    // send number of sectors-1, sector codes and checksum
+
+    // construct sector list
+    lenTx = numBatch + 2;
+    Tx[0] = (char) (numBatch - 1);
+    chk   = (uint8_t) Tx[0];
+    for (i=0; i<numBatch; i++) {
+      Tx[1+i] = (char) codes[i];
+      chk ^= codes[i];
     }
+    Tx[numBatch+1] = (char) chk;
+    lenRx = 1;
+
+    // send sector list
+    len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+    stats_phase(bsl->stats, PHASE_SEND);
+
+    if (len != lenTx)
+      return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_flashSectorErase()", "sending sectors failed (expect %d, sent %d)", lenTx, len));
+
+    // receive response after all sectors are erased
+    set_timeout(bsl->port, timeout + numBatch * ERASE_SECTORTIME);
+    len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+    stats_phase(bsl->stats, PHASE_ACK2);
+    set_timeout(bsl->port, timeout);
+
+    if (len != lenRx)
+      return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_flashSectorErase()", "ACK2 timeout (expect %d, received %d)", lenRx, len));
+
+    // check acknowledge
+    if (Rx[0] != ACK)
+      return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_flashSectorErase()", "ACK2 failure"));
+  }
+
+  bsl_log(bsl, "ok\n");
+
+  return(BSL_OK);
+}
+
+/**
+  upload up to 128 bytes to microcontroller memory via a single WRITE command (one try).
+  Return status, see BSL_OK
+*/
+static uint8_t bsl_writeFrame(Bsl_t *bsl, uint32_t addr, uint32_t numBytes, const char *buf) {
+
+  int       i, lenTx, lenRx, len;
+  char      Tx[1000], Rx[1000];
+  uint8_t   chk;
+
+  // send write command
+
+  // construct command
+  lenTx = 2;
+  Tx[0] = WRITE;
+  Tx[1] = (Tx[0] ^ 0xFF);
+  lenRx = 1;
+
+  // send command
+  stats_begin(bsl->stats, STAT_WRITE);
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
+
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_writeFrame()", "sending command failed (expect %d, sent %d)", lenTx, len));
+
+  // receive response
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK1);
+
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_writeFrame()", "ACK1 timeout (expect %d, received %d)", lenRx, len));
+
+  // check acknowledge
+  if (Rx[0] != ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_writeFrame()", "ACK1 failure"));
+
+  // send address
+
+  // construct address + checksum (XOR over address)
+  lenTx = 5;
+  Tx[0] = (char) (addr >> 24);
+  Tx[1] = (char) (addr >> 16);
+  Tx[2] = (char) (addr >> 8);
+  Tx[3] = (char) (addr);
+  Tx[4] = (Tx[0] ^ Tx[1] ^ Tx[2] ^ Tx[3]);
+  lenRx = 1;
+
+  // send command
+  len = send_port(bsl->port, bsl->trace,  lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
+
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_writeFrame()", "sending address failed (expect %d, sent %d)", lenTx, len));
+
+  // receive response
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK2);
+
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_writeFrame()", "ACK2 timeout (expect %d, received %d)", lenRx, len));
+
+  // check acknowledge
+  if (Rx[0] != ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_writeFrame()", "ACK2 failure"));
+
+  // send number of bytes and data
+
+  // construct number of bytes + data + checksum
+  lenTx = 0;
+  Tx[lenTx++] = numBytes-1;     // -1 from BSL
+  chk         = numBytes-1;
+  for (i=0; i<numBytes; i++) {
+    Tx[lenTx] = buf[i];
+    chk ^= Tx[lenTx];
+    lenTx++;
+  }
+  Tx[lenTx++] = chk;
+  lenRx = 1;
+
+  // send command
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
+
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_writeFrame()", "sending data failed (expect %d, sent %d)", lenTx, len));
+
+  // receive response
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_DATA);
+
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_writeFrame()", "ACK3 timeout (expect %d, received %d)", lenRx, len));
+
+  // check acknowledge
+  if (Rx[0] != ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_writeFrame()", "ACK3 failure"));
+  stats_payload(bsl->stats, numBytes);
+
+  return(BSL_OK);
+}
+
+/**
+  upload up to 128 bytes to microcontroller memory via a single WRITE command. The frame
+  is resent up to BLOCK_RETRY times (rewriting a flash block is safe). Return status
+*/
+static uint8_t bsl_writeBlock(Bsl_t *bsl, uint32_t addr, uint32_t numBytes, const char *buf) {
+
+  uint8_t   status;
+  int       retry;
+
+  // resend frame after NACK or timeout, see bsl_recover()
+  for (retry=0; (status = bsl_writeFrame(bsl, addr, numBytes, buf)) != BSL_OK; retry++) {
+    if (bsl_recover(bsl, retry, status) != BSL_OK)
+      return(status);
+  }
+
+  return(BSL_OK);
+}
+
+/**
+  upload address range to microcontroller memory in <=128B steps aligned to flash blocks. Report
+  progress per 1kB, counted in numSent across calls. Optionally report each acknowledged frame
+  to callback. Return status
+*/
+static uint8_t bsl_writeRange(Bsl_t *bsl, uint32_t addrStart, uint32_t numBytes, const char *buf, uint32_t *numSent, BslChunk_t confirmed, void *arg) {
+
+  uint32_t  addrTmp, addrStep, idx;
+  uint8_t   status;
+
+  // loop over addresses in <=128B steps. Frames end at flash block boundaries,
+  // so no WRITE straddles two blocks
+  idx = 0;
+  for (addrTmp=addrStart; addrTmp<addrStart+numBytes; addrTmp+=addrStep) {
+
+    // step to next block boundary. If addr too close to end of range reduce stepsize
+    addrStep = FLASH_BLOCKSIZE - (addrTmp % FLASH_BLOCKSIZE);
+    if (addrTmp+addrStep > addrStart+numBytes)
+      addrStep = addrStart+numBytes-addrTmp;
+
+    // write block
+    if ((status = bsl_writeBlock(bsl, addrTmp, addrStep, buf+idx)) != BSL_OK)
+      return(status);
+    if (confirmed != NULL)
+      confirmed(addrTmp, buf+idx, addrStep, arg);
+    idx += addrStep;
+    *numSent += addrStep;
+    bsl_progress(bsl, *numSent, addrStep);
+  }
+
+  return(BSL_OK);
+}
+
+/**
+  upload data to microcontroller memory via WRITE command
+*/
+uint8_t bsl_memWrite(Bsl_t *bsl, uint32_t addrStart, uint32_t numBytes, char *buf) {
+
+  uint32_t  numSent = 0;
+  uint8_t   status;
+
+  bsl_log(bsl, "  write ");
+
+  // check if port is open
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memWrite()", "port not open"));
+
+  // upload range
+  if ((status = bsl_writeRange(bsl, addrStart, numBytes, buf, &numSent, NULL, NULL)) != BSL_OK)
+    return(status);
+
+  bsl_log(bsl, " ok\n");
 
-    // print progress
-    if ((idx2 % 1024) == 0) {
-      printf(".");
-      fflush(stdout);
+  return(BSL_OK);
+}
+
+/**
+  upload all segments of a memory image to microcontroller memory via WRITE
+  command. Gaps between segments are skipped
+*/
+uint8_t bsl_memWriteImage(Bsl_t *bsl, const MemImage_t *image) {
+
+  uint32_t  numSent = 0;
+  uint8_t   status;
+  int       i;
+
+  bsl_log(bsl, "  write ");
+
+  // check if port is open
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_memWriteImage()", "port not open"));
+
+  // upload each segment
+  for (i=0; i<image->numSegments; i++) {
+    if ((status = bsl_writeRange(bsl, image->segment[i].addrStart, image->segment[i].numBytes, image->segment[i].data, &numSent, NULL, NULL)) != BSL_OK)
+      return(status);
+  }
+
+  bsl_log(bsl, " ok\n");
+
+  return(BSL_OK);
+}
+
+/**
+  upload memory image to microcontroller flash with whole-block WRITEs only, which
+  use the fast block programming of the E_W routines. Partial P-flash and D-flash
+  blocks are padded with image data of neighbouring segments, remaining bytes with
+  0x00 if flash was erased, else with the flash content read back. Memory outside
+  P-flash and D-flash (e.g. option bytes) is written as is and first. Flash blocks
+  are written in ascending order, each acknowledged frame is reported to confirmed
+  (optional), e.g. for a resume journal
+*/
+uint8_t bsl_flashWriteImage(Bsl_t *bsl, const MemImage_t *image, uint8_t erased, BslChunk_t confirmed, void *arg) {
+
+  MemImage_t    flash, aligned, pad;
+  MemSegment_t  *seg;
+  char          buf[FLASH_BLOCKSIZE];
+  uint32_t      block[2], addrEnd, numSent = 0;
+  uint8_t       status = BSL_OK;
+  int           i, j;
+
+  bsl_log(bsl, "  write ");
+
+  // check if port is open
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_flashWriteImage()", "port not open"));
+
+  // split image into flash (block aligned) and other memory (written as is)
+  image_init(&flash);
+  image_init(&aligned);
+  image_init(&pad);
+  for (i=0; (i<image->numSegments) && (status == BSL_OK); i++) {
+    seg = image->segment + i;
+    addrEnd = seg->addrStart + seg->numBytes - 1;
+    if (IS_FLASH(seg->addrStart) && IS_FLASH(addrEnd)) {
+      if (!image_setData(&flash, seg->addrStart, seg->numBytes, seg->data))
+        status = bsl_fail(bsl, BSL_ERR_MEMORY, "bsl_flashWriteImage()", "cannot allocate memory");
+    }
+    else
+      status = bsl_writeRange(bsl, seg->addrStart, seg->numBytes, seg->data, &numSent, NULL, NULL);
+  }
+  if ((status == BSL_OK) && !image_alignBlocks(&flash, FLASH_BLOCKSIZE, &aligned))
+    status = bsl_fail(bsl, BSL_ERR_MEMORY, "bsl_flashWriteImage()", "cannot allocate memory");
+
+  // pad partial blocks with flash content. Only first and last block of a segment can be partial
+  if (!erased) {
+    for (i=0; (i<flash.numSegments) && (status == BSL_OK); i++) {
+      seg = flash.segment + i;
+      addrEnd  = seg->addrStart + seg->numBytes - 1;
+      block[0] = seg->addrStart - (seg->addrStart % FLASH_BLOCKSIZE);
+      block[1] = addrEnd - (addrEnd % FLASH_BLOCKSIZE);
+      for (j=0; (j<2) && (status == BSL_OK); j++) {
+        if (image_contains(&flash, block[j], FLASH_BLOCKSIZE) || image_contains(&pad, block[j], FLASH_BLOCKSIZE))
+          continue;
+        if (((status = bsl_readBlock(bsl, block[j], FLASH_BLOCKSIZE, buf)) == BSL_OK) && !image_setData(&pad, block[j], FLASH_BLOCKSIZE, buf))
+          status = bsl_fail(bsl, BSL_ERR_MEMORY, "bsl_flashWriteImage()", "cannot allocate memory");
+      }
+    }
+    for (i=0; i<aligned.numSegments; i++) {
+      seg = aligned.segment + i;
+      image_getData(&pad, seg->addrStart, seg->numBytes, seg->data);
+      image_getData(&flash, seg->addrStart, seg->numBytes, seg->data);
     }
   }
 
-  printf(" ok\n");
-  fflush(stdout);
+  // upload whole blocks
+  for (i=0; (i<aligned.numSegments) && (status == BSL_OK); i++)
+    status = bsl_writeRange(bsl, aligned.segment[i].addrStart, aligned.segment[i].numBytes, aligned.segment[i].data, &numSent, confirmed, arg);
 
-  return(0);
+  image_free(&flash);
+  image_free(&aligned);
+  image_free(&pad);
+
+  if (status == BSL_OK)
+    bsl_log(bsl, " ok\n");
+
+  return(status);
 }
 
 /**
   jump to address and continue code execution. Generally RAM or flash
   starting address
 */
-uint8_t bsl_jumpTo(HANDLE ptrPort, uint32_t addr) {
-  int       i;
+uint8_t bsl_jumpTo(Bsl_t *bsl, uint32_t addr) {
   int       lenTx, lenRx, len;
   char      Tx[1000], Rx[1000];
 
@@ -570,10 +1448,8 @@ uint8_t bsl_jumpTo(HANDLE ptrPort, uint32_t addr) {
   memset(Rx, 0, 1000);
 
   // check if port is open
-  if (!ptrPort) {
-    // port not open
-    exit(1);
-  }
+  if (!bsl->port)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_jumpTo()", "port not open"));
 
   // send go command
 
@@ -584,26 +1460,23 @@ uint8_t bsl_jumpTo(HANDLE ptrPort, uint32_t addr) {
   lenRx = 1;
 
   // send command
-  len = send_port(ptrPort, lenTx, Tx);
+  stats_begin(bsl->stats, STAT_GO);
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
 
-  if (len != lenTx) {
-    fprintf(stderr, "\n\nerror in 'bsl_jumpTo()': sending command failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-    exit(1);
-  }
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_jumpTo()", "sending command failed (expect %d, sent %d)", lenTx, len));
 
   // receive response
-  len = receive_port(ptrPort, lenRx, Rx);
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK1);
 
-  if (len != lenRx) {
-    fprintf(stderr, "\n\nerror in 'bsl_jumpTo()': ACK1 timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-    exit(1);
-  }
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_jumpTo()", "ACK1 timeout (expect %d, received %d)", lenRx, len));
 
   // check acknowledge
-  if (Rx[0] != ACK) {
-    fprintf(stderr, "\n\nerror in 'bsl_jumpTo()': ACK1 failure, exit!\n\n");
-    exit(1);
-  }
+  if (Rx[0] != ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_jumpTo()", "ACK1 failure"));
 
   // send address
 
@@ -617,26 +1490,506 @@ uint8_t bsl_jumpTo(HANDLE ptrPort, uint32_t addr) {
   lenRx = 1;
 
   // send command
-  len = send_port(ptrPort, lenTx, Tx);
+  len = send_port(bsl->port, bsl->trace, lenTx, Tx);
+  stats_phase(bsl->stats, PHASE_SEND);
 
-  if (len != lenTx) {
-    fprintf(stderr, "\n\nerror in 'bsl_jumpTo()': sending address failed (expect %d, sent %d), exit!\n\n", lenTx, len);
-    exit(1);
-  }
+  if (len != lenTx)
+    return(bsl_fail(bsl, BSL_ERR_PORT, "bsl_jumpTo()", "sending address failed (expect %d, sent %d)", lenTx, len));
 
   // receive response
-  len = receive_port(ptrPort, lenRx, Rx);
+  len = receive_port(bsl->port, bsl->trace, bsl->uartMode, lenRx, Rx);
+  stats_phase(bsl->stats, PHASE_ACK2);
 
-  if (len != lenRx) {
-    fprintf(stderr, "\n\nerror in 'bsl_jumpTo()': ACK2 timeout (expect %d, received %d), exit!\n\n", lenRx, len);
-    exit(1);
-  }
+  if (len != lenRx)
+    return(bsl_fail(bsl, BSL_ERR_TIMEOUT, "bsl_jumpTo()", "ACK2 timeout (expect %d, received %d)", lenRx, len));
 
   // check acknowledge
-  if (Rx[0]!=ACK) {
-    fprintf(stderr, "\n\nerror in 'bsl_jumpTo()': ACK2 failure, exit!\n\n");
-    exit(1);
+  if (Rx[0]!=ACK)
+    return(bsl_fail(bsl, BSL_ERR_RESPONSE, "bsl_jumpTo()", "ACK2 failure"));
+
+  return(BSL_OK);
+}
+
+// steps of a non-blocking operation, see BslOp_t
+#define OP_IDLE           0         // done, received bytes are discarded
+#define OP_SYNC           1         // SYNCH sent, wait for ACK or NACK
+#define OP_BACKOFF        2         // wait before next SYNCH
+#define OP_ACK1           3         // command sent, wait for ACK1
+#define OP_ACK2           4         // address, sector list or mass erase trigger sent, wait for ACK2
+#define OP_DATA           5         // number of bytes (READ) or data (WRITE) sent, wait for response
+#define OP_SETTLE         6         // fill burst sent, wait for BSL to reject pending frame
+#define OP_SYNC_TRIES     15        // max. SYNCH tries, as bsl_sync()
+
+static void bsl_opFrame(BslOp_t *op);
+
+/**
+  init non-blocking operations of a session with response timeout [ms], i.e. the max.
+  gap within a response as the port timeout of the blocking functions
+*/
+void bsl_opInit(BslOp_t *op, Bsl_t *bsl, uint32_t timeout) {
+
+  memset(op, 0, sizeof(BslOp_t));
+  op->bsl     = bsl;
+  op->timeout = timeout;
+  op->status  = BSL_OK;
+  op->state   = OP_IDLE;
+}
+
+/**
+  name of operation for error messages
+*/
+static const char *bsl_opName(const BslOp_t *op) {
+
+  switch (op->cmd) {
+    case SYNCH: return("bsl_opSync()");
+    case READ:  return("bsl_opRead()");
+    case WRITE: return("bsl_opWrite()");
+    case ERASE: return("bsl_opErase()");
+    default:    return("bsl_opGo()");
   }
+}
+
+/**
+  finish operation with status. Return status
+*/
+static uint8_t bsl_opDone(BslOp_t *op, uint8_t status) {
+
+  op->state    = OP_IDLE;
+  op->deadline = 0;
+  op->lenRx    = 0;
+  op->numRx    = 0;
+  op->status   = status;
+
+  return(status);
+}
+
+/**
+  append bytes to output. Bytes already sent are dropped. Return 1 on overflow
+*/
+static uint8_t bsl_opQueue(BslOp_t *op, const char *data, uint32_t len) {
+
+  if (op->numTx > 0) {
+    memmove(op->Tx, op->Tx+op->numTx, op->lenTx-op->numTx);
+    op->lenTx -= op->numTx;
+    op->numTx  = 0;
+  }
+  if (op->lenTx + len > sizeof(op->Tx))
+    return(1);
+  memcpy(op->Tx+op->lenTx, data, len);
+  op->lenTx += len;
 
   return(0);
 }
+
+/**
+  send part of a frame, then wait in state for a response of lenRx bytes with max.
+  gap waitRx [ms] (lenRx=0: only wait)
+*/
+static void bsl_opSend(BslOp_t *op, const char *Tx, uint32_t lenTx, uint8_t state, uint32_t lenRx, uint32_t waitRx) {
+
+  if (bsl_opQueue(op, Tx, lenTx)) {
+    bsl_opDone(op, bsl_fail(op->bsl, BSL_ERR_PORT, bsl_opName(op), "output overflow (%d bytes pending)", (int) (op->lenTx - op->numTx)));
+    return;
+  }
+  if (state != OP_SETTLE)
+    stats_phase(op->bsl->stats, PHASE_SEND);
+  op->state    = state;
+  op->lenRx    = lenRx;
+  op->numRx    = 0;
+  op->waitRx   = waitRx;
+  op->deadline = micros() + (uint64_t) waitRx * 1000;
+}
+
+/**
+  record latency of the response awaited in current state (see stats_phase()). Each
+  response ends its phase as in the blocking functions, also on timeout
+*/
+static void bsl_opPhase(BslOp_t *op) {
+
+  switch (op->state) {
+    case OP_SYNC:
+    case OP_ACK1:
+      stats_phase(op->bsl->stats, PHASE_ACK1);
+      break;
+    case OP_ACK2:
+      stats_phase(op->bsl->stats, PHASE_ACK2);
+      break;
+    case OP_DATA:
+      stats_phase(op->bsl->stats, PHASE_DATA);
+      break;
+  }
+}
+
+/**
+  send SYNCH, response is not echoed in any mode (see bsl_syncRetry())
+*/
+static void bsl_opSynch(BslOp_t *op) {
+  char      Tx = SYNCH;
+
+  op->numSync++;
+  stats_begin(op->bsl->stats, STAT_SYNC);
+  bsl_opSend(op, &Tx, 1, OP_SYNC, 1, SYNC_TIMEOUT);
+}
+
+/**
+  no or wrong response to SYNCH (response<0: none). Wait with exponential backoff before
+  the next SYNCH, or give up after OP_SYNC_TRIES. When recovering a frame, it is resent
+  anyway (see bsl_recover())
+*/
+static void bsl_opBackoff(BslOp_t *op, int response) {
+
+  stats_retry(op->bsl->stats, RETRY_SYNC);
+  if (op->numSync >= OP_SYNC_TRIES) {
+    if (op->recover) {
+      op->recover = 0;
+      bsl_opFrame(op);
+    }
+    else if (response >= 0)
+      bsl_opDone(op, bsl_fail(op->bsl, BSL_ERR_RESPONSE, bsl_opName(op), "wrong response 0x%02x from BSL", (uint8_t) response));
+    else
+      bsl_opDone(op, bsl_fail(op->bsl, BSL_ERR_TIMEOUT, bsl_opName(op), "no response from BSL"));
+    return;
+  }
+
+  op->state    = OP_BACKOFF;
+  op->lenRx    = 0;
+  op->deadline = micros() + (uint64_t) op->wait * 1000;
+  if (op->wait < SYNC_MAXWAIT)
+    op->wait *= 2;
+}
+
+/**
+  failed frame with status and message. READ and WRITE frames are resent up to BLOCK_RETRY
+  times as by bsl_recover(): complete the pending frame by a fill burst, wait until the BSL
+  has rejected it, resynchronize and resend. Other operations are done with status
+*/
+static void bsl_opFail(BslOp_t *op, uint8_t status, const char *fmt, ...) {
+  va_list   args;
+  char      msg[150], burst[FLASH_BLOCKSIZE+3];
+  uint32_t  timeout, baudrate;
+  uint8_t   numBits, parity, numStop, RTS, DTR;
+
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+  bsl_fail(op->bsl, status, bsl_opName(op), "%s", msg);
+
+  if ((op->cmd != READ) && (op->cmd != WRITE)) {
+    bsl_opDone(op, status);
+    return;
+  }
+  if (op->retry >= BLOCK_RETRY) {
+    bsl_fail(op->bsl, status, bsl_opName(op), "%s (after %d retries)", msg, op->retry);
+    bsl_opDone(op, status);
+    return;
+  }
+  if (get_port_attribute(op->bsl->port, &baudrate, &timeout, &numBits, &parity, &numStop, &RTS, &DTR) || (baudrate == 0)) {
+    bsl_opDone(op, status);
+    return;
+  }
+  op->retry++;
+  stats_retry(op->bsl->stats, RETRY_BLOCK);
+  op->recover = 1;
+  op->numSync = 0;
+  op->wait    = 1;
+  memset(burst, BLOCK_FILL, sizeof(burst));
+  bsl_opSend(op, burst, sizeof(burst), OP_SETTLE, 0, sizeof(burst) * 10000 / baudrate + BLOCK_SETTLE);
+}
+
+/**
+  send command of current frame. Sizes READ and WRITE frames as bsl_memRead() and
+  bsl_writeRange(), ERASE frames as bsl_flashSectorErase()
+*/
+static void bsl_opFrame(BslOp_t *op) {
+  char      Tx[2];
+
+  if (op->cmd == SYNCH) {
+    bsl_opSynch(op);
+    return;
+  }
+
+  if (op->cmd == READ)
+    op->numFrame = (op->addrEnd - op->addr > 256) ? 256 : op->addrEnd - op->addr;
+  else if (op->cmd == WRITE) {
+    op->numFrame = FLASH_BLOCKSIZE - (op->addr % FLASH_BLOCKSIZE);
+    if (op->addr + op->numFrame > op->addrEnd)
+      op->numFrame = op->addrEnd - op->addr;
+  }
+  else if (op->cmd == ERASE)
+    op->numFrame = (op->numSectors > ERASE_MAXSECTORS) ? ERASE_MAXSECTORS : op->numSectors;
+
+  stats_begin(op->bsl->stats, (op->cmd == READ) ? STAT_READ : (op->cmd == WRITE) ? STAT_WRITE : (op->cmd == ERASE) ? STAT_ERASE : STAT_GO);
+  Tx[0] = op->cmd;
+  Tx[1] = (Tx[0] ^ 0xFF);
+  bsl_opSend(op, Tx, 2, OP_ACK1, 1, op->timeout);
+}
+
+/**
+  complete response of current step received: check it and continue with next step
+*/
+static void bsl_opStep(BslOp_t *op) {
+  char      Tx[ERASE_MAXSECTORS+2];   // longest: sector list, or N + data + checksum
+  uint8_t   chk;
+  uint32_t  i;
+
+  bsl_opPhase(op);
+  switch (op->state) {
+
+    // ACK starts a new session (NACK: already synchronized)
+    case OP_SYNC:
+      if ((op->Rx[0] != ACK) && (op->Rx[0] != NACK)) {
+        bsl_opBackoff(op, (uint8_t) op->Rx[0]);
+        return;
+      }
+      if (op->Rx[0] == ACK)
+        op->bsl->info.valid = 0;
+      if (op->recover) {
+        op->recover = 0;
+        bsl_opFrame(op);
+      }
+      else
+        bsl_opDone(op, BSL_OK);
+      return;
+
+    // command accepted: send sector list or mass erase trigger, else address + checksum
+    case OP_ACK1:
+      if (op->Rx[0] != ACK) {
+        bsl_opFail(op, BSL_ERR_RESPONSE, "ACK1 failure 0x%02x", (uint8_t) op->Rx[0]);
+        return;
+      }
+      if ((op->cmd == ERASE) && (op->codes == NULL)) {
+        Tx[0] = 0xFF;
+        Tx[1] = 0x00;
+        bsl_opSend(op, Tx, 2, OP_ACK2, 1, op->timeout);
+      }
+      else if (op->cmd == ERASE) {
+        Tx[0] = (char) (op->numFrame - 1);
+        chk   = (uint8_t) Tx[0];
+        for (i=0; i<op->numFrame; i++) {
+          Tx[1+i] = (char) op->codes[i];
+          chk ^= op->codes[i];
+        }
+        Tx[op->numFrame+1] = (char) chk;
+        bsl_opSend(op, Tx, op->numFrame+2, OP_ACK2, 1, op->timeout + op->numFrame * ERASE_SECTORTIME);
+      }
+      else {
+        Tx[0] = (char) (op->addr >> 24);
+        Tx[1] = (char) (op->addr >> 16);
+        Tx[2] = (char) (op->addr >> 8);
+        Tx[3] = (char) (op->addr);
+        Tx[4] = (Tx[0] ^ Tx[1] ^ Tx[2] ^ Tx[3]);
+        bsl_opSend(op, Tx, 5, OP_ACK2, 1, op->timeout);
+      }
+      return;
+
+    // address accepted: request data (READ) or send data (WRITE). ERASE and GO are done
+    case OP_ACK2:
+      if (op->Rx[0] != ACK) {
+        bsl_opFail(op, BSL_ERR_RESPONSE, "ACK2 failure");
+        return;
+      }
+      if (op->cmd == READ) {
+        Tx[0] = (char) (op->numFrame - 1);    // -1 from BSL
+        Tx[1] = (Tx[0] ^ 0xFF);
+        bsl_opSend(op, Tx, 2, OP_DATA, op->numFrame + 1, op->timeout);
+      }
+      else if (op->cmd == WRITE) {
+        Tx[0] = (char) (op->numFrame - 1);    // -1 from BSL
+        chk   = (uint8_t) Tx[0];
+        for (i=0; i<op->numFrame; i++) {
+          Tx[1+i] = op->buf[op->addr - op->addrStart + i];
+          chk ^= (uint8_t) Tx[1+i];
+        }
+        Tx[op->numFrame+1] = (char) chk;
+        bsl_opSend(op, Tx, op->numFrame+2, OP_DATA, 1, op->timeout);
+      }
+      else if ((op->cmd == ERASE) && (op->codes != NULL) && (op->numSectors > op->numFrame)) {
+        op->codes      += op->numFrame;
+        op->numSectors -= op->numFrame;
+        bsl_opFrame(op);
+      }
+      else
+        bsl_opDone(op, BSL_OK);
+      return;
+
+    // frame of READ or WRITE done: continue with next frame
+    case OP_DATA:
+      if (op->Rx[0] != ACK) {
+        bsl_opFail(op, BSL_ERR_RESPONSE, "ACK3 failure");
+        return;
+      }
+      if (op->cmd == READ)
+        memcpy(op->buf + (op->addr - op->addrStart), op->Rx+1, op->numFrame);
+      stats_payload(op->bsl->stats, op->numFrame);
+      op->addr += op->numFrame;
+      op->retry = 0;
+      bsl_progress(op->bsl, op->addr - op->addrStart, op->numFrame);
+      if (op->addr < op->addrEnd)
+        bsl_opFrame(op);
+      else
+        bsl_opDone(op, BSL_OK);
+      return;
+  }
+}
+
+/**
+  check if an operation is in progress, i.e. a new one can't be started. Return 1 if busy
+*/
+static uint8_t bsl_opBusy(BslOp_t *op) {
+
+  if (op->status != BSL_BUSY)
+    return(0);
+  bsl_fail(op->bsl, BSL_ERR_PARAM, bsl_opName(op), "operation in progress");
+  return(1);
+}
+
+/**
+  start operation with command. Return status (BSL_BUSY if started)
+*/
+static uint8_t bsl_opStart(BslOp_t *op, uint8_t cmd) {
+
+  op->cmd     = cmd;
+  op->status  = BSL_BUSY;
+  op->recover = 0;
+  op->retry   = 0;
+  op->numSync = 0;
+  op->wait    = 1;
+  if (!op->bsl->port)
+    return(bsl_opDone(op, bsl_fail(op->bsl, BSL_ERR_PORT, bsl_opName(op), "port not open")));
+  bsl_opFrame(op);
+
+  return(op->status);
+}
+
+/**
+  start non-blocking synchronization to microcontroller BSL, see bsl_sync(). Return status
+  (BSL_BUSY if started)
+*/
+uint8_t bsl_opSync(BslOp_t *op) {
+
+  if (bsl_opBusy(op))
+    return(BSL_ERR_PARAM);
+  return(bsl_opStart(op, SYNCH));
+}
+
+/**
+  start non-blocking read of microcontroller memory into buf in <=256B frames, see
+  bsl_memRead(). Return status (BSL_BUSY if started)
+*/
+uint8_t bsl_opRead(BslOp_t *op, uint32_t addrStart, uint32_t numBytes, char *buf) {
+
+  if (bsl_opBusy(op))
+    return(BSL_ERR_PARAM);
+  op->addrStart = addrStart;
+  op->addr      = addrStart;
+  op->addrEnd   = addrStart + numBytes;
+  op->buf       = buf;
+  if (numBytes == 0)
+    return(bsl_opDone(op, BSL_OK));
+
+  return(bsl_opStart(op, READ));
+}
+
+/**
+  start non-blocking upload of buf to microcontroller memory in <=128B frames aligned to
+  flash blocks, see bsl_memWrite(). buf is used until done. Return status (BSL_BUSY if started)
+*/
+uint8_t bsl_opWrite(BslOp_t *op, uint32_t addrStart, uint32_t numBytes, const char *buf) {
+
+  if (bsl_opBusy(op))
+    return(BSL_ERR_PARAM);
+  op->addrStart = addrStart;
+  op->addr      = addrStart;
+  op->addrEnd   = addrStart + numBytes;
+  op->buf       = (char*) buf;
+  if (numBytes == 0)
+    return(bsl_opDone(op, BSL_OK));
+
+  return(bsl_opStart(op, WRITE));
+}
+
+/**
+  start non-blocking erase of flash sectors (codes see bsl_getSectors()), or mass erase
+  if codes is NULL. codes are used until done. Return status (BSL_BUSY if started)
+*/
+uint8_t bsl_opErase(BslOp_t *op, const uint8_t *codes, int numSectors) {
+
+  if (bsl_opBusy(op))
+    return(BSL_ERR_PARAM);
+  op->codes      = codes;
+  op->numSectors = numSectors;
+  if ((codes != NULL) && (numSectors <= 0))
+    return(bsl_opDone(op, BSL_OK));
+
+  return(bsl_opStart(op, ERASE));
+}
+
+/**
+  start non-blocking jump to address, see bsl_jumpTo(). Return status (BSL_BUSY if started)
+*/
+uint8_t bsl_opGo(BslOp_t *op, uint32_t addr) {
+
+  if (bsl_opBusy(op))
+    return(BSL_ERR_PARAM);
+  op->addrStart = addr;
+  op->addr      = addr;
+
+  return(bsl_opStart(op, GO));
+}
+
+/**
+  advance operation with bytes received from port. Bytes outside of an expected
+  response are discarded, e.g. NACKs to a fill burst. In UART reply mode each
+  byte of a response is echoed (queued to Tx)
+*/
+void bsl_opReceive(BslOp_t *op, const char *data, uint32_t len) {
+  uint32_t  i;
+  uint8_t   partial = 0;
+
+  for (i=0; i<len; i++) {
+    if ((op->status != BSL_BUSY) || (op->numRx >= op->lenRx))
+      continue;
+    op->Rx[op->numRx++] = data[i];
+    if ((op->bsl->uartMode == UART_MODE_REPLY) && (op->state != OP_SYNC) && bsl_opQueue(op, data+i, 1)) {
+      bsl_opDone(op, bsl_fail(op->bsl, BSL_ERR_PORT, bsl_opName(op), "output overflow"));
+      return;
+    }
+    partial = (op->numRx < op->lenRx);
+    if (!partial)
+      bsl_opStep(op);
+  }
+
+  // timeout is the max. gap within a response
+  if (partial)
+    op->deadline = micros() + (uint64_t) op->waitRx * 1000;
+}
+
+/**
+  advance operation after its deadline: timeout of a response, end of SYNCH backoff,
+  or BSL has settled after a fill burst. Ignored before the deadline
+*/
+void bsl_opTimeout(BslOp_t *op) {
+
+  if ((op->status != BSL_BUSY) || (op->deadline == 0) || (micros() < op->deadline))
+    return;
+
+  bsl_opPhase(op);
+  switch (op->state) {
+    case OP_SYNC:
+      bsl_opBackoff(op, -1);
+      break;
+    case OP_BACKOFF:
+    case OP_SETTLE:
+      bsl_opSynch(op);
+      break;
+    case OP_ACK1:
+      bsl_opFail(op, BSL_ERR_TIMEOUT, "ACK1 timeout (expect %d, received %d)", (int) op->lenRx, (int) op->numRx);
+      break;
+    case OP_ACK2:
+      bsl_opFail(op, BSL_ERR_TIMEOUT, "ACK2 timeout (expect %d, received %d)", (int) op->lenRx, (int) op->numRx);
+      break;
+    case OP_DATA:
+      bsl_opFail(op, BSL_ERR_TIMEOUT, "data timeout (expect %d, received %d)", (int) op->lenRx, (int) op->numRx);
+      break;
+  }
+}
@@ -6,6 +6,9 @@
 #include <string.h>
 #include <stdint.h>
 #include "serial_comm.h"
+#include "memimage.h"
+#include "stats.h"
+#include "trace.h"
 
 // BSL command codes
 #define GET     0x00      // gets version and commands supported by the BSL
@@ -21,24 +24,187 @@
 #define BUSY    0xAA      // Busy flag status
 
 #define PFLASH_START      0x8000    // starting address of flash (same for all STM8 devices)
+#define PFLASH_MAXEND     0x47FFF   // end of P-flash of largest device (256kB)
+#define DFLASH_START      0x4000    // starting address of D-flash/EEPROM (same for all STM8 devices)
+#define DFLASH_END        0x47FF    // last address of D-flash/EEPROM (max. size), option bytes follow
 #define PFLASH_BLOCKSIZE  1024      // size of flash block for erase or block write (same for all STM8 devices)
+#define CRC_ROUTINE       0x0200    // start address of CRC16 routine in RAM (see STM8_Routines/crc16_routine.s)
+#define CRC_PARAM         0x01F0    // parameter block of CRC16 routine in RAM
+#define FLASH_BLOCKSIZE   128       // size of flash block for block programming (64 for low density devices)
+#define SYNC_TIMEOUT      20        // receive timeout [ms] for SYNCH response
+#define SYNC_MAXWAIT      64        // max. backoff [ms] between SYNCH tries
+#define ROUTINE_SIGNATURE 16        // bytes compared at start and end of RAM routines
+#define BLOCK_RETRY       5         // max. retries of a READ or WRITE frame
+#define BLOCK_SETTLE      10        // wait [ms] for BSL to reject frame completed on retry
+#define BLOCK_FILL        0xFF      // completes pending frame on retry. Never forms a command, as its complement differs
+#define ERASE_MAXSECTORS  255       // max. sectors per ERASE command (0xFF is mass erase)
+#define ERASE_SECTORTIME  50        // max. erase time per sector [ms], extends receive timeout
+
+// status codes of bsl_* functions. On error the message is kept in the session (Bsl_t.error)
+#define BSL_OK            0         // success
+#define BSL_ERR_PORT      1         // port not open, or sending or port setup failed
+#define BSL_ERR_TIMEOUT   2         // no or incomplete response from BSL
+#define BSL_ERR_RESPONSE  3         // NACK or unexpected response from BSL
+#define BSL_ERR_VERIFY    4         // memory differs from image
+#define BSL_ERR_PARAM     5         // range not supported
+#define BSL_STOPPED       6         // stopped by callback, see bsl_memReadStream()
+#define BSL_BUSY          7         // non-blocking operation in progress, see BslOp_t
+#define BSL_ERR_MEMORY    8         // cannot allocate memory image
+
+// BSL capabilities from GET response, queried once per session, see bsl_getInfo()
+typedef struct {
+  uint8_t   valid;                  // GET response received since last synchronization
+  uint8_t   version;                // BSL version, e.g. 0x13 for v1.3
+  uint8_t   numCmd;                 // number of supported commands
+  uint8_t   cmd[32];                // supported command codes
+} BslInfo_t;
+
+// callback for memory chunks read by bsl_memReadStream() or written by bsl_flashWriteImage().
+// Return 0 to continue, else stop (read only)
+typedef uint8_t (*BslChunk_t)(uint32_t addr, const char *data, uint32_t numBytes, void *arg);
+
+// callback for messages of a session, e.g. "  write " and " ok\n"
+typedef void (*BslLog_t)(const char *msg, void *arg);
+
+// callback for progress of a read or write, called per 1kB with the bytes done so far
+typedef void (*BslProgress_t)(uint32_t numBytes, void *arg);
+
+// BSL session on one port. Keeps all state of the protocol incl. statistics and trace, i.e.
+// several sessions can be used in one process (one thread per session). Init with bsl_init()
+typedef struct {
+  HANDLE        port;               // handle to communication port (NULL: not open)
+  uint8_t       uartMode;           // UART mode (UART_MODE_*), see bsl_getUartMode()
+  BslInfo_t     info;               // BSL capabilities, see bsl_getInfo()
+  Stats_t       *stats;             // protocol statistics of session (NULL: none), see stats.c
+  Trace_t       *trace;             // trace of all bytes via port (NULL: none), see trace.c
+  char          error[200];         // message of last error
+  BslLog_t      log;                // output of messages (NULL: none)
+  BslProgress_t progress;           // output of progress (NULL: none)
+  void          *arg;               // argument of log and progress callbacks
+} Bsl_t;
+
+// non-blocking operation (SYNCH, READ, WRITE, ERASE or GO) of a session as state machine, i.e.
+// many sessions can be served by one thread (see rack.c). Started by bsl_opSync() etc., then
+// advanced by the caller: send Tx[numTx..lenTx-1] when the port is writable, pass received
+// bytes to bsl_opReceive() and call bsl_opTimeout() when the deadline has passed. Done when
+// status is no longer BSL_BUSY. Failed READ and WRITE frames are retried as by the blocking
+// functions. Doesn't log, only reports progress. Statistics are recorded to the session
+// (see Bsl_t), the trace by the caller as it moves the bytes (see rack.c)
+typedef struct {
+  Bsl_t         *bsl;               // session (port, UART mode, error, callbacks)
+  uint32_t      timeout;            // max. gap within a response [ms]
+  uint8_t       status;             // BSL_BUSY while in progress, else result (see BSL_OK)
+  uint8_t       cmd;                // command of operation (SYNCH, READ, WRITE, ERASE, GO)
+  uint8_t       state;              // step of current frame, see bootloader.c
+  uint8_t       recover;            // resynchronize for frame retry, see bsl_opFail()
+  int           retry;              // retries of current READ or WRITE frame
+  int           numSync;            // SYNCH tries
+  uint32_t      wait;               // backoff before next SYNCH [ms]
+  uint64_t      deadline;           // end of current wait [us] (0: none), see micros()
+  uint32_t      waitRx;             // max. gap within current response [ms]
+  uint32_t      addrStart;          // start of READ or WRITE range, GO address
+  uint32_t      addr;               // address of current frame
+  uint32_t      addrEnd;            // end of READ or WRITE range (last+1)
+  uint32_t      numFrame;           // bytes (READ, WRITE) or sectors (ERASE) of current frame
+  char          *buf;               // data of READ or WRITE range
+  const uint8_t *codes;             // remaining sector codes (ERASE, NULL: mass erase)
+  int           numSectors;         // number of remaining sector codes
+  char          Tx[600];            // output to send: frame, fill burst or echo
+  uint32_t      lenTx;              // bytes in Tx
+  uint32_t      numTx;              // bytes of Tx already sent
+  char          Rx[260];            // response of current frame
+  uint32_t      lenRx;              // expected length of response
+  uint32_t      numRx;              // bytes of response received
+} BslOp_t;
+
+// address is in P-flash or D-flash, i.e. supports block programming
+#define IS_FLASH(addr)    (((addr) >= PFLASH_START) || (((addr) >= DFLASH_START) && ((addr) <= DFLASH_END)))
+
+/// init BSL session on open port
+void    bsl_init(Bsl_t *bsl, HANDLE port, uint8_t uartMode);
 
 /// synchronize to microcontroller BSL
-uint8_t bsl_sync(HANDLE ptrPort);
+uint8_t bsl_sync(Bsl_t *bsl);
+
+/// try to synchronize with backoff, return response byte or -1
+int     bsl_syncRetry(Bsl_t *bsl, int maxRetry);
+
+/// detect UART mode (duplex or reply) of BSL via GET command
+uint8_t bsl_getUartMode(Bsl_t *bsl);
+
+/// get BSL version and supported commands, GET only once per session
+uint8_t bsl_getInfo(Bsl_t *bsl);
+
+/// check if BSL supports command (after bsl_getInfo())
+uint8_t bsl_hasCommand(const Bsl_t *bsl, uint8_t cmd);
 
 /// read from microcontroller memory
-uint8_t bsl_memRead(HANDLE ptrPort, uint32_t addrStart, uint32_t numBytes, char *buf);
+uint8_t bsl_memRead(Bsl_t *bsl, uint32_t addrStart, uint32_t numBytes, char *buf);
+
+/// stream microcontroller memory to callback, double buffered
+uint8_t bsl_memReadStream(Bsl_t *bsl, uint32_t addrStart, uint32_t numBytes, BslChunk_t callback, void *arg);
+
+/// read microcontroller memory for all segments of memory image
+uint8_t bsl_memReadImage(Bsl_t *bsl, MemImage_t *image);
+
+/// verify microcontroller memory against memory image
+uint8_t bsl_memVerifyImage(Bsl_t *bsl, const MemImage_t *image);
+
+/// calculate CRC16 of microcontroller memory via routine in RAM
+uint8_t bsl_memCrc(Bsl_t *bsl, uint32_t addrStart, uint32_t numBytes, uint16_t *crc);
+
+/// verify microcontroller memory against memory image via CRC16 calculated on STM8
+uint8_t bsl_memVerifyImageCrc(Bsl_t *bsl, const MemImage_t *image);
 
 /// check if address exists
-uint8_t bsl_memCheck(HANDLE ptrPort, uint32_t addr);
+uint8_t bsl_memCheck(Bsl_t *bsl, uint32_t addr, uint8_t *exists);
 
 /// mass erase microcontroller P- and D-flash
-uint8_t bsl_flashMassErase(HANDLE ptrPort);
+uint8_t bsl_flashMassErase(Bsl_t *bsl);
+
+/// get erase sector codes touched by memory image
+int     bsl_getSectors(const MemImage_t *image, uint8_t *codes);
+
+/// erase microcontroller P- and D-flash sectors
+uint8_t bsl_flashSectorErase(Bsl_t *bsl, const uint8_t *codes, int numSectors);
 
 /// upload to microcontroller flash or RAM
-uint8_t bsl_memWrite(HANDLE ptrPort, uint32_t addrStart, uint32_t numBytes, char *buf, int verbose);
+uint8_t bsl_memWrite(Bsl_t *bsl, uint32_t addrStart, uint32_t numBytes, char *buf);
+
+/// upload memory image to microcontroller flash or RAM
+uint8_t bsl_memWriteImage(Bsl_t *bsl, const MemImage_t *image);
+
+/// check if memory image is resident via short READs
+uint8_t bsl_memResident(Bsl_t *bsl, const MemImage_t *image, uint32_t numSig, uint8_t *resident);
+
+/// upload memory image to microcontroller flash using whole-block WRITEs, report confirmed flash blocks
+uint8_t bsl_flashWriteImage(Bsl_t *bsl, const MemImage_t *image, uint8_t erased, BslChunk_t confirmed, void *arg);
 
 /// jump to flash or RAM
-uint8_t bsl_jumpTo(HANDLE ptrPort, uint32_t addr);
+uint8_t bsl_jumpTo(Bsl_t *bsl, uint32_t addr);
+
+/// init non-blocking operations of session with response timeout [ms]
+void    bsl_opInit(BslOp_t *op, Bsl_t *bsl, uint32_t timeout);
+
+/// start non-blocking synchronization
+uint8_t bsl_opSync(BslOp_t *op);
+
+/// start non-blocking read from microcontroller memory
+uint8_t bsl_opRead(BslOp_t *op, uint32_t addrStart, uint32_t numBytes, char *buf);
+
+/// start non-blocking upload to microcontroller flash or RAM
+uint8_t bsl_opWrite(BslOp_t *op, uint32_t addrStart, uint32_t numBytes, const char *buf);
+
+/// start non-blocking erase of flash sectors (codes NULL: mass erase)
+uint8_t bsl_opErase(BslOp_t *op, const uint8_t *codes, int numSectors);
+
+/// start non-blocking jump to flash or RAM
+uint8_t bsl_opGo(BslOp_t *op, uint32_t addr);
+
+/// advance non-blocking operation with received bytes
+void    bsl_opReceive(BslOp_t *op, const char *data, uint32_t len);
+
+/// advance non-blocking operation after its deadline
+void    bsl_opTimeout(BslOp_t *op);
 
 #endif
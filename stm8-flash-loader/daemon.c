@@ -0,0 +1,288 @@
+/**
+  persistent flashing daemon (POSIX only). Holds the port open and keeps the STM8 in the
+  BSL with RAM routines loaded, so repeated jobs skip reset, sync and routine upload.
+  Jobs are received via a local Unix socket, one line per connection (files with
+  absolute path):
+    flash <erase> <diff> <verify> <file>    upload hex/s19 file to flash, see flash_upload()
+    verify <mode> <file>                    verify memory against file (1=CRC, 2=compare)
+    read <addr> <numBytes> <file>           read memory to Intel hex or binary file
+    go <addr>                               jump to address, i.e. leave BSL
+  Each job runs in a forked child with output sent to the client, so a failed job
+  (which exits) doesn't stop the daemon. The child reports the session state back via
+  a pipe, the daemon then sends DAEMON_STATUS with the exit code of the job
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "misc.h"
+#include "serial_comm.h"
+#include "bootloader.h"
+#include "hexfile.h"
+#include "flash.h"
+#include "daemon.h"
+
+#if defined(WIN32) || defined(WIN64)
+
+void daemon_run(const char *socketPath, const char *portname, int baudrate, uint8_t uartMode) {
+  fprintf(stderr, "\n\nerror in 'daemon_run()': daemon not supported on Windows, exit!\n\n");
+  exit(1);
+}
+
+int daemon_job(const char *socketPath, const char *job) {
+  fprintf(stderr, "\n\nerror in 'daemon_job()': daemon not supported on Windows, exit!\n\n");
+  exit(1);
+}
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// session state, see daemon_exec()
+#define SESSION_COLD      0         // reset, sync and routine upload required
+#define SESSION_SYNCED    1         // in BSL, routines may be disturbed (BSL was re-entered after CRC16)
+#define SESSION_WARM      2         // in BSL with routines loaded
+
+/**
+  load hex or s19 file of job to memory image. Exits on error
+*/
+static void daemon_load(const char *file, MemImage_t *image, char *error) {
+
+  if (load_image(file, image, error)) {
+    fprintf(stderr, "\n\n%s, exit!\n\n", error);
+    exit(1);
+  }
+}
+
+/**
+  execute job in child process. Bring session to SESSION_WARM first, then execute job
+  (empty job: only warm up). Exits on error, else returns new session state
+*/
+static uint8_t daemon_exec(Bsl_t *bsl, const char *portname, int baudrate, uint8_t uartMode, uint8_t state, const char *job) {
+  char        file[STRLEN];
+  char        error[HEXFILE_ERRLEN];
+  int         erase, diff, verify;
+  unsigned    addr, numBytes;
+  MemImage_t  image;
+  uint8_t     reentered;          // BSL re-entered by CRC16 routine
+
+  // warm up session. Routines incl. CRC16 for fast verify
+  if (state == SESSION_COLD)
+    flash_enter(bsl, portname, baudrate, uartMode);
+  if (state != SESSION_WARM)
+    flash_routines(bsl, portname, 1);
+
+  // upload file to flash
+  if (sscanf(job, "flash %d %d %d %999[^\n]", &erase, &diff, &verify, file) == 4) {
+    image_init(&image);
+    daemon_load(file, &image, error);
+    reentered = flash_upload(bsl, portname, &image, erase, diff, verify);
+    image_free(&image);
+    return((reentered || diff || (verify == 1)) ? SESSION_SYNCED : SESSION_WARM);
+  }
+
+  // verify memory against file
+  else if (sscanf(job, "verify %d %999[^\n]", &verify, file) == 2) {
+    image_init(&image);
+    daemon_load(file, &image, error);
+    if (verify == 1)
+      flash_check(bsl, bsl_memVerifyImageCrc(bsl, &image));
+    else
+      flash_check(bsl, bsl_memVerifyImage(bsl, &image));
+    image_free(&image);
+    return((verify == 1) ? SESSION_SYNCED : SESSION_WARM);
+  }
+
+  // read memory to Intel hex or binary file
+  else if (sscanf(job, "read %x %u %999[^\n]", &addr, &numBytes, file) == 3) {
+    flash_dump(bsl, addr, numBytes, file);
+    return(SESSION_WARM);
+  }
+
+  // jump to address, i.e. leave BSL
+  else if (sscanf(job, "go %x", &addr) == 1) {
+    flash_check(bsl, bsl_jumpTo(bsl, addr));
+    return(SESSION_COLD);
+  }
+
+  // only warm up
+  else if (job[0] == '\0')
+    return(SESSION_WARM);
+
+  fprintf(stderr, "\n\nerror in 'daemon_exec()': unknown job '%s', exit!\n\n", job);
+  exit(1);
+}
+
+/**
+  run job in forked child with output to fdOut (-1: stdout of daemon). Update session
+  state and BSL session (UART mode, BSL capabilities). Return exit code of child
+*/
+static int daemon_fork(Bsl_t *bsl, const char *portname, int baudrate, uint8_t uartMode, uint8_t *state, const char *job, int fdOut) {
+  int       fdState[2], status;
+  uint8_t   result;
+  Bsl_t     session;
+  pid_t     pid;
+
+  if (pipe(fdState) != 0) {
+    fprintf(stderr, "\n\nerror in 'daemon_fork()': pipe failed with code %d, exit!\n\n", errno);
+    exit(1);
+  }
+  fflush(stdout);
+  fflush(stderr);
+  pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "\n\nerror in 'daemon_fork()': fork failed with code %d, exit!\n\n", errno);
+    exit(1);
+  }
+
+  // child: execute job and report session state and BSL session
+  if (pid == 0) {
+    close(fdState[0]);
+    if (fdOut >= 0) {
+      dup2(fdOut, STDOUT_FILENO);
+      dup2(fdOut, STDERR_FILENO);
+    }
+    result = daemon_exec(bsl, portname, baudrate, uartMode, *state, job);
+    fflush(stdout);
+    if ((write(fdState[1], &result, 1) != 1) || (write(fdState[1], bsl, sizeof(Bsl_t)) != sizeof(Bsl_t)))
+      exit(1);
+    exit(0);
+  }
+
+  // daemon: wait for child. If it failed the session state is unknown -> cold
+  close(fdState[1]);
+  waitpid(pid, &status, 0);
+  status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+  if ((status == 0) && (read(fdState[0], &result, 1) == 1) && (read(fdState[0], &session, sizeof(Bsl_t)) == sizeof(Bsl_t))) {
+    *state = result;
+    memcpy(bsl, &session, sizeof(Bsl_t));
+  }
+  else
+    *state = SESSION_COLD;
+  close(fdState[0]);
+
+  return(status);
+}
+
+/**
+  run flashing daemon on port, listening for jobs on Unix socket. Doesn't return
+*/
+void daemon_run(const char *socketPath, const char *portname, int baudrate, uint8_t uartMode) {
+  Bsl_t               bsl;
+  struct sockaddr_un  addr;
+  int                 fdListen, fdClient, len, status;
+  char                job[STRLEN];
+  uint8_t             state;
+  uint64_t            t;
+
+  // client may disconnect during job
+  signal(SIGPIPE, SIG_IGN);
+
+  // listen on socket, replace stale socket file
+  if ((fdListen = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    fprintf(stderr, "\n\nerror in 'daemon_run()': socket failed with code %d, exit!\n\n", errno);
+    exit(1);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path)-1);
+  unlink(socketPath);
+  if ((bind(fdListen, (struct sockaddr*) &addr, sizeof(addr)) != 0) || (listen(fdListen, 8) != 0)) {
+    fprintf(stderr, "\n\nerror in 'daemon_run()': cannot listen on '%s' (code %d), exit!\n\n", socketPath, errno);
+    exit(1);
+  }
+
+  // open port once and warm up session
+  flash_init(&bsl, portname);
+  state = SESSION_COLD;
+  printf("daemon on port %s, listening on %s\n", portname, socketPath);
+  daemon_fork(&bsl, portname, baudrate, uartMode, &state, "", -1);
+
+  // serve jobs, one per connection
+  while (1) {
+    if ((fdClient = accept(fdListen, NULL, NULL)) < 0)
+      continue;
+
+    // read job line
+    len = 0;
+    while ((len < STRLEN-1) && (read(fdClient, job+len, 1) == 1) && (job[len] != '\n'))
+      len++;
+    job[len] = '\0';
+
+    // execute job and send exit code
+    t = micros();
+    status = daemon_fork(&bsl, portname, baudrate, uartMode, &state, job, fdClient);
+    dprintf(fdClient, "%s%d\n", DAEMON_STATUS, status);
+    close(fdClient);
+    printf("  job '%s': %s (%.2fs)\n", job, status ? "failed" : "ok", (micros()-t)*1e-6);
+    fflush(stdout);
+  }
+}
+
+/**
+  send job to daemon and print its output. Return exit code of job
+*/
+int daemon_job(const char *socketPath, const char *job) {
+  struct sockaddr_un  addr;
+  int                 fd, lenLine, lenStatus, status;
+  char                line[STRLEN], c;
+  uint8_t             atStart;
+
+  // connect to daemon and send job
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    fprintf(stderr, "\n\nerror in 'daemon_job()': socket failed with code %d, exit!\n\n", errno);
+    exit(1);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path)-1);
+  if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "\n\nerror in 'daemon_job()': cannot connect to daemon on '%s', exit!\n\n", socketPath);
+    exit(1);
+  }
+  if ((write(fd, job, strlen(job)) != (ssize_t) strlen(job)) || (write(fd, "\n", 1) != 1)) {
+    fprintf(stderr, "\n\nerror in 'daemon_job()': cannot send job, exit!\n\n");
+    exit(1);
+  }
+
+  // print output while it arrives. Hold back line start as long as it may be the status
+  status    = 1;
+  lenStatus = strlen(DAEMON_STATUS);
+  lenLine   = 0;
+  atStart   = 1;
+  while (read(fd, &c, 1) == 1) {
+    if (!atStart) {
+      putchar(c);
+      atStart = (c == '\n');
+      if (atStart)
+        fflush(stdout);
+      continue;
+    }
+    line[lenLine++] = c;
+    if ((c == '\n') && (lenLine > lenStatus) && (!strncmp(line, DAEMON_STATUS, lenStatus))) {
+      line[lenLine] = '\0';
+      status  = atoi(line+lenStatus);
+      lenLine = 0;
+      continue;
+    }
+    if ((c != '\n') && (lenLine < STRLEN-1) && (!strncmp(line, DAEMON_STATUS, (lenLine < lenStatus) ? lenLine : lenStatus)))
+      continue;
+    fwrite(line, 1, lenLine, stdout);
+    fflush(stdout);
+    atStart = (c == '\n');
+    lenLine = 0;
+  }
+  fwrite(line, 1, lenLine, stdout);
+  fflush(stdout);
+  close(fd);
+
+  return(status);
+}
+
+#endif // WIN32 || WIN64
@@ -0,0 +1,15 @@
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include <stdint.h>
+
+// last line of daemon response, followed by exit code of job
+#define DAEMON_STATUS   "@status "
+
+/// run flashing daemon on port, listening for jobs on Unix socket. Doesn't return
+void  daemon_run(const char *socketPath, const char *portname, int baudrate, uint8_t uartMode);
+
+/// send job to daemon and print its output. Return exit code of job
+int   daemon_job(const char *socketPath, const char *job);
+
+#endif // _DAEMON_H_
@@ -0,0 +1,940 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#if !defined(WIN32) && !defined(WIN64)
+  #include <sys/wait.h>
+#endif
+
+#include "misc.h"
+#include "serial_comm.h"
+#include "bootloader.h"
+#include "hexfile.h"
+#include "flash.h"
+#include "stats.h"
+
+// RAM routines as constant memory images, generated at build time (requires memimage.h).
+// E_W routine variants are selected via registry (requires Routine_t)
+#include "E_W_ROUTINEs.h"
+#include "crc16_routine.h"
+
+// baudrates tried during negotiation (fastest first), after cached baudrate of port
+const uint32_t BAUD_TRY[] = {921600, 460800, 230400, 115200};
+
+// last P-flash address of device found by flash_detect() (0=unknown)
+static uint32_t g_flashEnd = 0;
+
+// CRC16 routine was loaded by flash_routines()
+static uint8_t  g_crcLoaded = 0;
+
+// statistics and trace of the session of this process, see flash_record()
+static Stats_t  g_stats;
+static Trace_t  g_trace;
+static char     g_fileReport[STRLEN] = "";
+
+/**
+  print message of BSL session to stdout (log callback, see Bsl_t)
+*/
+static void flash_log(const char *msg, void *arg) {
+  fputs(msg, stdout);
+  fflush(stdout);
+}
+
+/**
+  print one dot per kB read or written (progress callback, see Bsl_t)
+*/
+static void flash_progress(uint32_t numBytes, void *arg) {
+  putchar('.');
+  fflush(stdout);
+}
+
+/**
+  exit with error message of BSL session if status is not BSL_OK
+*/
+void flash_check(Bsl_t *bsl, uint8_t status) {
+
+  if (status != BSL_OK) {
+    fprintf(stderr, "\n\n%s, exit!\n\n", bsl->error);
+    exit(1);
+  }
+}
+
+/**
+  exit with error message if a memory image function failed (result 0: out of memory)
+*/
+static void flash_checkImage(uint8_t result, const char *func) {
+
+  if (!result) {
+    fprintf(stderr, "\n\nerror in '%s': cannot allocate memory image, exit!\n\n", func);
+    exit(1);
+  }
+}
+
+/**
+  atexit() handler of flash_record(). Must not exit
+*/
+static void flash_statsAtExit(void) {
+  stats_write(&g_stats, g_fileReport);
+}
+
+/**
+  record the session of this process (see flash_init()): write protocol statistics to
+  JSON report fileReport when the process exits, i.e. also for runs aborted on error, and
+  all bytes via port to trace fileTrace. Empty names are skipped. Exits on error
+*/
+void flash_record(const char *fileReport, const char *fileTrace) {
+
+  if (strlen(fileReport) > 0) {
+    strncpy(g_fileReport, fileReport, STRLEN-1);
+    atexit(flash_statsAtExit);
+  }
+  if ((strlen(fileTrace) > 0) && !trace_start(&g_trace, fileTrace)) {
+    fprintf(stderr, "\n\nerror in 'flash_record()': cannot create trace '%s', exit!\n\n", fileTrace);
+    exit(1);
+  }
+}
+
+/**
+  open port and init BSL session with output to stdout. Statistics are collected for the
+  session, the trace is recorded if started by flash_record(). Exits on error
+*/
+void flash_init(Bsl_t *bsl, const char *portname) {
+  HANDLE    ptrPort;              // handle to communication port
+
+  stats_init(&g_stats, portname);
+  ptrPort = init_port(portname, 9600, 1000, 8, 0, 1, 0, 0);   // use no parity
+  if (!ptrPort) {
+    fprintf(stderr, "\n\nerror in 'init_port(%s)': open port failed, exit!\n\n", portname);
+    exit(1);
+  }
+  bsl_init(bsl, ptrPort, UART_MODE_REPLY);
+  bsl->log      = flash_log;
+  bsl->progress = flash_progress;
+  bsl->stats    = &g_stats;
+  bsl->trace    = &g_trace;
+}
+
+/**
+  reset STM8 via UART command (9600 Baud, same as in STM8 SW!) and set communication
+  baudrate for BSL. Return 1 if baudrate is not supported by port
+*/
+uint8_t reset_STM8(Bsl_t *bsl, uint32_t baudrate) {
+  char      buf[10];
+  int       i;
+
+  if (set_baudrate(bsl->port, bsl->trace, 9600))
+    return(1);
+  sprintf(buf, "##reset##");
+  for (i=0; i<9; i++) {
+    send_port(bsl->port, bsl->trace, 1, buf+i);   // send reset command bytewise to account for possible slow handling on STM8 side
+    SLEEP(10);
+  }
+  if (set_baudrate(bsl->port, bsl->trace, baudrate))
+    return(1);
+  SLEEP(20);                        // allow BSL to initialize
+
+  flush_port(bsl->port, bsl->trace);
+  SLEEP(200);                       // required to make flush work, for some reason
+  flush_port(bsl->port, bsl->trace);
+
+  return(0);
+}
+
+/**
+  find highest baudrate the port and BSL can hold. Try cached baudrate of port first,
+  then BAUD_TRY. A baudrate is accepted if the first SYNCH is answered by ACK (or NACK
+  if BSL was already synchronized) and a second one by NACK, i.e. the BSL has locked
+  to this baudrate. Else (e.g. NACK or framing error) reset STM8 and try next. Store
+  accepted baudrate in cache and return it
+*/
+uint32_t negotiate_baudrate(Bsl_t *bsl, const char *portname) {
+  char      fileCache[STRLEN];
+  FILE      *fp;
+  uint32_t  baudrate, cached = 0;
+  int       i, response;
+
+  printf("  reset via UART command ... ");
+  fflush(stdout);
+
+  // get baudrate of last run via this port
+  if (get_cache_file(portname, ".baud", fileCache, STRLEN) && ((fp = fopen(fileCache, "r")) != NULL)) {
+    if (fscanf(fp, "%u", &cached) != 1)
+      cached = 0;
+    fclose(fp);
+  }
+
+  // try cached baudrate first, then from fastest to slowest
+  for (i=-1; i<(int) (sizeof(BAUD_TRY)/sizeof(BAUD_TRY[0])); i++) {
+    baudrate = (i < 0) ? cached : BAUD_TRY[i];
+    if ((baudrate == 0) || ((i >= 0) && (baudrate == cached)))
+      continue;
+
+    // reset STM8 and synchronize
+    if (reset_STM8(bsl, baudrate))
+      continue;
+    response = bsl_syncRetry(bsl, 15);
+    if (((response == ACK) || (response == NACK)) && (bsl_syncRetry(bsl, 1) == NACK)) {
+      printf("ok (%s, %d Baud)\n", (response == ACK) ? "ACK" : "NACK", (int) baudrate);
+      fflush(stdout);
+      if (get_cache_file(portname, ".baud", fileCache, STRLEN) && ((fp = fopen(fileCache, "w")) != NULL)) {
+        fprintf(fp, "%u\n", baudrate);
+        fclose(fp);
+      }
+      return(baudrate);
+    }
+    printf("%d failed, ", (int) baudrate);
+    fflush(stdout);
+    stats_retry(bsl->stats, RETRY_BAUD);
+  }
+
+  fprintf(stderr, "\n\nerror in 'negotiate_baudrate()': no response from BSL, exit!\n\n");
+  exit(1);
+}
+
+/**
+  enter BSL via already open port: reset STM8 and synchronize. Use specified baudrate,
+  or negotiate highest reliable baudrate (baudrate=0). Detect UART mode for uartMode=255.
+  Exits on error
+*/
+void flash_enter(Bsl_t *bsl, const char *portname, int baudrate, uint8_t uartMode) {
+
+  if (baudrate != 0) {
+    printf("  reset via UART command ... ");
+    fflush(stdout);
+    if (reset_STM8(bsl, baudrate)) {
+      fprintf(stderr, "\n\nerror in 'flash_enter()': baudrate %d not supported by port, exit!\n\n", baudrate);
+      exit(1);
+    }
+    flash_check(bsl, bsl_sync(bsl));
+  }
+  else
+    baudrate = negotiate_baudrate(bsl, portname);
+  stats_setBaudrate(bsl->stats, baudrate);
+
+  // detect or set UART mode (duplex or reply)
+  if (uartMode == 255)
+    flash_check(bsl, bsl_getUartMode(bsl));
+  else
+    bsl->uartMode = uartMode;
+}
+
+/**
+  identify device connected to BSL: BSL version and commands via GET (once per session,
+  see bsl_getInfo()), P-flash size via binary search for the last existing 1kB block
+  (bsl_memCheck(), ~8 probes). Select the E_W routine for the size class (8/32/128/256kB),
+  preferring exact BSL version and standard family. Exits if the BSL lacks READ or WRITE
+  or no routine for the device is available, else returns the routine. 128kB and 256kB
+  parts are detected, but rejected as the registry has no routine for them. Extended
+  addresses above 0xFFFF are also not handled by the CRC16 routine (see bsl_memCrc())
+  and have no erase code beyond 128kB (see bsl_getSectors())
+*/
+const Routine_t *flash_detect(Bsl_t *bsl) {
+  uint8_t         version;        // BSL version, e.g. 0x13 for v1.3
+  uint8_t         exists;         // address exists on device
+  uint32_t        addrLo, addrHi; // last known existing, first known missing address
+  uint32_t        addr, flashKB, classKB;
+  const Routine_t *routine, *best;
+  int             i;
+
+  printf("  detect device ... ");
+  fflush(stdout);
+
+  // BSL version and commands. READ and WRITE are required for all further steps
+  flash_check(bsl, bsl_getInfo(bsl));
+  version = bsl->info.version;
+  if ((!bsl_hasCommand(bsl, READ)) || (!bsl_hasCommand(bsl, WRITE))) {
+    fprintf(stderr, "\n\nerror in 'flash_detect()': BSL v%x.%x doesn't support READ and WRITE, exit!\n\n", version >> 4, version & 0x0F);
+    exit(1);
+  }
+
+  // binary search for end of P-flash with 1kB granularity
+  flash_check(bsl, bsl_memCheck(bsl, PFLASH_START, &exists));
+  if (!exists) {
+    fprintf(stderr, "\n\nerror in 'flash_detect()': no flash at 0x%04x, exit!\n\n", PFLASH_START);
+    exit(1);
+  }
+  addrLo = PFLASH_START;
+  addrHi = PFLASH_MAXEND + 1;
+  while (addrHi - addrLo > 1024) {
+    addr = addrLo + (((addrHi - addrLo) / 2) & ~((uint32_t) 1023));
+    flash_check(bsl, bsl_memCheck(bsl, addr, &exists));
+    if (exists)
+      addrLo = addr;
+    else
+      addrHi = addr;
+  }
+  g_flashEnd = addrHi - 1;
+  flashKB    = (addrHi - PFLASH_START) / 1024;
+
+  // size class of E_W routines
+  if (flashKB <= 8)
+    classKB = 8;
+  else if (flashKB <= 32)
+    classKB = 32;
+  else if (flashKB <= 128)
+    classKB = 128;
+  else
+    classKB = 256;
+
+  // best matching routine: exact version first, then standard over low density family
+  best = NULL;
+  for (i=0; i<NUM_E_W_ROUTINES; i++) {
+    routine = &(E_W_ROUTINES[i]);
+    if (routine->flashKB != classKB)
+      continue;
+    if ((best == NULL) ||
+        (((routine->version == version) << 1) + (routine->family == 'S') > ((best->version == version) << 1) + (best->family == 'S')))
+      best = routine;
+  }
+  if (best == NULL) {
+    fprintf(stderr, "\n\nerror in 'flash_detect()': no E_W routine for %dkB device (BSL v%x.%x), exit!\n\n",
+      (int) flashKB, version >> 4, version & 0x0F);
+    exit(1);
+  }
+
+  printf("ok (%dkB flash, BSL v%x.%x, E_W %s%s)\n", (int) flashKB, version >> 4, version & 0x0F, best->name,
+    (best->version == version) ? "" : ", no exact version match");
+  fflush(stdout);
+
+  return(best);
+}
+
+/**
+  upload RAM routine unless it is already resident (see bsl_memResident()).
+  The duration of the last upload is kept in the per-port cache (extension ext) to
+  report the time saved by skipping it. Without cache (e.g. HOME not set) it isn't reported
+*/
+static void flash_routine(Bsl_t *bsl, const char *portname, const char *name, const char *ext, const MemImage_t *ramImage) {
+  char        fileCache[STRLEN];  // name of cache file with duration of last upload
+  FILE        *fp;
+  uint8_t     resident;           // routine is resident in RAM
+  uint64_t    t;                  // duration of check or upload [us]
+  unsigned    tUpload = 0;        // duration of last upload [us]
+  uint8_t     cache;              // cache file available
+
+  cache = get_cache_file(portname, ext, fileCache, STRLEN);
+
+  // skip upload if routine is resident
+  t = micros();
+  flash_check(bsl, bsl_memResident(bsl, ramImage, ROUTINE_SIGNATURE, &resident));
+  if (resident) {
+    t = micros() - t;
+    if (cache && ((fp = fopen(fileCache, "r")) != NULL)) {
+      if (fscanf(fp, "%u", &tUpload) != 1)
+        tUpload = 0;
+      fclose(fp);
+    }
+    if (tUpload > t)
+      printf("  %s routine resident, skip upload (check %.1fms, saved %.1fms)\n", name, t*1e-3, (tUpload-t)*1e-3);
+    else
+      printf("  %s routine resident, skip upload (check %.1fms)\n", name, t*1e-3);
+  }
+
+  // upload routine and store duration
+  else {
+    t = micros();
+    flash_check(bsl, bsl_memWriteImage(bsl, ramImage));
+    t = micros() - t;
+    if (cache && ((fp = fopen(fileCache, "w")) != NULL)) {
+      fprintf(fp, "%u\n", (unsigned) t);
+      fclose(fp);
+    }
+  }
+  fflush(stdout);
+}
+
+/**
+  upload RAM routines unless resident: E_W routines for flash programming (variant for the
+  detected device), CRC16 routine for fast verify if loadCrc
+*/
+void flash_routines(Bsl_t *bsl, const char *portname, uint8_t loadCrc) {
+
+  flash_routine(bsl, portname, "E_W", ".ew", flash_detect(bsl)->image);
+  if (loadCrc) {
+    flash_routine(bsl, portname, "CRC16", ".crc16", &STM8_Routines_crc16_routine);
+    g_crcLoaded = 1;
+  }
+}
+
+/**
+  open port, enter BSL and upload RAM routines, see flash_init(), flash_enter() and
+  flash_routines(). Exits on error, else the session is ready in bsl
+*/
+void flash_open(Bsl_t *bsl, const char *portname, int baudrate, uint8_t uartMode, uint8_t loadCrc) {
+
+  flash_init(bsl, portname);
+  flash_enter(bsl, portname, baudrate, uartMode);
+  flash_routines(bsl, portname, loadCrc);
+}
+
+// resume journal of an interrupted upload, see flash_upload()
+typedef struct {
+  char      file[STRLEN];         // journal file of port
+  uint32_t  numBytes;             // size of image, see image_numBytes()
+  uint16_t  crc;                  // CRC16 of image, see flash_imageCrc()
+  uint8_t   erase;                // erase mode of upload (ERASE_*)
+  uint32_t  addrNext;             // flash address after last acknowledged frame
+  uint32_t  addrSaved;            // addrNext last written to journal file
+} Journal_t;
+
+/**
+  identify memory image for the resume journal (together with its size): CRC16 over start
+  addresses and data of all segments
+*/
+static uint16_t flash_imageCrc(const MemImage_t *image) {
+  uint16_t  crc = 0xFFFF;
+  char      addr[4];
+  int       i;
+
+  for (i=0; i<image->numSegments; i++) {
+    addr[0] = (char) (image->segment[i].addrStart >> 24);
+    addr[1] = (char) (image->segment[i].addrStart >> 16);
+    addr[2] = (char) (image->segment[i].addrStart >> 8);
+    addr[3] = (char) (image->segment[i].addrStart);
+    crc = crc16(addr, 4, crc);
+    crc = crc16(image->segment[i].data, image->segment[i].numBytes, crc);
+  }
+
+  return(crc);
+}
+
+/**
+  record acknowledged flash frame in resume journal (callback of bsl_flashWriteImage()).
+  The file is only rewritten when a new 1kB sector is reached, i.e. a resume may repeat
+  the frames of up to one sector
+*/
+static uint8_t flash_journalChunk(uint32_t addr, const char *data, uint32_t numBytes, void *arg) {
+  Journal_t *journal = (Journal_t*) arg;
+  FILE      *fp;
+
+  journal->addrNext = addr + numBytes;
+  if ((journal->addrNext / PFLASH_BLOCKSIZE) == (journal->addrSaved / PFLASH_BLOCKSIZE))
+    return(0);
+  journal->addrSaved = journal->addrNext;
+  if ((fp = fopen(journal->file, "w")) != NULL) {
+    fprintf(fp, "%x %04x %d %x\n", (unsigned) journal->numBytes, (unsigned) journal->crc, (int) journal->erase, (unsigned) journal->addrNext);
+    fclose(fp);
+  }
+
+  return(0);
+}
+
+/**
+  check resume journal of port for an interrupted upload of the same image with the same erase
+  mode. Doesn't access the device, see flash_journalValid(). Return flash address to resume
+  upload at, or 0 to upload complete image
+*/
+static uint32_t flash_journalLoad(Journal_t *journal) {
+  FILE      *fp;
+  unsigned  numBytes, crc, addr;
+  int       erase, num;
+
+  // read journal
+  if ((fp = fopen(journal->file, "r")) == NULL)
+    return(0);
+  num = fscanf(fp, "%x %x %d %x", &numBytes, &crc, &erase, &addr);
+  fclose(fp);
+  if ((num != 4) || (numBytes != journal->numBytes) || (crc != journal->crc) || (erase != journal->erase) || (addr < FLASH_BLOCKSIZE))
+    return(0);
+
+  journal->addrNext  = addr;
+  journal->addrSaved = addr;
+  return(addr);
+}
+
+/**
+  compare chunk read back by bsl_memReadStream() with image segment (arg). Stop on mismatch
+*/
+static uint8_t flash_compareChunk(uint32_t addr, const char *data, uint32_t numBytes, void *arg) {
+  const MemSegment_t *seg = (const MemSegment_t*) arg;
+
+  return(memcmp(seg->data + (addr - seg->addrStart), data, numBytes) != 0);
+}
+
+/**
+  check that the device holds all flash data of the image confirmed in the resume journal
+  (below addrNext), i.e. the board was neither swapped nor flashed by other means since the
+  interrupted upload. Checked via CRC16 calculated on STM8 if the routine was loaded (see
+  flash_routines()), else by reading back. Return 1 if the journal is valid. Exits on error
+*/
+static uint8_t flash_journalValid(Bsl_t *bsl, const MemImage_t *image, uint32_t addrNext) {
+  MemSegment_t  *seg;
+  uint32_t      addrEnd;          // end of confirmed part of segment (last+1)
+  uint16_t      crc;
+  uint8_t       status;
+  int           i;
+
+  for (i=0; i<image->numSegments; i++) {
+    seg = image->segment + i;
+    addrEnd = seg->addrStart + seg->numBytes;
+    if (!(IS_FLASH(seg->addrStart) && IS_FLASH(addrEnd-1)) || (seg->addrStart >= addrNext))
+      continue;
+    if (addrEnd > addrNext)
+      addrEnd = addrNext;
+
+    // CRC16 on STM8. Ranges the routine can't handle are read back
+    if (g_crcLoaded) {
+      status = bsl_memCrc(bsl, seg->addrStart, addrEnd - seg->addrStart, &crc);
+      if (status == BSL_OK) {
+        if (crc != crc16(seg->data, addrEnd - seg->addrStart, 0xFFFF))
+          return(0);
+        continue;
+      }
+      if (status != BSL_ERR_PARAM)
+        flash_check(bsl, status);
+    }
+
+    // read back and compare
+    status = bsl_memReadStream(bsl, seg->addrStart, addrEnd - seg->addrStart, flash_compareChunk, seg);
+    if (status == BSL_STOPPED)
+      return(0);
+    flash_check(bsl, status);
+  }
+
+  return(1);
+}
+
+/**
+  check flash content of port cache against device for differential upload. The cache is
+  per port, i.e. the device may have been flashed by other means since. All blocks touched
+  by the image must be cached and match the CRC16 calculated on STM8 (see bsl_memCrc(),
+  routine loaded by flash_routines()). On success blocks holds the cached content. Return
+  1 if cache is valid
+*/
+static uint8_t flash_cacheValid(Bsl_t *bsl, const MemImage_t *imageRef, MemImage_t *blocks) {
+  MemSegment_t  *seg;
+  uint16_t      crc;
+  int           i;
+
+  for (i=0; i<blocks->numSegments; i++) {
+    seg = blocks->segment + i;
+    if (!image_contains(imageRef, seg->addrStart, seg->numBytes))
+      return(0);
+    image_getData(imageRef, seg->addrStart, seg->numBytes, seg->data);
+    if ((bsl_memCrc(bsl, seg->addrStart, seg->numBytes, &crc) != BSL_OK) || (crc != crc16(seg->data, seg->numBytes, 0xFFFF)))
+      return(0);
+  }
+
+  return(1);
+}
+
+/**
+  upload memory image to flash after flash_open(). Optionally erase before (ERASE_*) and
+  verify after upload, or only rewrite changed blocks (flashDiff). Enables the BSL in the
+  option bytes and updates the flash content cache of the port. Acknowledged blocks are
+  recorded in a resume journal, so an interrupted upload of the same image continues after
+  the last confirmed block without erase. Exits on error, else returns 1 if the BSL was
+  re-entered by the CRC16 routine (see bsl_memCrc()), i.e. RAM routines may be disturbed
+*/
+uint8_t flash_upload(Bsl_t *bsl, const char *portname, const MemImage_t *imageIn, uint8_t flashErase, uint8_t flashDiff, uint8_t verifyUpload) {
+  int       i;                    // generic variable
+
+  // for differential upload
+  char      fileCache[STRLEN];    // name of cache file with flash content of last upload
+  MemImage_t imageRef;            // known flash content
+  MemImage_t imageDiff;           // changed flash blocks
+  MemImage_t imageCheck;          // blocks to check validity of cache
+  uint8_t   cacheValid;           // flash content from cache is valid
+  uint32_t  numChanged;           // number of changed flash blocks
+
+  // for sector erase
+  uint8_t   sectors[256];         // codes of erased sectors
+  char      blank[PFLASH_BLOCKSIZE];  // content of erased sector
+  int       numSectors;           // number of erased sectors
+
+  // for resume of interrupted upload
+  Journal_t journal;              // progress of upload
+  MemImage_t imageRest;           // image part not yet confirmed
+  uint32_t  addrResume = 0;       // flash address to resume upload at (0=complete upload)
+  MemSegment_t *seg;              // segment of image
+  uint32_t  addrEnd;              // last address of segment
+
+  uint8_t   reentered = 0;        // BSL re-entered by CRC16 routine
+
+  image_init(&imageRef);
+  image_init(&imageRest);
+  image_init(&imageDiff);
+  image_init(&imageCheck);
+
+  // check image against flash size of detected device
+  if ((imageIn != NULL) && (g_flashEnd != 0)) {
+    for (i=0; i<imageIn->numSegments; i++) {
+      if ((imageIn->segment[i].addrStart >= PFLASH_START) && (imageIn->segment[i].addrStart + imageIn->segment[i].numBytes - 1 > g_flashEnd)) {
+        fprintf(stderr, "\n\nerror in 'flash_upload()': image exceeds flash (0x%x > 0x%x), exit!\n\n",
+          (unsigned) (imageIn->segment[i].addrStart + imageIn->segment[i].numBytes - 1), (unsigned) g_flashEnd);
+        exit(1);
+      }
+    }
+  }
+
+  // BSL without ERASE (see GET response): unwritten bytes of blocks are read back instead
+  if ((flashErase != ERASE_NONE) && (!bsl_hasCommand(bsl, ERASE))) {
+    printf("  BSL doesn't support ERASE, upload without erase\n");
+    flashErase = ERASE_NONE;
+  }
+
+  // erase sectors touched by image, e.g. keep calibration data in D-flash. Fall back to
+  // mass erase if a sector has no erase code
+  numSectors = 0;
+  if ((flashErase == ERASE_SECTORS) && (imageIn != NULL)) {
+    if ((numSectors = bsl_getSectors(imageIn, sectors)) < 0) {
+      printf("  image exceeds sectors with erase code (128kB), use mass erase\n");
+      flashErase = ERASE_MASS;
+      numSectors = 0;
+    }
+  }
+
+  // check for interrupted upload of same image. Flash was already erased by that upload
+  journal.file[0] = '\0';
+  if ((imageIn != NULL) && (!flashDiff) && get_cache_file(portname, ".resume", journal.file, STRLEN)) {
+    journal.numBytes = image_numBytes(imageIn);
+    journal.crc      = flash_imageCrc(imageIn);
+    journal.erase    = flashErase;
+    journal.addrNext  = 0;
+    journal.addrSaved = 0;
+    if ((addrResume = flash_journalLoad(&journal)) != 0) {
+      printf("  check interrupted upload ");
+      fflush(stdout);
+      reentered |= g_crcLoaded;
+      if (flash_journalValid(bsl, imageIn, addrResume))
+        printf(" ok, resume at 0x%04x\n", (unsigned) addrResume);
+      else {
+        printf(" outdated, upload complete image\n");
+        addrResume = 0;
+      }
+    }
+  }
+
+  // erase touched sectors or complete flash
+  if (addrResume == 0) {
+    if (numSectors > 0)
+      flash_check(bsl, bsl_flashSectorErase(bsl, sectors, numSectors));
+    else if (flashErase == ERASE_MASS)
+      flash_check(bsl, bsl_flashMassErase(bsl));
+  }
+
+  // upload file to flash
+  if (imageIn != NULL) {
+
+    // differential upload: only write blocks which differ from current flash content
+    if (flashDiff) {
+
+      // get flash content from cache of last upload. Check all blocks touched by image
+      // on device via CRC16
+      cacheValid = 0;
+      if ((imageIn->numSegments > 0) && get_cache_file(portname, ".img", fileCache, STRLEN) && image_load(fileCache, &imageRef)) {
+        flash_checkImage(image_alignBlocks(imageIn, FLASH_BLOCKSIZE, &imageCheck), "flash_upload()");
+        cacheValid = flash_cacheValid(bsl, &imageRef, &imageCheck);
+        reentered  = 1;
+        if (!cacheValid)
+          printf("  cached flash content outdated\n");
+      }
+
+      // else read back all blocks touched by image
+      if (!cacheValid) {
+        image_free(&imageRef);
+        flash_checkImage(image_alignBlocks(imageIn, FLASH_BLOCKSIZE, &imageRef), "flash_upload()");
+        flash_check(bsl, bsl_memReadImage(bsl, &imageRef));
+      }
+
+      // write changed blocks only
+      flash_checkImage(image_diffBlocks(imageIn, &imageRef, FLASH_BLOCKSIZE, &imageDiff, &numChanged), "flash_upload()");
+      printf("  differential upload: %d blocks changed\n", (int) numChanged);
+      flash_check(bsl, bsl_flashWriteImage(bsl, &imageDiff, 0, NULL, NULL));
+
+      // update known flash content
+      for (i=0; i<imageDiff.numSegments; i++)
+        flash_checkImage(image_setData(&imageRef, imageDiff.segment[i].addrStart, imageDiff.segment[i].numBytes, imageDiff.segment[i].data), "flash_upload()");
+    }
+
+    // upload memory image to STM8. On resume skip flash below resume address, other memory
+    // (e.g. option bytes) is always written. Journal is obsolete after upload
+    else {
+      if (addrResume != 0) {
+        for (i=0; i<imageIn->numSegments; i++) {
+          seg = imageIn->segment + i;
+          addrEnd = seg->addrStart + seg->numBytes - 1;
+          if (!(IS_FLASH(seg->addrStart) && IS_FLASH(addrEnd)) || (seg->addrStart >= addrResume))
+            flash_checkImage(image_setData(&imageRest, seg->addrStart, seg->numBytes, seg->data), "flash_upload()");
+          else if (addrEnd >= addrResume)
+            flash_checkImage(image_setData(&imageRest, addrResume, addrEnd - addrResume + 1, seg->data + (addrResume - seg->addrStart)), "flash_upload()");
+        }
+        flash_check(bsl, bsl_flashWriteImage(bsl, &imageRest, flashErase, flash_journalChunk, &journal));
+      }
+      else
+        flash_check(bsl, bsl_flashWriteImage(bsl, imageIn, flashErase, flash_journalChunk, &journal));
+      remove(journal.file);
+    }
+
+    // enable ROM bootloader after upload (option bytes always on same address).
+    // Required before CRC verify, which re-enters the BSL
+    flash_check(bsl, bsl_memWrite(bsl, 0x487E, 2, (char*)"\x55\xAA"));
+
+    // verify upload
+    if (verifyUpload == 1) {
+      flash_check(bsl, bsl_memVerifyImageCrc(bsl, imageIn));
+      reentered = 1;
+    }
+    else if (verifyUpload == 2)
+      flash_check(bsl, bsl_memVerifyImage(bsl, imageIn));
+
+    // store flash content for next differential upload. Without erase the content is unknown
+    if (get_cache_file(portname, ".img", fileCache, STRLEN)) {
+      if (flashDiff)
+        image_save(fileCache, &imageRef);
+      else if (flashErase == ERASE_MASS)
+        image_save(fileCache, imageIn);
+
+      // sector erase: erased sectors with image, previous content elsewhere
+      else if (flashErase == ERASE_SECTORS) {
+        image_load(fileCache, &imageRef);
+        memset(blank, 0, PFLASH_BLOCKSIZE);
+        for (i=0; i<numSectors; i++)
+          flash_checkImage(image_setData(&imageRef, (sectors[i] < 0x80) ? (PFLASH_START + sectors[i]*PFLASH_BLOCKSIZE) : (DFLASH_START + (sectors[i]-0x80)*PFLASH_BLOCKSIZE), PFLASH_BLOCKSIZE, blank), "flash_upload()");
+        for (i=0; i<imageIn->numSegments; i++)
+          flash_checkImage(image_setData(&imageRef, imageIn->segment[i].addrStart, imageIn->segment[i].numBytes, imageIn->segment[i].data), "flash_upload()");
+        image_save(fileCache, &imageRef);
+      }
+      else
+        remove(fileCache);
+    }
+  }
+
+  image_free(&imageRef);
+  image_free(&imageDiff);
+  image_free(&imageCheck);
+  image_free(&imageRest);
+
+  return(reentered);
+}
+
+// output of memory dump, see flash_dump()
+typedef struct {
+  char      *buf;                 // mapped output file
+  uint32_t  addrStart;            // first address of dump
+  uint32_t  pos;                  // write position in file
+  uint32_t  addrUpper;            // upper 16 address bits of last Intel hex record
+  uint8_t   hex;                  // Intel hex (else binary)
+} Dump_t;
+
+/**
+  encode chunk of memory dump and write it to the mapped output file
+*/
+static uint8_t flash_dumpChunk(uint32_t addr, const char *data, uint32_t numBytes, void *arg) {
+  Dump_t    *dump = (Dump_t*) arg;
+
+  if (dump->hex)
+    dump->pos += encode_hex(dump->buf + dump->pos, addr, data, numBytes, &(dump->addrUpper));
+  else
+    memcpy(dump->buf + (addr - dump->addrStart), data, numBytes);
+  return(0);
+}
+
+/**
+  read memory range to Intel hex (extension .hex or .ihx) or binary file after flash_enter().
+  READ replies are streamed into the memory mapped file, encoding overlaps the transfer
+  of the next chunk (see bsl_memReadStream()). Exits on error
+*/
+void flash_dump(Bsl_t *bsl, uint32_t addrStart, uint32_t numBytes, const char *filename) {
+  Dump_t    dump;
+  uint32_t  len;
+  int       lenName;
+  char      error[HEXFILE_ERRLEN];
+
+  if (numBytes == 0) {
+    fprintf(stderr, "\n\nerror in 'flash_dump()': no bytes to read, exit!\n\n");
+    exit(1);
+  }
+
+  // size of output file is known in advance
+  lenName   = strlen(filename);
+  dump.hex  = (lenName > 4) && ((!strcmp(filename+lenName-4, ".hex")) || (!strcmp(filename+lenName-4, ".ihx")));
+  dump.addrStart = addrStart;
+  dump.pos       = 0;
+  dump.addrUpper = 0;
+  len = numBytes;
+  if (dump.hex) {
+    len  = encode_hex(NULL, addrStart, NULL, numBytes, &(dump.addrUpper)) + encode_hexEnd(NULL);
+    dump.addrUpper = 0;
+  }
+
+  // stream memory to file
+  printf("  read ");
+  fflush(stdout);
+  if ((dump.buf = map_outfile(filename, len, error)) == NULL) {
+    fprintf(stderr, "\n\n%s, exit!\n\n", error);
+    exit(1);
+  }
+  flash_check(bsl, bsl_memReadStream(bsl, addrStart, numBytes, flash_dumpChunk, &dump));
+  printf(" ok\n");
+  fflush(stdout);
+  if (dump.hex)
+    encode_hexEnd(dump.buf + dump.pos);
+  unmap_outfile(dump.buf, len);
+}
+
+/**
+  read memory of STM8 connected to port to file (see flash_dump()) without uploading RAM
+  routines, then start application if jumpApp. Exits on error, else returns 0
+*/
+int flash_dumpPort(const char *portname, int baudrate, uint8_t uartMode, uint32_t addrStart, uint32_t numBytes, const char *filename, uint8_t jumpApp) {
+  Bsl_t     bsl;                  // BSL session on port
+
+  flash_init(&bsl, portname);
+  flash_enter(&bsl, portname, baudrate, uartMode);
+  flash_dump(&bsl, addrStart, numBytes, filename);
+
+  // jump to application
+  if (jumpApp)
+    flash_check(&bsl, bsl_jumpTo(&bsl, PFLASH_START));
+
+  close_port(&bsl.port);
+  stats_setResult(bsl.stats, 0);
+
+  return(0);
+}
+
+/**
+  upload memory image (NULL: none) to STM8 connected to port and start application. Exits
+  on error, else returns 0. Protocol statistics are collected for the run, see stats.c
+*/
+int flash_port(const char *portname, int baudrate, uint8_t uartMode, uint8_t flashErase, uint8_t flashDiff, uint8_t verifyUpload, const MemImage_t *imageIn) {
+  Bsl_t     bsl;                  // BSL session on port
+
+  flash_open(&bsl, portname, baudrate, uartMode, (imageIn != NULL) && ((verifyUpload == 1) || flashDiff));
+  flash_upload(&bsl, portname, imageIn, flashErase, flashDiff, verifyUpload);
+
+  // jump to application
+  flash_check(&bsl, bsl_jumpTo(&bsl, PFLASH_START));
+
+  close_port(&bsl.port);
+  stats_setResult(bsl.stats, 0);
+
+  return(0);
+}
+
+/**
+  upload memory image to STM8s connected to several ports. On POSIX one worker process
+  per port is forked, which shares the memory image read-only. Output of each worker is
+  written to a log in the cache directory and printed when all are done, followed by a
+  pass/fail summary. On Windows ports are handled sequentially. If fileReport is not
+  empty, the protocol statistics of all ports are merged into this JSON report. Return
+  number of failed uploads
+*/
+int flash_ports(char **portList, int numPorts, int baudrate, uint8_t uartMode, uint8_t flashErase, uint8_t flashDiff, uint8_t verifyUpload, const MemImage_t *imageIn, const char *fileReport) {
+  char      fileLog[MAX_PORTS][STRLEN]; // output of workers
+  char      fileStats[MAX_PORTS][STRLEN]; // statistics of workers
+  char      *fileList[MAX_PORTS];
+  uint64_t  timeStart[MAX_PORTS];       // start time of workers [us]
+  uint64_t  timeEnd[MAX_PORTS];         // end time of workers [us]
+  int       result[MAX_PORTS];          // exit code of workers
+  uint64_t  timeTotal;                  // start time of panel [us]
+  int       numFailed;
+  int       i;
+  FILE      *fp;
+  char      buf[1000];
+
+  timeTotal = micros();
+  for (i=0; i<numPorts; i++) {
+    fileStats[i][0] = '\0';
+    if ((strlen(fileReport) > 0) && get_cache_file(portList[i], ".json", fileStats[i], STRLEN))
+      remove(fileStats[i]);
+    fileList[i] = fileStats[i];
+  }
+
+#if defined(WIN32) || defined(WIN64)
+
+  // sequential upload. Errors exit as for single port
+  for (i=0; i<numPorts; i++) {
+    fileLog[i][0] = '\0';
+    printf("\nport %s:\n", portList[i]);
+    timeStart[i] = micros();
+    result[i]    = flash_port(portList[i], baudrate, uartMode, flashErase, flashDiff, verifyUpload, imageIn);
+    timeEnd[i]   = micros();
+    if ((fileStats[i][0] != '\0') && !stats_write(&g_stats, fileStats[i])) {
+      fprintf(stderr, "\n\nerror in 'flash_ports()': cannot write report '%s', exit!\n\n", fileStats[i]);
+      exit(1);
+    }
+  }
+
+#else
+
+  pid_t     pid[MAX_PORTS];             // process IDs of workers
+  pid_t     pidDone;
+  int       status, numRunning;
+
+  // start one worker per port
+  fflush(stdout);
+  fflush(stderr);
+  numRunning = 0;
+  for (i=0; i<numPorts; i++) {
+    if (!get_cache_file(portList[i], ".log", fileLog[i], STRLEN)) {
+      fprintf(stderr, "\n\nerror in 'flash_ports()': cannot create log for port '%s', exit!\n\n", portList[i]);
+      exit(1);
+    }
+    timeStart[i] = micros();
+    result[i]    = 1;
+    pid[i] = fork();
+    if (pid[i] < 0) {
+      fprintf(stderr, "\n\nerror in 'flash_ports()': fork failed with code %d, exit!\n\n", errno);
+      exit(1);
+    }
+
+    // worker: redirect output to log and upload
+    if (pid[i] == 0) {
+      if (freopen(fileLog[i], "w", stdout) == NULL)
+        _exit(1);
+      dup2(fileno(stdout), STDERR_FILENO);
+      flash_record(fileStats[i], "");
+      exit(flash_port(portList[i], baudrate, uartMode, flashErase, flashDiff, verifyUpload, imageIn));
+    }
+    numRunning++;
+  }
+
+  // wait for workers
+  while (numRunning > 0) {
+    pidDone = wait(&status);
+    if (pidDone < 0)
+      break;
+    for (i=0; i<numPorts; i++) {
+      if (pid[i] == pidDone) {
+        timeEnd[i] = micros();
+        result[i]  = (WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? 0 : 1;
+        numRunning--;
+      }
+    }
+  }
+
+#endif // WIN32 || WIN64
+
+  timeTotal = micros() - timeTotal;
+
+  // merge statistics of workers
+  if ((strlen(fileReport) > 0) && !stats_merge(fileReport, fileList, numPorts)) {
+    fprintf(stderr, "\n\nerror in 'flash_ports()': cannot write report '%s', exit!\n\n", fileReport);
+    exit(1);
+  }
+
+  // print output of workers
+  for (i=0; i<numPorts; i++) {
+    if ((fileLog[i][0] == '\0') || ((fp = fopen(fileLog[i], "r")) == NULL))
+      continue;
+    printf("\nport %s:\n", portList[i]);
+    while (fgets(buf, sizeof(buf), fp) != NULL)
+      fputs(buf, stdout);
+    fclose(fp);
+  }
+
+  // print summary
+  numFailed = 0;
+  printf("\nsummary:\n");
+  for (i=0; i<numPorts; i++) {
+    printf("  %-20s %s  %6.2fs\n", portList[i], result[i] ? "FAIL" : "pass", (timeEnd[i]-timeStart[i])*1e-6);
+    numFailed += result[i] ? 1 : 0;
+  }
+  printf("  %d of %d passed, total %.2fs\n\n", numPorts-numFailed, numPorts, timeTotal*1e-6);
+  fflush(stdout);
+
+  return(numFailed);
+}
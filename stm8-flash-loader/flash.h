@@ -0,0 +1,69 @@
+#ifndef _FLASH_H_
+#define _FLASH_H_
+
+#include <stdint.h>
+#include "serial_comm.h"
+#include "memimage.h"
+#include "bootloader.h"
+
+// buffer sizes
+#define  STRLEN     1000
+#define  MAX_PORTS  64
+
+// erase prior to upload (flashErase)
+#define  ERASE_NONE     0         // no erase, flash blocks are read back for padding
+#define  ERASE_SECTORS  1         // erase sectors touched by image only
+#define  ERASE_MASS     2         // mass erase P-flash and D-flash
+
+// E_W routine variant for flash programming, see STM8_Routines/E_W_ROUTINEs.h
+typedef struct {
+  uint16_t          flashKB;      // flash size class [kB]
+  char              family;       // 'S'=standard, 'L'=low density
+  uint8_t           version;      // BSL version, e.g. 0x13 for v1.3
+  const char        *name;        // variant name, e.g. "32K_ver_1.3"
+  const MemImage_t  *image;       // routine as memory image
+} Routine_t;
+
+/// exit with error message of BSL session on failed status
+void      flash_check(Bsl_t *bsl, uint8_t status);
+
+/// record statistics (report at exit) and trace of the session of this process
+void      flash_record(const char *fileReport, const char *fileTrace);
+
+/// open port and init BSL session with output to stdout
+void      flash_init(Bsl_t *bsl, const char *portname);
+
+/// reset STM8 via UART command and set BSL baudrate
+uint8_t   reset_STM8(Bsl_t *bsl, uint32_t baudrate);
+
+/// find highest baudrate the port and BSL can hold
+uint32_t  negotiate_baudrate(Bsl_t *bsl, const char *portname);
+
+/// enter BSL via open port: reset and synchronize
+void      flash_enter(Bsl_t *bsl, const char *portname, int baudrate, uint8_t uartMode);
+
+/// identify device (BSL version, flash size) and select E_W routine
+const Routine_t *flash_detect(Bsl_t *bsl);
+
+/// upload RAM routines for flash programming and CRC16 unless resident
+void      flash_routines(Bsl_t *bsl, const char *portname, uint8_t loadCrc);
+
+/// open port, enter BSL and upload RAM routines
+void      flash_open(Bsl_t *bsl, const char *portname, int baudrate, uint8_t uartMode, uint8_t loadCrc);
+
+/// upload memory image to flash after flash_open(), return 1 if BSL was re-entered by CRC16 routine
+uint8_t   flash_upload(Bsl_t *bsl, const char *portname, const MemImage_t *imageIn, uint8_t flashErase, uint8_t flashDiff, uint8_t verifyUpload);
+
+/// read memory range to Intel hex or binary file after flash_enter()
+void      flash_dump(Bsl_t *bsl, uint32_t addrStart, uint32_t numBytes, const char *filename);
+
+/// read memory via port to file, optionally start application
+int       flash_dumpPort(const char *portname, int baudrate, uint8_t uartMode, uint32_t addrStart, uint32_t numBytes, const char *filename, uint8_t jumpApp);
+
+/// upload memory image via port and start application
+int       flash_port(const char *portname, int baudrate, uint8_t uartMode, uint8_t flashErase, uint8_t flashDiff, uint8_t verifyUpload, const MemImage_t *imageIn);
+
+/// upload memory image via several ports in parallel
+int       flash_ports(char **portList, int numPorts, int baudrate, uint8_t uartMode, uint8_t flashErase, uint8_t flashDiff, uint8_t verifyUpload, const MemImage_t *imageIn, const char *fileReport);
+
+#endif // _FLASH_H_
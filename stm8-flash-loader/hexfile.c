@@ -4,371 +4,461 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <ctype.h>
+#if defined(WIN32) || defined(WIN64)
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
 
+#include "memimage.h"
 #include "hexfile.h"
 
-/**  
-   read line (until LF, CR, or EOF) from RAM buffer and advance buffer pointer.
-   memory for line has to be allocated externally
+// lookup table for hex digits: 0x10 | value, 0 for invalid characters
+static const uint8_t hexDigit[256] = {
+  ['0']=0x10, ['1']=0x11, ['2']=0x12, ['3']=0x13, ['4']=0x14, ['5']=0x15, ['6']=0x16, ['7']=0x17,
+  ['8']=0x18, ['9']=0x19, ['A']=0x1A, ['B']=0x1B, ['C']=0x1C, ['D']=0x1D, ['E']=0x1E, ['F']=0x1F,
+  ['a']=0x1A, ['b']=0x1B, ['c']=0x1C, ['d']=0x1D, ['e']=0x1E, ['f']=0x1F
+};
+
+/**
+   decode numBytes hex encoded bytes from string to buffer and add them to checksum.
+   Stops at first non-hex character (incl. line end) or end of buffer, then returns 0
 */
-char *get_line(char **buf, char *line) {  
-  char  *p = line;
-  
-  // copy line
-  while ((**buf!=10) && (**buf!=13) && (**buf!=0)) {
-    *line = **buf;
-    line++;
-    (*buf)++;
+static inline uint8_t decode_hex(const char *str, const char *end, int numBytes, uint8_t *buf, uint8_t *chk) {
+  uint8_t   hi, lo, sum = *chk;
+  int       i;
+
+  if (end - str < 2*numBytes)
+    return(0);
+  for (i=0; i<numBytes; i++) {
+    hi = hexDigit[(uint8_t) *str++];
+    if (!hi)
+      return(0);
+    lo = hexDigit[(uint8_t) *str++];
+    if (!lo)
+      return(0);
+    buf[i] = (uint8_t) (hi << 4) | (lo & 0x0F);
+    sum += buf[i];
   }
-  
-  // skip CR + LF in buffer
-  while ((**buf==10) || (**buf==13))
-    (*buf)++;
-    
-  // terminate line
-  *line = '\0';
-  
-  // check if data was copied
-  if (p == line)
-    return(NULL);
-  else
-    return(p);  
+  *chk = sum;
+  return(1);
 }
 
 /**
-   read hexfile from file to memory buffer. Don't interpret (is done
-   in separate routine)
+   skip whitespace and empty lines in buffer and count lines. Return pointer to next record
 */
-void load_hexfile(const char *filename, char *buf, uint32_t bufsize) {
-  FILE      *fp;
-  uint32_t  len;
-  
-  // open file to read
-  if (!(fp = fopen(filename, "rb")))
-    printf("Failed to open file");
-     
-  // get filesize
-  fseek(fp, 0, SEEK_END);
-  len = ftell(fp);
-  fseek(fp, 0, SEEK_SET);
-
-  // read file to buffer
-  fread(buf, len, 1, fp);
-  
-  // close file again
-  fclose(fp);
-
-  // attach 0 to buffer to detect EOF
-  buf[len++] = 0;
-} 
+static const char *skip_space(const char *p, const char *end, int *linecount) {
+  while ((p < end) && ((*p==' ') || (*p=='\t') || (*p=='\r') || (*p=='\n') || (*p=='\0'))) {
+    if (*p == '\n')
+      (*linecount)++;
+    p++;
+  }
+  return(p);
+}
 
 /**
-   convert memory buffer containing s19 hexfile to memory buffer. For description of 
-   Motorola S19 file format see http://en.wikipedia.org/wiki/SREC_(file_format)
+   keep error message "error in 'func': ..." in buffer of HEXFILE_ERRLEN characters
 */
-void convert_s19(char *buf, uint32_t *addrStart, uint32_t *numBytes, char *image) {  
-  char      line[1000], tmp[1000], *p;
-  int       linecount, idx, i;
-  uint8_t   type, len, chkRead, chkCalc;
-  uint32_t  addr, addrMin, addrMax, val;
- 
-  // 1st run: check syntax and extract min/max addresses
-  linecount = 0;
-  addrMin = 0xFFFFFFFF;
-  addrMax = 0x00000000;
-  p = buf;
-  
-  while (get_line(&p, line)) {  
-    // increase line counter
-    linecount++;
-    chkCalc = 0x00;
-    
-    // check 1st char (must be 'S')
-    if (line[0] != 'S')
-      printf("Line %d of Motorola S-record file not start with 'S'", linecount);
-    
-    // record type
-    type = line[1]-48;
-    
-    // skip if line contains no data
-    if ((type==0) || (type==8) || (type==9))
-      continue; 
-    
-    // record length (address + data + checksum)
-    sprintf(tmp,"0x00");
-    strncpy(tmp+2, line+2, 2);
-    sscanf(tmp, "%x", &val);
-    len = val;
-    chkCalc += val;              // increase checksum
-    
-    // address (S1=16bit, S2=24bit, S3=32bit)
-    addr = 0;
-    for (i=0; i<type+1; i++) {
-      sprintf(tmp,"0x00");
-      tmp[2] = line[4+(i*2)];
-      tmp[3] = line[5+(i*2)];
-      sscanf(tmp, "%x", &val);
-      addr *= 256;
-      addr += val;    
-      chkCalc += val;
-    } 
-
-    // read record data
-    idx=6+(type*2);                // start at position 8, 10, or 12, depending on record type
-    len=len-1-(1+type);            // substract chk and address length
-    for (i=0; i<len; i++) {
-      sprintf(tmp,"0x00");
-      strncpy(tmp+2, line+idx, 2);    // get next 2 chars as string
-      sscanf(tmp, "%x", &val);        // interpret as hex data
-      chkCalc += val;                 // increase checksum
-      idx+=2;                         // advance 2 chars in line
+static void hex_fail(char *error, const char *func, const char *fmt, ...) {
+  va_list   args;
+  int       len;
+
+  len = snprintf(error, HEXFILE_ERRLEN, "error in '%s': ", func);
+  va_start(args, fmt);
+  vsnprintf(error+len, HEXFILE_ERRLEN-len, fmt, args);
+  va_end(args);
+}
+
+/**
+   map hexfile read-only into memory. Don't interpret (is done in separate routine).
+   Return pointer to file content (not 0-terminated) and its length, or NULL on error
+   with message in error. Release with unload_hexfile()
+*/
+const char *load_hexfile(const char *filename, uint32_t *len, char *error) {
+  const char  *buf;
+
+#if defined(WIN32) || defined(WIN64)
+
+  HANDLE        fp, map;
+  LARGE_INTEGER size;
+
+  // open file and get filesize
+  fp = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (fp == INVALID_HANDLE_VALUE) {
+    hex_fail(error, "load_hexfile()", "failed to open file '%s'", filename);
+    return(NULL);
+  }
+  if ((!GetFileSizeEx(fp, &size)) || (size.QuadPart > 0xFFFFFFFF)) {
+    hex_fail(error, "load_hexfile()", "failed to get size of file '%s'", filename);
+    CloseHandle(fp);
+    return(NULL);
+  }
+  *len = (uint32_t) size.QuadPart;
+
+  // map file (mapping of empty file not possible)
+  buf = "";
+  if (*len > 0) {
+    map = CreateFileMapping(fp, NULL, PAGE_READONLY, 0, 0, NULL);
+    if ((map == NULL) || ((buf = (const char*) MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0)) == NULL)) {
+      hex_fail(error, "load_hexfile()", "failed to map file '%s'", filename);
+      if (map != NULL)
+        CloseHandle(map);
+      CloseHandle(fp);
+      return(NULL);
     }
+    CloseHandle(map);
+  }
+  CloseHandle(fp);
+
+#else
+
+  int           fd;
+  struct stat   st;
 
-    // checksum
-    sprintf(tmp,"0x00");
-    strncpy(tmp+2, line+idx, 2);
-    sscanf(tmp, "%x", &val);
-    chkRead = val;
-    
-    // assert checksum (0xFF xor (sum over all except record type)
-    chkCalc ^= 0xFF;                 // invert checksum
-    if (chkCalc != chkRead)
-      printf("Checksum error in line %d of Motorola S-record file (0x%02x vs. 0x%02x)", linecount, chkRead, chkCalc);
-    
-    // store min/max address
-    if (addr < addrMin)
-      addrMin = addr;
-    if (addr+len-1 > addrMax)
-      addrMax = addr+len-1;    
+  // open file and get filesize
+  if ((fd = open(filename, O_RDONLY)) < 0) {
+    hex_fail(error, "load_hexfile()", "failed to open file '%s'", filename);
+    return(NULL);
   }
-      
-  // store base address and image size
-  *addrStart = addrMin;
-  if ((addrMin != 0xFFFFFFFF) || (addrMax != 0x00000000))
-    *numBytes  = addrMax-addrMin+1;
-  else
-    *numBytes  = 0;       
-  
-  // 2nd run: store data to image
-  if (*numBytes != 0) {
-    p = buf;
-    while (get_line(&p, line)) {
-    
-      // record type
-      type = line[1]-48;
-    
-      // skip if line contains no data
-      if ((type==0) || (type==8) || (type==9))
-        continue; 
-    
-      // record length (address + data + checksum)
-      sprintf(tmp,"0x00");
-      strncpy(tmp+2, line+2, 2);
-      sscanf(tmp, "%x", &val);
-      len = val;
-    
-      // address (S1=16bit, S2=24bit, S3=32bit)
+  if ((fstat(fd, &st) != 0) || (st.st_size > 0xFFFFFFFF)) {
+    hex_fail(error, "load_hexfile()", "failed to get size of file '%s'", filename);
+    close(fd);
+    return(NULL);
+  }
+  *len = (uint32_t) st.st_size;
+
+  // map file (mapping of empty file not possible)
+  buf = "";
+  if (*len > 0) {
+    buf = (const char*) mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED) {
+      hex_fail(error, "load_hexfile()", "failed to map file '%s'", filename);
+      close(fd);
+      return(NULL);
+    }
+  }
+  close(fd);
+
+#endif // WIN32 || WIN64
+
+  return(buf);
+}
+
+/**
+   release memory of hexfile mapped by load_hexfile()
+*/
+void unload_hexfile(const char *buf, uint32_t len) {
+
+  if (len == 0)
+    return;
+
+#if defined(WIN32) || defined(WIN64)
+  UnmapViewOfFile(buf);
+#else
+  munmap((void*) buf, len);
+#endif // WIN32 || WIN64
+}
+
+/**
+   convert memory buffer containing s19 hexfile to sparse memory image. Records are
+   decoded in place in a single pass. For description of Motorola S19 file format
+   see http://en.wikipedia.org/wiki/SREC_(file_format)
+*/
+uint8_t convert_s19(const char *buf, uint32_t len, MemImage_t *image, char *error) {
+  const char  *p, *end = buf + len;
+  uint8_t     rec[256];         // length, address, data, checksum
+  int         linecount, lenAddr, numData, i;
+  uint8_t     type, chk;
+  uint32_t    addr;
+
+  linecount = 1;
+  p = skip_space(buf, end, &linecount);
+  while (p < end) {
+
+    // check 1st char (must be 'S') and record type
+    type = (end - p < 2) ? 0xFF : (uint8_t) (p[1] - '0');
+    if ((p[0] != 'S') || (type > 9) || (type == 4)) {
+      hex_fail(error, "convert_s19()", "line %d has wrong syntax", linecount);
+      return(1);
+    }
+    p += 2;
+
+    // record length (address + data + checksum), then record
+    chk = 0;
+    if (!decode_hex(p, end, 1, rec, &chk) || !decode_hex(p+2, end, rec[0], rec+1, &chk)) {
+      hex_fail(error, "convert_s19()", "line %d has wrong syntax", linecount);
+      return(1);
+    }
+    p += 2 + 2*rec[0];
+
+    // assert checksum (0xFF xor (sum over all except record type)), i.e. sum incl. checksum is 0xFF
+    if (chk != 0xFF) {
+      hex_fail(error, "convert_s19()", "line %d has wrong checksum", linecount);
+      return(1);
+    }
+
+    // address length (S0/1/5/9=16bit, S2/6/8=24bit, S3/7=32bit)
+    lenAddr = ((type==2) || (type==6) || (type==8)) ? 3 : (((type==3) || (type==7)) ? 4 : 2);
+    numData = rec[0] - 1 - lenAddr;
+    if (numData < 0) {
+      hex_fail(error, "convert_s19()", "line %d is too short", linecount);
+      return(1);
+    }
+
+    // store data records (S1/2/3) to image, skip header, count and start address
+    if ((type >= 1) && (type <= 3)) {
       addr = 0;
-      for (i=0; i<type+1; i++) {
-        sprintf(tmp,"0x00");
-        strncpy(tmp+2, line+4+(i*2), 2);
-        sscanf(tmp, "%x", &val);
-        addr *= 256;
-        addr += val;    
-      }
-    
-      // read record data
-      idx=6+(type*2);                // start at position 8, 10, or 12, depending on record type
-      len=len-1-(1+type);            // substract chk and address length
-      for (i=0; i<len; i++) {
-        sprintf(tmp,"0x00");
-        strncpy(tmp+2, line+idx, 2);    // get next 2 chars as string
-        sscanf(tmp, "%x", &val);        // interpret as hex data
-        image[addr-addrMin+i] = val;     // store data byte in buffer
-        idx+=2;                         // advance 2 chars in line
+      for (i=0; i<lenAddr; i++)
+        addr = (addr << 8) | rec[1+i];
+      if (!image_setData(image, addr, numData, (char*) rec+1+lenAddr)) {
+        hex_fail(error, "convert_s19()", "cannot allocate memory in line %d", linecount);
+        return(1);
       }
     }
+
+    p = skip_space(p, end, &linecount);
   }
+
+  return(0);
 }
 
-/**  
-   convert memory buffer containing intel hexfile to memory buffer. For description of 
-   Intel hex file format see http://en.wikipedia.org/wiki/Intel_HEX
+/**
+   convert memory buffer containing intel hexfile to sparse memory image. Records are
+   decoded in place in a single pass. For description of Intel hex file format see
+   http://en.wikipedia.org/wiki/Intel_HEX
 */
-void convert_hex(char *buf, uint32_t *addrStart, uint32_t *numBytes, char *image) {
-  
-  char      line[1000], tmp[1000], *p;
-  int       linecount, idx, i;
-  uint8_t   type, len, chkRead, chkCalc;
-  uint32_t  addr, addrMin, addrMax, addrOff, addrJumpStart, val;
-
-  // avoid compiler warning (variable not yet used). See https://stackoverflow.com/questions/3599160/unused-parameter-warnings-in-c
-  (void) (addrJumpStart);
-  
-  // 1st run: check syntax and extract min/max addresses
-  linecount = 0;
-  addrMin = 0xFFFFFFFF;
-  addrMax = 0x00000000;
+uint8_t convert_hex(const char *buf, uint32_t len, MemImage_t *image, char *error) {
+  const char  *p, *end = buf + len;
+  uint8_t     rec[4+256];       // length, 16b address, type, data, checksum
+  int         linecount, numData;
+  uint8_t     type, chk;
+  uint32_t    addr, addrOff;
+
+  linecount = 1;
   addrOff = 0x00000000;
-  p = buf;
-  
-  while (get_line(&p, line)) {  
-    // increase line counter
-    linecount++;
-    chkCalc = 0x00;
-    
+  p = skip_space(buf, end, &linecount);
+  while (p < end) {
+
     // check 1st char (must be ':')
-    if (line[0] != ':')
-      printf("Line %d of Intel hex file not start with ':'", linecount);
-    
-    // record length (address + data + checksum)
-    sprintf(tmp,"0x00");
-    strncpy(tmp+2, line+1, 2);
-    sscanf(tmp, "%x", &val);
-    len = val;
-    chkCalc += len;              // increase checksum
-    
-    // 16b address
-    addr = 0;
-    sprintf(tmp,"0x0000");
-    strncpy(tmp+2, line+3, 4);
-    sscanf(tmp, "%x", &val);
-    chkCalc += (uint8_t) (val >> 8);
-    chkCalc += (uint8_t)  val;
-    addr = val + addrOff;         // add offset for >64kB addresses
-
-    // record type
-    sprintf(tmp,"0x00");
-    strncpy(tmp+2, line+7, 2);
-    sscanf(tmp, "%x", &val);
-    type = val;
-    chkCalc += type;              // increase checksum
-    
-    // record contains data
-    if (type==0) {
-      idx = 9;                          // start at index 9
-      for (i=0; i<len; i++) {
-        sprintf(tmp,"0x00");
-        strncpy(tmp+2, line+idx, 2);    // get next 2 chars as string
-        sscanf(tmp, "%x", &val);        // interpret as hex data
-        chkCalc += val;                 // increase checksum
-        idx+=2;                         // advance 2 chars in line
+    if (*p++ != ':') {
+      hex_fail(error, "convert_hex()", "line %d does not start with ':'", linecount);
+      return(1);
+    }
+
+    // record length, 16b address and type, then data and checksum
+    chk = 0;
+    if (!decode_hex(p, end, 4, rec, &chk) || !decode_hex(p+8, end, rec[0]+1, rec+4, &chk)) {
+      hex_fail(error, "convert_hex()", "line %d has wrong syntax", linecount);
+      return(1);
+    }
+    numData = rec[0];
+    addr    = ((uint32_t) rec[1] << 8) | rec[2];
+    type    = rec[3];
+    p += 2*(5+numData);
+
+    // assert checksum (2-complement of sum over all), i.e. sum incl. checksum is 0
+    if (chk != 0) {
+      hex_fail(error, "convert_hex()", "line %d has wrong checksum", linecount);
+      return(1);
+    }
+
+    // data record
+    if (type == 0) {
+      if (!image_setData(image, addr+addrOff, numData, (char*) rec+4)) {
+        hex_fail(error, "convert_hex()", "cannot allocate memory in line %d", linecount);
+        return(1);
       }
-    
-      // store min/max address
-      if (addr < addrMin)
-        addrMin = addr;
-      if (addr+len-1 > addrMax)
-        addrMax = addr+len-1;
-
-    } // type==0
-
-    // EOF indicator
-    else if (type==1)
-      continue; 
-    
-    // start segment address (only relevant for 80x86 processors, ignore here) 
-    else if (type==3)
-      continue;
-    
-    // extended address (=upper 16b of address for following data records)
-    else if (type==4) {
-      sprintf(tmp,"0x0000");
-      strncpy(tmp+2, line+9, 4);      // get next 4 chars as string
-      sscanf(tmp, "%x", &val);        // interpret as hex data
-      chkCalc += (uint8_t) (val >> 8);
-      chkCalc += (uint8_t)  val;
-      addrOff = val << 16;
-    } // type==4
-    
-    // start linear address records. Can be ignored, see http://www.keil.com/support/docs/1584/
-    else if (type==5) {
-      sprintf(tmp,"0x00000000");
-      strncpy(tmp+2, line+9, 8);      // get next 8 chars as string
-      sscanf(tmp, "%x", &val);        // interpret as hex data
-      chkCalc += (uint8_t) (val >> 24);
-      chkCalc += (uint8_t) (val >> 16);
-      chkCalc += (uint8_t) (val >> 8);
-      chkCalc += (uint8_t)  val;
-      addrJumpStart = val;            // not used yet
-    } // type==5
-    
+    }
+
+    // EOF indicator, ignore rest of file
+    else if (type == 1)
+      return(0);
+
+    // extended segment address (=address bits 4..19 for following data records)
+    else if ((type == 2) && (numData == 2))
+      addrOff = (((uint32_t) rec[4] << 8) | rec[5]) << 4;
+
+    // extended linear address (=upper 16b of address for following data records)
+    else if ((type == 4) && (numData == 2))
+      addrOff = (((uint32_t) rec[4] << 8) | rec[5]) << 16;
+
+    // start segment (only relevant for 80x86 processors) or start linear address. Can be ignored, see http://www.keil.com/support/docs/1584/
+    else if ((type == 3) || (type == 5))
+      ;
+
     // unsupported record type -> error
-    else
-      printf("Line %d of Intel hex file has unsupported type %d", linecount, type);
-    
-    // checksum
-    sprintf(tmp,"0x00");
-    strncpy(tmp+2, line+9+2*len, 2);
-    sscanf(tmp, "%x", &val);
-    chkRead = val;
-    
-    // assert checksum (0xFF xor (sum over all except record type))
-    chkCalc = 255 - chkCalc + 1;                 // calculate 2-complement
-    if (chkCalc != chkRead)
-      printf("Line %d of Intel hex file has wrong checksum (0x%02x vs. 0x%02x)", linecount, chkRead, chkCalc);    
+    else {
+      hex_fail(error, "convert_hex()", "line %d has unsupported type %d", linecount, type);
+      return(1);
+    }
+
+    p = skip_space(p, end, &linecount);
   }
-    
-  // store base address and image size
-  *addrStart = addrMin;
-  if ((addrMin != 0xFFFFFFFF) || (addrMax != 0x00000000))
-    *numBytes  = addrMax-addrMin+1;
+
+  return(0);
+}
+
+/**
+   load Intel hex or Motorola S19 file (by extension .s19) to sparse memory image.
+   Return 0 on success, else 1 with message in error
+*/
+uint8_t load_image(const char *filename, MemImage_t *image, char *error) {
+  const char  *buf;
+  uint32_t    len;
+  int         lenName;
+  uint8_t     result;
+
+  if ((buf = load_hexfile(filename, &len, error)) == NULL)
+    return(1);
+  lenName = strlen(filename);
+  if ((lenName > 4) && (!strcmp(filename+lenName-4, ".s19")))
+    result = convert_s19(buf, len, image, error);
   else
-    *numBytes  = 0;       
-  
-  // 2nd run: store data to image
-  addrOff = 0x00000000;
-  if (*numBytes != 0) {
-    p = buf;
-    
-    while (get_line(&p, line)) {    
-      // record length (address + data + checksum)
-      sprintf(tmp,"0x00");
-      strncpy(tmp+2, line+1, 2);
-      sscanf(tmp, "%x", &val);
-      len = val;
-      
-      // 16b address
-      addr = 0;
-      sprintf(tmp,"0x0000");
-      strncpy(tmp+2, line+3, 4);
-      sscanf(tmp, "%x", &val);
-      addr = val;         // add offset for >64kB addresses
-
-      // record type
-      sprintf(tmp,"0x00");
-      strncpy(tmp+2, line+7, 2);
-      sscanf(tmp, "%x", &val);
-      type = val;
-      
-      // record contains data
-      if (type==0) {
-        idx = 9;                          // start at index 9
-        for (i=0; i<len; i++) {
-          sprintf(tmp,"0x00");
-          strncpy(tmp+2, line+idx, 2);          // get next 2 chars as string
-          sscanf(tmp, "%x", &val);              // interpret as hex data
-          image[addr+addrOff-addrMin+i] = val;  // store data byte in buffer
-          idx+=2;                               // advance 2 chars in line
-        }
-      } // type==0
-      
-	  // EOF indicator
-      else if (type==1)
-        continue;    
-      // start segment address (only relevant for 80x86 processors, ignore here) 
-      else if (type==3)
-        continue;
-      // extended address (=upper 16b of address for following data records)
-      else if (type==4) {
-        sprintf(tmp,"0x0000");
-        strncpy(tmp+2, line+9, 4);        // get next 4 chars as string
-        sscanf(tmp, "%x", &val);        // interpret as hex data
-        addrOff = val << 16;
-      } // type==4
-      else
-        printf("Line %d of Intel hex file has unsupported type %d", linecount, type);
+    result = convert_hex(buf, len, image, error);
+  unload_hexfile(buf, len);
+  return(result);
+}
+
+/**
+   create file of len bytes (>0) and map it writable into memory, e.g. to stream a memory
+   dump into it. Release with unmap_outfile(). Return NULL on error with message in error
+*/
+char *map_outfile(const char *filename, uint32_t len, char *error) {
+  char  *buf;
+
+#if defined(WIN32) || defined(WIN64)
+
+  HANDLE        fp, map;
+
+  // create file and map it with its final size
+  fp = CreateFile(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (fp == INVALID_HANDLE_VALUE) {
+    hex_fail(error, "map_outfile()", "failed to create file '%s'", filename);
+    return(NULL);
+  }
+  map = CreateFileMapping(fp, NULL, PAGE_READWRITE, 0, len, NULL);
+  if ((map == NULL) || ((buf = (char*) MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, len)) == NULL)) {
+    hex_fail(error, "map_outfile()", "failed to map file '%s'", filename);
+    if (map != NULL)
+      CloseHandle(map);
+    CloseHandle(fp);
+    return(NULL);
+  }
+  CloseHandle(map);
+  CloseHandle(fp);
+
+#else
+
+  int           fd;
+
+  // create file with final size and map it
+  if ((fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+    hex_fail(error, "map_outfile()", "failed to create file '%s'", filename);
+    return(NULL);
+  }
+  if (ftruncate(fd, len) != 0) {
+    hex_fail(error, "map_outfile()", "failed to create file '%s'", filename);
+    close(fd);
+    return(NULL);
+  }
+  buf = (char*) mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (buf == MAP_FAILED) {
+    hex_fail(error, "map_outfile()", "failed to map file '%s'", filename);
+    close(fd);
+    return(NULL);
+  }
+  close(fd);
+
+#endif // WIN32 || WIN64
+
+  return(buf);
+}
+
+/**
+   release file mapped by map_outfile(). Content is written back by the OS
+*/
+void unmap_outfile(char *buf, uint32_t len) {
+
+#if defined(WIN32) || defined(WIN64)
+  UnmapViewOfFile(buf);
+#else
+  munmap(buf, len);
+#endif // WIN32 || WIN64
+}
+
+/**
+   write Intel hex record to buf (NULL: only count). Return number of characters
+*/
+static uint32_t encode_record(char *buf, uint8_t type, uint16_t addr, const uint8_t *data, uint8_t numBytes) {
+  static const char digit[] = "0123456789ABCDEF";
+  uint8_t   hdr[4], chk;
+  char      *p;
+  int       i;
+
+  if (buf == NULL)
+    return(12 + 2*numBytes);
+
+  hdr[0] = numBytes;
+  hdr[1] = (uint8_t) (addr >> 8);
+  hdr[2] = (uint8_t) addr;
+  hdr[3] = type;
+  chk = 0;
+  p = buf;
+  *p++ = ':';
+  for (i=0; i<4; i++) {
+    *p++ = digit[hdr[i] >> 4];
+    *p++ = digit[hdr[i] & 0x0F];
+    chk += hdr[i];
+  }
+  for (i=0; i<numBytes; i++) {
+    *p++ = digit[data[i] >> 4];
+    *p++ = digit[data[i] & 0x0F];
+    chk += data[i];
+  }
+  chk = -chk;
+  *p++ = digit[chk >> 4];
+  *p++ = digit[chk & 0x0F];
+  *p++ = '\n';
+
+  return((uint32_t) (p - buf));
+}
+
+/**
+   encode data at addr as Intel hex data records of up to 16 bytes, aligned to 16B addresses
+   (i.e. no record crosses a 64kB boundary). Extended linear address records are inserted
+   where the upper 16 address bits change from *addrUpper (start with 0), which is updated.
+   Consecutive calls continue the file. Write to buf (NULL: only count characters, e.g. for
+   the file size). Return number of characters
+*/
+uint32_t encode_hex(char *buf, uint32_t addr, const char *data, uint32_t numBytes, uint32_t *addrUpper) {
+  uint32_t  num = 0, len;
+  uint8_t   upper[2];
+
+  while (numBytes > 0) {
+    if ((addr >> 16) != *addrUpper) {
+      *addrUpper = addr >> 16;
+      upper[0] = (uint8_t) (*addrUpper >> 8);
+      upper[1] = (uint8_t) *addrUpper;
+      num += encode_record(buf ? buf+num : NULL, 4, 0, upper, 2);
     }
+    len = 16 - (addr % 16);
+    if (len > numBytes)
+      len = numBytes;
+    num += encode_record(buf ? buf+num : NULL, 0, (uint16_t) addr, (const uint8_t*) data, (uint8_t) len);
+    addr     += len;
+    data     += len;
+    numBytes -= len;
   }
+
+  return(num);
 }
 
+/**
+   write Intel hex end of file record to buf (NULL: only count). Return number of characters
+*/
+uint32_t encode_hexEnd(char *buf) {
+  return(encode_record(buf, 1, 0, NULL, 0));
+}
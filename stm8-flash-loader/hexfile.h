@@ -1,17 +1,38 @@
 #ifndef _HEXFILE_H_
 #define _HEXFILE_H_
 
-// read next line from RAM buffer
-char *get_line(char **buf, char *line);
+#include <stdint.h>
+#include "memimage.h"
 
-// read hexfile into memory buffer
-void load_hexfile(const char *filename, char *buf, uint32_t bufsize);
+// size of error message buffer passed to below functions
+#define HEXFILE_ERRLEN  200
 
-// convert s19 format in memory buffer to memory image
-void convert_s19(char *buf, uint32_t *addrStart, uint32_t *numBytes, char *image);
+// map hexfile read-only into memory, NULL on error
+const char *load_hexfile(const char *filename, uint32_t *len, char *error);
 
-// convert intel hex format in memory buffer to memory image
-void convert_hex(char *buf, uint32_t *addrStart, uint32_t *numBytes, char *image);
+// release memory of hexfile
+void unload_hexfile(const char *buf, uint32_t len);
+
+// convert s19 format in memory buffer to sparse memory image, 1 on error
+uint8_t convert_s19(const char *buf, uint32_t len, MemImage_t *image, char *error);
+
+// convert intel hex format in memory buffer to sparse memory image, 1 on error
+uint8_t convert_hex(const char *buf, uint32_t len, MemImage_t *image, char *error);
+
+// load Intel hex or Motorola S19 file to sparse memory image, 1 on error
+uint8_t load_image(const char *filename, MemImage_t *image, char *error);
+
+// create file of given size and map it writable into memory, NULL on error
+char *map_outfile(const char *filename, uint32_t len, char *error);
+
+// release file mapped by map_outfile()
+void unmap_outfile(char *buf, uint32_t len);
+
+// encode data as Intel hex records (buf=NULL: only count characters)
+uint32_t encode_hex(char *buf, uint32_t addr, const char *data, uint32_t numBytes, uint32_t *addrUpper);
+
+// encode Intel hex end of file record
+uint32_t encode_hexEnd(char *buf);
 
 #endif // _HEXFILE_H_
 
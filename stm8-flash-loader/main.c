@@ -10,142 +10,262 @@
 #include <time.h>
 #include <sys/time.h>
 
-#include <windows.h>
-#include <malloc.h>
-
+#include "misc.h"
 #include "serial_comm.h"
 #include "bootloader.h"
 #include "hexfile.h"
-
-#include "E_W_ROUTINEs_32K_ver_1.3.h"
-
-// buffer sizes
-#define  STRLEN   1000
-#define  BUFSIZE  10000000
+#include "flash.h"
+#include "daemon.h"
 
 
 // configuration
-#define COM_PORT 	"COM6"
+#if defined(WIN32) || defined(WIN64)
+  #define COM_PORT 	"COM6"
+#else
+  #define COM_PORT 	"/dev/ttyUSB0"
+#endif
 #define HEX_FILE 	"test_hex/main.ihx"
-#define ERASE_ALL	1
-#define VERIFY 		0
+#define FLASH_ERASE	ERASE_SECTORS	// ERASE_NONE, ERASE_SECTORS or ERASE_MASS
+#define VERIFY 		0		// 0=off, 1=CRC16 on STM8, 2=read back and compare
+#define UART_MODE	255		// 0=duplex, 1=reply, 255=auto-detect after sync
+#define BAUDRATE	0		// 0=negotiate highest baudrate, see BAUD_TRY
 
 
+/**
+  print help and exit
+*/
+void printHelp(const char *appname) {
+  printf("\n");
+  printf("usage: %s [-h] [-p port] [-b rate] [-u mode] [-f file] [-n] [-m] [-d] [-v] [-V] [-j file] [-t file]\n", appname);
+  printf("       %s [-p port] [-b rate] [-u mode] -r addr num file [-g] [-j file] [-t file]\n", appname);
+  printf("       %s -D socket [-p port] [-b rate] [-u mode]\n", appname);
+  printf("       %s -C socket [-f file] [-n] [-m] [-d] [-v] [-V] [-c file] [-r addr num file] [-g]\n\n", appname);
+  printf("  -h        print this help\n");
+  printf("  -p port   name of communication port (default: %s). For several ports separated\n", COM_PORT);
+  printf("            by ',' all boards are flashed in parallel, followed by a summary\n");
+  printf("  -b rate   communication baudrate in Baud, 0=negotiate highest (default: %d)\n", BAUDRATE);
+  printf("  -u mode   UART mode: 0=duplex, 1=reply, 255=auto-detect (default: %d)\n", UART_MODE);
+  printf("  -f file   upload Intel hex or Motorola S19 file to flash (default: %s).\n", HEX_FILE);
+  printf("            Failed frames are retried, an interrupted upload of the same file via\n");
+  printf("            this port resumes after the last acknowledged block\n");
+  printf("  -n        don't erase flash prior to upload\n");
+  printf("  -m        mass erase P-flash and D-flash prior to upload (default: erase only\n");
+  printf("            the 1kB sectors touched by the file, e.g. keep data in EEPROM)\n");
+  printf("  -d        differential upload: only rewrite changed %dB blocks, no erase.\n", FLASH_BLOCKSIZE);
+  printf("            Flash content is taken from the cache of the last upload via this port\n");
+  printf("            (checked via CRC16 on the device), else it is read back from the device\n");
+  printf("  -v        verify memory after upload via CRC16 calculated on STM8 (fast)\n");
+  printf("  -V        verify memory after upload by reading back and comparing\n");
+  printf("  -j file   write JSON report with latency of each BSL transaction phase (histogram),\n");
+  printf("            payload throughput and retries of all ports, also for failed uploads\n");
+  printf("  -t file   record all bytes via port with timestamps to binary trace (single port),\n");
+  printf("            replay with tools/bsl_replay\n");
+  printf("  -r addr num file  read num bytes from address (hex) to Intel hex (.hex, .ihx) or\n");
+  printf("            binary file instead of upload, streamed at wire speed. Start application\n");
+  printf("            afterwards only with -g\n");
+  printf("  -D socket run as daemon: keep port open and STM8 in BSL with routines loaded,\n");
+  printf("            execute jobs received via Unix socket (POSIX only)\n");
+  printf("  -C socket send jobs to daemon instead of using a port, in order: upload file (-f),\n");
+  printf("            verify against file (-c), read memory to file (-r),\n");
+  printf("            start application (-g). BSL stays active unless -g is given\n");
+  printf("\n");
+  exit(0);
+}
+
 int main(int argc, char ** argv) {
-  char      portname[STRLEN];     // name of communication port
-  HANDLE    ptrPort;              // handle to communication port
+  char      *appname;             // name of application without path
+  char      portname[STRLEN];     // name(s) of communication port(s), separated by ','
   int       baudrate;             // communication baudrate [Baud]
-  uint8_t   flashErase;           // erase P-flash and D-flash prior to upload
-  uint8_t   verifyUpload;         // verify memory after upload
-  char      *ptr=NULL;            // pointer to memory
-  int       i, j;                 // generic variables
-  char      buf[1000];            // misc buffer
+  uint8_t   flashErase;           // erase flash prior to upload (ERASE_*)
+  uint8_t   flashDiff;            // only rewrite changed flash blocks
+  uint8_t   verifyUpload;         // verify memory after upload (0=off, 1=CRC, 2=compare)
+  uint8_t   uartMode;             // UART mode (duplex, reply) or auto-detect
+  int       i;                    // generic variable
+
+  // for multiple ports
+  char      *portList[MAX_PORTS]; // names of communication ports
+  int       numPorts;             // number of communication ports
+  int       numFailed;            // number of failed uploads
 
   // for upload to flash
   char      fileIn[STRLEN];       // name of file to upload to STM8
-  char      *fileBufIn;           // buffer for hexfiles
-  char      *imageIn;             // memory buffer for upload hexfile
-  uint32_t  imageInStart;         // starting address of imageIn
-  uint32_t  imageInBytes;         // number of bytes in imageIn
-
-  // for download from flash
-  char      fileOut[STRLEN];      // name of file to download from STM8
-  char      *imageOut;            // memory buffer for download hexfile
-  uint32_t  imageOutStart;        // starting address of imageOut
-  uint32_t  imageOutBytes;        // number of bytes in imageOut
-
-  // allocate buffers (can't be static for large buffers)
-  imageIn   = (char*) malloc(BUFSIZE);
-  imageOut  = (char*) malloc(BUFSIZE);
-  fileBufIn = (char*) malloc(BUFSIZE);
+  MemImage_t imageIn;             // sparse memory image of upload hexfile
+
+  // for daemon
+  char      socketDaemon[STRLEN]; // socket to run daemon on
+  char      socketClient[STRLEN]; // socket of daemon to send jobs to
+  uint8_t   jobFlash;             // upload file (-f given)
+  char      fileCheck[STRLEN];    // client: file to verify against
+  char      fileRead[STRLEN];     // file to read memory to
+  uint32_t  addrRead, numRead;    // memory range to read
+  uint8_t   jobGo;                // start application (client and read)
+  char      job[3*STRLEN];        // client: job for daemon
+
+  // for statistics
+  char      fileReport[STRLEN];   // JSON report of protocol statistics
+  char      fileTrace[STRLEN];    // protocol trace
+  char      error[HEXFILE_ERRLEN];  // message of failed hexfile import
+
+  // image grows with file content
+  image_init(&imageIn);
 
   // initialize default arguments
-  baudrate   = 230400;            // default baudrate
-  flashErase = ERASE_ALL;                 // erase P-flash and D-flash prior to upload
+  baudrate   = BAUDRATE;          // default baudrate or negotiate
+  flashErase = FLASH_ERASE;       // erase flash prior to upload
+  flashDiff  = 0;                 // upload complete image
   verifyUpload = VERIFY;               // verify memory content after upload
-  memmove(portname, COM_PORT, sizeof(portname));
-  memmove(fileIn, HEX_FILE, sizeof(fileIn));
+  uartMode   = UART_MODE;         // UART mode or auto-detect
+  strncpy(portname, COM_PORT, STRLEN-1);
+  strncpy(fileIn, HEX_FILE, STRLEN-1);
+  socketDaemon[0] = socketClient[0] = fileCheck[0] = fileRead[0] = fileReport[0] = fileTrace[0] = '\0';
+  jobFlash = jobGo = 0;
+  addrRead = numRead = 0;
 
-  if (strlen(fileIn) > 0) {
-    // convert to memory image, support .hex and .ihx
-    fflush(stdout);
-    load_hexfile(fileIn, fileBufIn, BUFSIZE);
-    convert_hex(fileBufIn, &imageInStart, &imageInBytes, imageIn);
+  // get application name without path
+  appname = argv[0];
+  for (i=strlen(argv[0])-1; i>=0; i--) {
+    if ((argv[0][i] == '/') || (argv[0][i] == '\\')) {
+      appname = argv[0]+i+1;
+      break;
+    }
   }
 
-  //reset STM8
-  ptrPort = init_port(portname, 9600, 1000, 8, 0, 1, 0, 0);   // use no parity
-  printf("  reset via UART command ... ");
-  fflush(stdout);
-  sprintf(buf, "##reset##");           // reset command (same as in STM8 SW!)
-  for (i=0; i<9; i++) {
-    send_port(ptrPort, 1, buf+i);   // send reset command bytewise to account for possible slow handling on STM8 side
-    Sleep(10);
+  // parse commandline arguments
+  for (i=1; i<argc; i++) {
+    if (!strcmp(argv[i], "-h"))
+      printHelp(appname);
+    else if ((!strcmp(argv[i], "-p")) && (i+1<argc))
+      strncpy(portname, argv[++i], STRLEN-1);
+    else if ((!strcmp(argv[i], "-b")) && (i+1<argc))
+      baudrate = atoi(argv[++i]);
+    else if ((!strcmp(argv[i], "-u")) && (i+1<argc))
+      uartMode = atoi(argv[++i]);
+    else if ((!strcmp(argv[i], "-f")) && (i+1<argc)) {
+      strncpy(fileIn, argv[++i], STRLEN-1);
+      jobFlash = 1;
+    }
+    else if (!strcmp(argv[i], "-n"))
+      flashErase = ERASE_NONE;
+    else if (!strcmp(argv[i], "-m"))
+      flashErase = ERASE_MASS;
+    else if (!strcmp(argv[i], "-d"))
+      flashDiff = 1;
+    else if (!strcmp(argv[i], "-v"))
+      verifyUpload = 1;
+    else if (!strcmp(argv[i], "-V"))
+      verifyUpload = 2;
+    else if ((!strcmp(argv[i], "-D")) && (i+1<argc))
+      strncpy(socketDaemon, argv[++i], STRLEN-1);
+    else if ((!strcmp(argv[i], "-C")) && (i+1<argc))
+      strncpy(socketClient, argv[++i], STRLEN-1);
+    else if ((!strcmp(argv[i], "-c")) && (i+1<argc))
+      strncpy(fileCheck, argv[++i], STRLEN-1);
+    else if ((!strcmp(argv[i], "-r")) && (i+3<argc)) {
+      addrRead = strtoul(argv[++i], NULL, 16);
+      numRead  = strtoul(argv[++i], NULL, 0);
+      strncpy(fileRead, argv[++i], STRLEN-1);
+    }
+    else if (!strcmp(argv[i], "-g"))
+      jobGo = 1;
+    else if ((!strcmp(argv[i], "-j")) && (i+1<argc))
+      strncpy(fileReport, argv[++i], STRLEN-1);
+    else if ((!strcmp(argv[i], "-t")) && (i+1<argc))
+      strncpy(fileTrace, argv[++i], STRLEN-1);
+    else {
+      fprintf(stderr, "\n\nerror: unknown or incomplete option '%s', see '%s -h'\n\n", argv[i], appname);
+      exit(1);
+    }
   }
-  fflush(stdout);
-  set_baudrate(ptrPort, baudrate);  // restore specified baudrate
-  Sleep(20);                        // allow BSL to initialize
-
-  flush_port(ptrPort);
 
-  // communicate with STM8 bootloader
+  // differential upload keeps unchanged blocks -> no erase
+  if (flashDiff)
+    flashErase = ERASE_NONE;
 
-  usleep(200000); // required to make flush work, for some reason
-  flush_port(ptrPort);
-
-  // synchronize baudrate
-  bsl_sync(ptrPort);
+  // send jobs to daemon. Paths relative to daemon are absolute
+  if (strlen(socketClient) > 0) {
+    numFailed = 0;
+    if (jobFlash && (numFailed == 0)) {
+      sprintf(job, "flash %d %d %d ", flashErase, flashDiff, verifyUpload);
+      get_abs_path(fileIn, job+strlen(job), STRLEN);
+      numFailed = daemon_job(socketClient, job);
+    }
+    if ((strlen(fileCheck) > 0) && (numFailed == 0)) {
+      sprintf(job, "verify %d ", (verifyUpload == 2) ? 2 : 1);
+      get_abs_path(fileCheck, job+strlen(job), STRLEN);
+      numFailed = daemon_job(socketClient, job);
+    }
+    if ((strlen(fileRead) > 0) && (numFailed == 0)) {
+      sprintf(job, "read %x %u ", addrRead, numRead);
+      get_abs_path(fileRead, job+strlen(job), STRLEN);
+      numFailed = daemon_job(socketClient, job);
+    }
+    if (jobGo && (numFailed == 0)) {
+      sprintf(job, "go %x", PFLASH_START);
+      numFailed = daemon_job(socketClient, job);
+    }
+    exit(numFailed);
+  }
 
-  // upload RAM routines
-  ptr = (char*) STM8_Routines_E_W_ROUTINEs_32K_ver_1_3_s19;
-  ptr[STM8_Routines_E_W_ROUTINEs_32K_ver_1_3_s19_len]=0;
+  // split port list
+  numPorts = 0;
+  for (portList[0]=strtok(portname, ","); portList[numPorts]!=NULL; portList[numPorts]=strtok(NULL, ",")) {
+    if (++numPorts == MAX_PORTS) {
+      fprintf(stderr, "\n\nerror: too many ports (max. %d), exit!\n\n", MAX_PORTS);
+      exit(1);
+    }
+  }
+  if (numPorts == 0) {
+    fprintf(stderr, "\n\nerror: no port specified, see '%s -h'\n\n", appname);
+    exit(1);
+  }
 
-  char      ramImage[8192];
-  uint32_t  ramImageStart;
-  uint32_t  numRamBytes;
+  // trace of several ports would interleave
+  if ((strlen(fileTrace) > 0) && ((numPorts != 1) || (strlen(socketDaemon) > 0))) {
+    fprintf(stderr, "\n\nerror: trace requires a single port without daemon, exit!\n\n");
+    exit(1);
+  }
 
-  convert_s19(ptr, &ramImageStart, &numRamBytes, ramImage);
-  fflush(stdout);
-  
-  bsl_memWrite(ptrPort, ramImageStart, numRamBytes, ramImage, -1);
-  fflush(stdout);
+  // run as daemon on single port
+  if (strlen(socketDaemon) > 0) {
+    if (numPorts != 1) {
+      fprintf(stderr, "\n\nerror: daemon requires a single port, exit!\n\n");
+      exit(1);
+    }
+    daemon_run(socketDaemon, portList[0], baudrate, uartMode);
+  }
 
-  // if flash mass erase
-  if (flashErase)
-    bsl_flashMassErase(ptrPort);
+  // read memory via single port instead of upload
+  if (strlen(fileRead) > 0) {
+    if ((numPorts != 1) || jobFlash) {
+      fprintf(stderr, "\n\nerror: read (-r) requires a single port and no upload (-f), exit!\n\n");
+      exit(1);
+    }
+    flash_record(fileReport, fileTrace);
+    exit(flash_dumpPort(portList[0], baudrate, uartMode, addrRead, numRead, fileRead, jobGo));
+  }
 
-  // upload file to flash
+  // convert to memory image once, support .s19 and .hex/.ihx. Shared by all ports
   if (strlen(fileIn) > 0) {
-    // upload memory image to STM8
-    bsl_memWrite(ptrPort, imageInStart, imageInBytes, imageIn, 0);
-
-    // verify upload
-    if (verifyUpload) {
-      bsl_memRead(ptrPort, imageInStart, imageInBytes, imageOut);
-      printf("  verify memory ... ");
-      for (i=0; i<imageInBytes; i++) {
-        if (imageIn[i] != imageOut[i]) {
-          printf("\nfailed at address 0x%04x (0x%02x vs 0x%02x), exit!\n", (uint32_t) (imageInStart+i), (uint8_t) (imageIn[i]), (uint8_t) (imageOut[i]));
-          exit(1);
-        }
-      }
-      printf("ok\n");
+    fflush(stdout);
+    if (load_image(fileIn, &imageIn, error)) {
+      fprintf(stderr, "\n\n%s, exit!\n\n", error);
+      exit(1);
     }
+  }
 
-    // enable ROM bootloader after upload (option bytes always on same address)
-    fflush(stdout);
-    bsl_memWrite(ptrPort, 0x487E, 2, (char*)"\x55\xAA", -1);
-    fflush(stdout);
+  // upload via single port. Report is written also if upload fails (exits)
+  if (numPorts == 1) {
+    flash_record(fileReport, fileTrace);
+    flash_port(portList[0], baudrate, uartMode, flashErase, flashDiff, verifyUpload, (strlen(fileIn) > 0) ? &imageIn : NULL);
+    numFailed = 0;
   }
 
-  // jump to application
-  fflush(stdout);
-  bsl_jumpTo(ptrPort, PFLASH_START);
-  fflush(stdout);
+  // upload via multiple ports in parallel
+  else
+    numFailed = flash_ports(portList, numPorts, baudrate, uartMode, flashErase, flashDiff, verifyUpload, (strlen(fileIn) > 0) ? &imageIn : NULL, fileReport);
 
-  close_port(&ptrPort);
-  exit(0);
+  image_free(&imageIn);
+  exit(numFailed ? 1 : 0);
 
   return(0);
 }
-
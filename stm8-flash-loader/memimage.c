@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "memimage.h"
+
+/**
+  initialize empty memory image
+*/
+void image_init(MemImage_t *image) {
+
+  image->numSegments = 0;
+  image->capacity    = 0;
+  image->segment     = NULL;
+}
+
+/**
+  release all memory of image. Image is empty afterwards
+*/
+void image_free(MemImage_t *image) {
+  int   i;
+
+  for (i=0; i<image->numSegments; i++)
+    free(image->segment[i].data);
+  free(image->segment);
+  image_init(image);
+}
+
+/**
+  reserve buffer of segment for at least numBytes. Grows geometrically to keep
+  appending records cheap. Return 0 on failure, segment is unchanged then
+*/
+static uint8_t segment_reserve(MemSegment_t *seg, uint32_t numBytes) {
+  uint32_t  capacity;
+  char      *data;
+
+  if (numBytes <= seg->capacity)
+    return(1);
+  capacity = (seg->capacity < 256) ? 256 : seg->capacity;
+  while (capacity < numBytes)
+    capacity *= 2;
+  if ((data = (char*) realloc(seg->data, capacity)) == NULL)
+    return(0);
+  seg->data     = data;
+  seg->capacity = capacity;
+
+  return(1);
+}
+
+/**
+  store data in image, overwrite existing data. A new segment is created if data
+  doesn't touch an existing segment, otherwise segments are merged. Appending to
+  the end of a segment (typical for hexfiles) is O(log n). Return 0 on failure (out of
+  memory), image is unchanged then
+*/
+uint8_t image_setData(MemImage_t *image, uint32_t addr, uint32_t numBytes, const char *data) {
+  MemSegment_t  *seg, segNew;
+  uint32_t      addrEnd, segStart, segEnd;
+  int           lo, hi, mid, i, j, capacity;
+
+  if (numBytes == 0)
+    return(1);
+  addrEnd = addr + numBytes;
+
+  // binary search first segment which ends at or after addr (i.e. overlaps or touches)
+  lo = 0;
+  hi = image->numSegments;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (image->segment[mid].addrStart + image->segment[mid].numBytes < addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  i = lo;
+
+  // no overlap -> insert new segment at position i
+  if ((i == image->numSegments) || (image->segment[i].addrStart > addrEnd)) {
+    if (image->numSegments == image->capacity) {
+      capacity = (image->capacity == 0) ? 16 : 2*image->capacity;
+      if ((seg = (MemSegment_t*) realloc(image->segment, capacity * sizeof(MemSegment_t))) == NULL)
+        return(0);
+      image->segment  = seg;
+      image->capacity = capacity;
+    }
+    segNew.addrStart = addr;
+    segNew.numBytes  = 0;
+    segNew.capacity  = 0;
+    segNew.data      = NULL;
+    if (!segment_reserve(&segNew, numBytes))
+      return(0);
+    segNew.numBytes  = numBytes;
+    memcpy(segNew.data, data, numBytes);
+    memmove(image->segment+i+1, image->segment+i, (image->numSegments-i) * sizeof(MemSegment_t));
+    image->segment[i] = segNew;
+    image->numSegments++;
+    return(1);
+  }
+
+  // merge with segment i and all following segments touched by new data
+  seg      = image->segment + i;
+  segStart = (seg->addrStart < addr) ? seg->addrStart : addr;
+  segEnd   = seg->addrStart + seg->numBytes;
+  if (addrEnd > segEnd)
+    segEnd = addrEnd;
+  for (j=i+1; (j < image->numSegments) && (image->segment[j].addrStart <= segEnd); j++) {
+    if (image->segment[j].addrStart + image->segment[j].numBytes > segEnd)
+      segEnd = image->segment[j].addrStart + image->segment[j].numBytes;
+  }
+
+  // grow segment i, move existing data if new data starts before it
+  if (!segment_reserve(seg, segEnd - segStart))
+    return(0);
+  if (segStart < seg->addrStart) {
+    memmove(seg->data + (seg->addrStart - segStart), seg->data, seg->numBytes);
+    seg->addrStart = segStart;
+  }
+  seg->numBytes = segEnd - segStart;
+
+  // copy absorbed segments, then remove them from list
+  for (mid=i+1; mid<j; mid++) {
+    memcpy(seg->data + (image->segment[mid].addrStart - segStart), image->segment[mid].data, image->segment[mid].numBytes);
+    free(image->segment[mid].data);
+  }
+  memmove(image->segment+i+1, image->segment+j, (image->numSegments-j) * sizeof(MemSegment_t));
+  image->numSegments -= (j-i-1);
+
+  // new data takes precedence
+  memcpy(seg->data + (addr - segStart), data, numBytes);
+
+  return(1);
+}
+
+/**
+  get total number of data bytes in image
+*/
+uint32_t image_numBytes(const MemImage_t *image) {
+  uint32_t  numBytes = 0;
+  int       i;
+
+  for (i=0; i<image->numSegments; i++)
+    numBytes += image->segment[i].numBytes;
+
+  return(numBytes);
+}
+
+/**
+  get lowest and highest address (inclusive) in image. Return 0 for empty image
+*/
+uint8_t image_getRange(const MemImage_t *image, uint32_t *addrMin, uint32_t *addrMax) {
+  MemSegment_t  *last;
+
+  if (image->numSegments == 0)
+    return(0);
+  last     = image->segment + image->numSegments - 1;
+  *addrMin = image->segment[0].addrStart;
+  *addrMax = last->addrStart + last->numBytes - 1;
+
+  return(1);
+}
+
+/**
+  check if address range is completely contained in image, i.e. in a single segment
+*/
+uint8_t image_contains(const MemImage_t *image, uint32_t addr, uint32_t numBytes) {
+  int   lo, hi, mid;
+
+  // binary search first segment ending after addr
+  lo = 0;
+  hi = image->numSegments;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (image->segment[mid].addrStart + image->segment[mid].numBytes <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return((lo < image->numSegments) && (image->segment[lo].addrStart <= addr) &&
+    (addr + numBytes <= image->segment[lo].addrStart + image->segment[lo].numBytes));
+}
+
+/**
+  copy image data in address range to buffer. Bytes not contained in image are
+  left unchanged, i.e. caller initializes buffer with default content
+*/
+void image_getData(const MemImage_t *image, uint32_t addr, uint32_t numBytes, char *buf) {
+  MemSegment_t  *seg;
+  uint32_t      addrEnd, start, end;
+  int           lo, hi, mid;
+
+  addrEnd = addr + numBytes;
+
+  // binary search first segment ending after addr
+  lo = 0;
+  hi = image->numSegments;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (image->segment[mid].addrStart + image->segment[mid].numBytes <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  // copy overlapping part of all segments within range
+  for (; (lo < image->numSegments) && (image->segment[lo].addrStart < addrEnd); lo++) {
+    seg   = image->segment + lo;
+    start = (seg->addrStart > addr) ? seg->addrStart : addr;
+    end   = seg->addrStart + seg->numBytes;
+    if (end > addrEnd)
+      end = addrEnd;
+    memcpy(buf + (start - addr), seg->data + (start - seg->addrStart), end - start);
+  }
+}
+
+/**
+  create image covering all blocks touched by image, i.e. segment boundaries are
+  rounded to multiples of blockSize. Bytes not contained in image are set to 0x00,
+  which is the erased state of STM8 flash. Return 0 on failure (out of memory)
+*/
+uint8_t image_alignBlocks(const MemImage_t *image, uint32_t blockSize, MemImage_t *aligned) {
+  MemSegment_t  *seg;
+  uint32_t      start, end;
+  uint8_t       result;
+  char          *buf;
+  int           i;
+
+  for (i=0; i<image->numSegments; i++) {
+    seg   = image->segment + i;
+    start = seg->addrStart - (seg->addrStart % blockSize);
+    end   = seg->addrStart + seg->numBytes;
+    if (end % blockSize)
+      end += blockSize - (end % blockSize);
+    if ((buf = (char*) calloc(end - start, 1)) == NULL)
+      return(0);
+    image_getData(image, start, end - start, buf);
+    result = image_setData(aligned, start, end - start, buf);
+    free(buf);
+    if (!result)
+      return(0);
+  }
+
+  return(1);
+}
+
+/**
+  get all blocks touched by image which differ from reference. The block content
+  is the reference (0x00 where unknown) overwritten by the image. Changed blocks
+  are stored in diff, their number in numChanged. Return 0 on failure (out of memory)
+*/
+uint8_t image_diffBlocks(const MemImage_t *image, const MemImage_t *reference, uint32_t blockSize, MemImage_t *diff, uint32_t *numChanged) {
+  MemImage_t    aligned;
+  MemSegment_t  *seg;
+  uint32_t      addr;
+  uint8_t       result = 1;
+  char          *old;
+  int           i;
+
+  *numChanged = 0;
+  if ((old = (char*) malloc(blockSize)) == NULL)
+    return(0);
+
+  // block aligned copy of reference overwritten by image
+  image_init(&aligned);
+  if (!image_alignBlocks(image, blockSize, &aligned))
+    result = 0;
+  for (i=0; i<aligned.numSegments; i++) {
+    seg = aligned.segment + i;
+    memset(seg->data, 0, seg->numBytes);
+    image_getData(reference, seg->addrStart, seg->numBytes, seg->data);
+    image_getData(image, seg->addrStart, seg->numBytes, seg->data);
+  }
+
+  // compare block-wise with reference
+  for (i=0; (i<aligned.numSegments) && result; i++) {
+    seg = aligned.segment + i;
+    for (addr=seg->addrStart; (addr<seg->addrStart+seg->numBytes) && result; addr+=blockSize) {
+      memset(old, 0, blockSize);
+      image_getData(reference, addr, blockSize, old);
+      if (memcmp(old, seg->data + (addr - seg->addrStart), blockSize) != 0) {
+        result = image_setData(diff, addr, blockSize, seg->data + (addr - seg->addrStart));
+        (*numChanged)++;
+      }
+    }
+  }
+
+  image_free(&aligned);
+  free(old);
+
+  return(result);
+}
+
+/**
+  save image to binary file. Format: "STM8IMG1", number of segments, then for
+  each segment start address, number of bytes and data (all integers 32b little endian)
+*/
+uint8_t image_save(const char *filename, const MemImage_t *image) {
+  FILE      *fp;
+  uint8_t   hdr[8];
+  int       i, j;
+
+  if (!(fp = fopen(filename, "wb")))
+    return(0);
+
+  fwrite("STM8IMG1", 8, 1, fp);
+  for (j=0; j<4; j++)
+    hdr[j] = (uint8_t) (image->numSegments >> (8*j));
+  fwrite(hdr, 4, 1, fp);
+  for (i=0; i<image->numSegments; i++) {
+    for (j=0; j<4; j++) {
+      hdr[j]   = (uint8_t) (image->segment[i].addrStart >> (8*j));
+      hdr[j+4] = (uint8_t) (image->segment[i].numBytes >> (8*j));
+    }
+    fwrite(hdr, 8, 1, fp);
+    fwrite(image->segment[i].data, image->segment[i].numBytes, 1, fp);
+  }
+
+  return(fclose(fp) == 0);
+}
+
+/**
+  load image from binary file written by image_save(). Data is merged into image
+*/
+uint8_t image_load(const char *filename, MemImage_t *image) {
+  FILE      *fp;
+  uint8_t   hdr[8];
+  uint32_t  numSegments, addr, numBytes;
+  char      *buf;
+  int       i, j;
+
+  if (!(fp = fopen(filename, "rb")))
+    return(0);
+
+  // check header
+  if ((fread(hdr, 8, 1, fp) != 1) || (memcmp(hdr, "STM8IMG1", 8) != 0) || (fread(hdr, 4, 1, fp) != 1)) {
+    fclose(fp);
+    return(0);
+  }
+  numSegments = 0;
+  for (j=0; j<4; j++)
+    numSegments |= (uint32_t) hdr[j] << (8*j);
+
+  // read segments
+  for (i=0; i<numSegments; i++) {
+    addr = numBytes = 0;
+    if (fread(hdr, 8, 1, fp) != 1)
+      break;
+    for (j=0; j<4; j++) {
+      addr     |= (uint32_t) hdr[j]   << (8*j);
+      numBytes |= (uint32_t) hdr[j+4] << (8*j);
+    }
+    if ((buf = (char*) malloc(numBytes)) == NULL)
+      break;
+    if (fread(buf, 1, numBytes, fp) != numBytes) {
+      free(buf);
+      break;
+    }
+    j = image_setData(image, addr, numBytes, buf);
+    free(buf);
+    if (!j)
+      break;
+  }
+  fclose(fp);
+
+  return(i == numSegments);
+}
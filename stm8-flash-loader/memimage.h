@@ -0,0 +1,54 @@
+#ifndef _MEMIMAGE_H_
+#define _MEMIMAGE_H_
+
+#include <stdint.h>
+
+/// contiguous block of memory data
+typedef struct {
+  uint32_t      addrStart;      // starting address of segment
+  uint32_t      numBytes;       // number of data bytes in segment
+  uint32_t      capacity;       // allocated size of data buffer
+  char          *data;          // segment data
+} MemSegment_t;
+
+/// sparse memory image. Segments are sorted by address, never overlap and never touch
+typedef struct {
+  int           numSegments;    // number of segments in image
+  int           capacity;       // allocated number of segments
+  MemSegment_t  *segment;       // segment list
+} MemImage_t;
+
+/// initialize empty memory image
+void      image_init(MemImage_t *image);
+
+/// release all memory of image
+void      image_free(MemImage_t *image);
+
+/// store data in image, overwrite existing data. Adjacent segments are merged. Return 0 on failure
+uint8_t   image_setData(MemImage_t *image, uint32_t addr, uint32_t numBytes, const char *data);
+
+/// get total number of data bytes in image
+uint32_t  image_numBytes(const MemImage_t *image);
+
+/// get lowest and highest address (inclusive) in image. Return 0 for empty image
+uint8_t   image_getRange(const MemImage_t *image, uint32_t *addrMin, uint32_t *addrMax);
+
+/// check if address range is completely contained in image
+uint8_t   image_contains(const MemImage_t *image, uint32_t addr, uint32_t numBytes);
+
+/// copy image data in address range to buffer. Bytes not contained in image are left unchanged
+void      image_getData(const MemImage_t *image, uint32_t addr, uint32_t numBytes, char *buf);
+
+/// create image covering all blocks touched by image. Missing bytes are set to 0x00 (erased). Return 0 on failure
+uint8_t   image_alignBlocks(const MemImage_t *image, uint32_t blockSize, MemImage_t *aligned);
+
+/// get all blocks of image which differ from reference, with unchanged bytes taken from reference. Return 0 on failure
+uint8_t   image_diffBlocks(const MemImage_t *image, const MemImage_t *reference, uint32_t blockSize, MemImage_t *diff, uint32_t *numChanged);
+
+/// save image to binary file. Return 0 on failure
+uint8_t   image_save(const char *filename, const MemImage_t *image);
+
+/// load image from binary file written by image_save(). Return 0 on failure
+uint8_t   image_load(const char *filename, MemImage_t *image);
+
+#endif // _MEMIMAGE_H_
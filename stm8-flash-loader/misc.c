@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#if defined(WIN32) || defined(WIN64)
+  #include <io.h>
+#endif
+
+#include "misc.h"
+
+#if defined(WIN32) || defined(WIN64)
+
+/**
+  get monotonic time in [us] from performance counter
+*/
+uint64_t micros(void) {
+  static LARGE_INTEGER  freq = {0};
+  LARGE_INTEGER         count;
+
+  if (freq.QuadPart == 0)
+    QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+
+  return((uint64_t) (count.QuadPart * 1000000 / freq.QuadPart));
+}
+
+#else
+
+#include <time.h>
+
+/**
+  get monotonic time in [us]
+*/
+uint64_t micros(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return((uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000);
+}
+
+#endif // WIN32 || WIN64
+
+/**
+  calculate CRC-16/CCITT-FALSE (poly 0x1021, no reflection). Start with crc=0xFFFF.
+  Same algorithm as STM8_Routines/crc16_routine.s
+*/
+uint16_t crc16(const char *buf, uint32_t numBytes, uint16_t crc) {
+  uint8_t   x;
+  uint32_t  i;
+
+  for (i=0; i<numBytes; i++) {
+    x = (uint8_t) (crc >> 8) ^ (uint8_t) buf[i];
+    x ^= x >> 4;
+    crc = (crc << 8) ^ ((uint16_t) x << 12) ^ ((uint16_t) x << 5) ^ x;
+  }
+
+  return(crc);
+}
+
+/**
+  get name of per-port cache file, e.g. ~/.stm8-flash-loader/dev_ttyUSB0.img.
+  Path separators in port name are replaced. Cache directory is created if
+  required. Return 0 if no home directory is known
+*/
+uint8_t get_cache_file(const char *port, const char *ext, char *filename, int len) {
+  const char  *home;
+  char        dir[1000];
+  int         i, n;
+
+  // user cache directory
+  #if defined(WIN32) || defined(WIN64)
+    home = getenv("APPDATA");
+    if (home == NULL)
+      return(0);
+    snprintf(dir, sizeof(dir), "%s\\stm8-flash-loader", home);
+    mkdir(dir);
+    n = snprintf(filename, len, "%s\\", dir);
+  #else
+    home = getenv("HOME");
+    if (home == NULL)
+      return(0);
+    snprintf(dir, sizeof(dir), "%s/.stm8-flash-loader", home);
+    mkdir(dir, 0755);
+    n = snprintf(filename, len, "%s/", dir);
+  #endif
+
+  // append port name without leading '/' and separators, then extension
+  if (port[0] == '/')
+    port++;
+  for (i=0; (port[i] != 0) && (n < len-1); i++) {
+    if ((port[i] == '/') || (port[i] == '\\') || (port[i] == ':'))
+      filename[n++] = '_';
+    else
+      filename[n++] = port[i];
+  }
+  filename[n] = 0;
+  strncat(filename, ext, len - strlen(filename) - 1);
+
+  return(1);
+}
+
+/**
+  get absolute path of file relative to current directory (file doesn't have to exist).
+  Return 0 on failure
+*/
+uint8_t get_abs_path(const char *path, char *absPath, int len) {
+
+  #if defined(WIN32) || defined(WIN64)
+    return(_fullpath(absPath, path, len) != NULL);
+  #else
+    char  cwd[1000];
+
+    if (path[0] == '/')
+      return(snprintf(absPath, len, "%s", path) < len);
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+      return(0);
+    return(snprintf(absPath, len, "%s/%s", cwd, path) < len);
+  #endif
+}
@@ -0,0 +1,29 @@
+#ifndef _MISC_H_
+#define _MISC_H_
+
+#include <stdint.h>
+
+// OS specific sleep in [ms]
+#if defined(WIN32) || defined(WIN64)
+  #include <windows.h>
+  #define SLEEP(a)    Sleep(a)
+#elif defined(__APPLE__) || defined(__unix__)
+  #include <unistd.h>
+  #define SLEEP(a)    usleep((useconds_t) (a)*1000)
+#else
+  #error OS not supported
+#endif
+
+/// get monotonic time in [us]
+uint64_t micros(void);
+
+/// calculate CRC-16/CCITT-FALSE (init 0xFFFF) or continue calculation
+uint16_t crc16(const char *buf, uint32_t numBytes, uint16_t crc);
+
+/// get name of per-port cache file in user cache directory. Return 0 on failure
+uint8_t get_cache_file(const char *port, const char *ext, char *filename, int len);
+
+/// get absolute path of file relative to current directory. Return 0 on failure
+uint8_t get_abs_path(const char *path, char *absPath, int len);
+
+#endif // _MISC_H_
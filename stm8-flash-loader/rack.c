@@ -0,0 +1,259 @@
+/**
+  rack: one event loop serving the BSL sessions of many ports in one thread (Linux epoll),
+  instead of one blocking thread or process per port. Each port runs one non-blocking
+  operation at a time (see BslOp_t in bootloader.h), the loop only moves its bytes:
+    - received bytes are read as they arrive and passed to bsl_opReceive()
+    - output of the operation (frames, echos in reply mode) is written without blocking.
+      If the port can't take it all, the loop waits until it is writable
+    - the loop sleeps until the nearest deadline of all operations (bsl_opTimeout())
+  When an operation is done, the done callback of the port starts the next one. The bytes
+  are recorded to the trace of the session (see Bsl_t), the operations record statistics
+*/
+#if defined(__linux__)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "misc.h"
+#include "serial_comm.h"
+#include "bootloader.h"
+#include "rack.h"
+
+
+/**
+  init empty rack. Return 0 on success, 1 on failure
+*/
+uint8_t rack_init(Rack_t *rack) {
+
+  memset(rack, 0, sizeof(Rack_t));
+  if ((rack->fdEpoll = epoll_create1(0)) < 0) {
+    snprintf(rack->error, sizeof(rack->error), "error in 'rack_init()': cannot create epoll instance");
+    return(1);
+  }
+
+  return(0);
+}
+
+/**
+  open port with baudrate and known UART mode, and add it to rack. Responses of the BSL
+  may have gaps up to timeout [ms]. The done callback is called whenever an operation of
+  the port is done. Return port, or NULL on failure (message in rack->error)
+*/
+RackPort_t *rack_open(Rack_t *rack, const char *portname, uint32_t baudrate, uint8_t uartMode, uint32_t timeout, RackDone_t done, void *arg) {
+
+  struct epoll_event  ev;
+  RackPort_t          *port;
+  HANDLE              ptrPort;
+
+  if (rack->numPorts >= RACK_MAXPORTS) {
+    snprintf(rack->error, sizeof(rack->error), "error in 'rack_open()': max. %d ports", RACK_MAXPORTS);
+    return(NULL);
+  }
+
+  // open port, then switch to non-blocking I/O
+  if (!(ptrPort = init_port(portname, baudrate, timeout, 8, 0, 1, 0, 0))) {
+    snprintf(rack->error, sizeof(rack->error), "error in 'rack_open()': cannot open port '%s'", portname);
+    return(NULL);
+  }
+  if ((fcntl(ptrPort->fd, F_SETFL, fcntl(ptrPort->fd, F_GETFL) | O_NONBLOCK) != 0) || ((port = (RackPort_t*) calloc(1, sizeof(RackPort_t))) == NULL)) {
+    close_port(&ptrPort);
+    snprintf(rack->error, sizeof(rack->error), "error in 'rack_open()': cannot setup port '%s'", portname);
+    return(NULL);
+  }
+  strncpy(port->name, portname, sizeof(port->name)-1);
+  bsl_init(&(port->bsl), ptrPort, uartMode);
+  bsl_opInit(&(port->op), &(port->bsl), timeout);
+  port->done = done;
+  port->arg  = arg;
+
+  // wait for received bytes
+  ev.events   = EPOLLIN;
+  ev.data.ptr = port;
+  if (epoll_ctl(rack->fdEpoll, EPOLL_CTL_ADD, ptrPort->fd, &ev) != 0) {
+    close_port(&(port->bsl.port));
+    free(port);
+    snprintf(rack->error, sizeof(rack->error), "error in 'rack_open()': cannot add port '%s' to epoll", portname);
+    return(NULL);
+  }
+  rack->port[rack->numPorts++] = port;
+
+  return(port);
+}
+
+/**
+  write pending output of port without blocking. If the port can't take it all, also
+  wait for it to become writable. Output is dropped on a port error, i.e. the operation
+  times out
+*/
+static void rack_send(Rack_t *rack, RackPort_t *port) {
+
+  struct epoll_event  ev;
+  BslOp_t             *op = &(port->op);
+  ssize_t             num;
+  uint8_t             waitTx;
+
+  while (op->numTx < op->lenTx) {
+    num = write(port->bsl.port->fd, op->Tx+op->numTx, op->lenTx-op->numTx);
+    if (num > 0) {
+      trace_record(port->bsl.trace, TRACE_TX, op->Tx+op->numTx, (uint32_t) num);
+      op->numTx += (uint32_t) num;
+    }
+    else if ((num < 0) && (errno == EINTR))
+      continue;
+    else {
+      if ((num == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+        op->numTx = op->lenTx;
+      break;
+    }
+  }
+
+  waitTx = (op->numTx < op->lenTx);
+  if (waitTx != port->waitTx) {
+    ev.events   = waitTx ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.ptr = port;
+    epoll_ctl(rack->fdEpoll, EPOLL_CTL_MOD, port->bsl.port->fd, &ev);
+    port->waitTx = waitTx;
+  }
+}
+
+/**
+  read all received bytes of port and pass them to its operation
+*/
+static void rack_receive(RackPort_t *port) {
+
+  char      buf[512];
+  ssize_t   num;
+
+  do {
+    num = read(port->bsl.port->fd, buf, sizeof(buf));
+    if (num > 0) {
+      trace_record(port->bsl.trace, TRACE_RX, buf, (uint32_t) num);
+      bsl_opReceive(&(port->op), buf, (uint32_t) num);
+    }
+  } while ((num == sizeof(buf)) || ((num < 0) && (errno == EINTR)));
+}
+
+/**
+  port hung up or failed, e.g. USB adapter unplugged: stop watching it and drop
+  pending output. The operation times out
+*/
+static void rack_hangup(Rack_t *rack, RackPort_t *port) {
+
+  epoll_ctl(rack->fdEpoll, EPOLL_CTL_DEL, port->bsl.port->fd, NULL);
+  port->op.numTx = port->op.lenTx;
+  port->waitTx   = 0;
+}
+
+/**
+  send output of port. If its operation is done, report it to the done callback, which
+  may start the next operation
+*/
+static void rack_advance(Rack_t *rack, RackPort_t *port) {
+
+  do {
+    rack_send(rack, port);
+    if (port->op.status == BSL_BUSY) {
+      port->active = 1;
+      return;
+    }
+    if (!port->active)
+      return;
+    port->active = 0;
+    if (port->done != NULL)
+      port->done(port, port->arg);
+  } while (port->op.status == BSL_BUSY);
+}
+
+/**
+  advance operations of all ports as their bytes arrive, until all operations are done
+  and their output is sent. Operations started before are sent first. Return 0 on
+  success, 1 on failure of the event loop (message in rack->error). Results of the
+  operations are reported to the done callbacks
+*/
+uint8_t rack_run(Rack_t *rack) {
+
+  struct epoll_event  events[RACK_MAXEVENTS];
+  RackPort_t          *port;
+  uint64_t            now, next;
+  int                 i, num, timeout, busy;
+
+  for (i=0; i<rack->numPorts; i++)
+    rack_advance(rack, rack->port[i]);
+
+  while (1) {
+
+    // nearest deadline of all operations. Done if nothing is left to do
+    busy = 0;
+    next = 0;
+    for (i=0; i<rack->numPorts; i++) {
+      port = rack->port[i];
+      if ((port->op.status == BSL_BUSY) || port->waitTx)
+        busy = 1;
+      if ((port->op.status == BSL_BUSY) && (port->op.deadline != 0) && ((next == 0) || (port->op.deadline < next)))
+        next = port->op.deadline;
+    }
+    if (!busy)
+      break;
+    now = micros();
+    if (next == 0)
+      timeout = -1;
+    else if (next <= now)
+      timeout = 0;
+    else
+      timeout = (int) ((next - now + 999) / 1000);
+
+    // wait for received bytes, writable ports or deadline
+    num = epoll_wait(rack->fdEpoll, events, RACK_MAXEVENTS, timeout);
+    if ((num < 0) && (errno == EINTR))
+      continue;
+    if (num < 0) {
+      snprintf(rack->error, sizeof(rack->error), "error in 'rack_run()': epoll_wait failed (errno %d)", errno);
+      return(1);
+    }
+    for (i=0; i<num; i++) {
+      port = (RackPort_t*) events[i].data.ptr;
+      if (events[i].events & EPOLLIN)
+        rack_receive(port);
+      if (events[i].events & (EPOLLHUP | EPOLLERR))
+        rack_hangup(rack, port);
+      rack_advance(rack, port);
+    }
+
+    // operations past their deadline
+    now = micros();
+    for (i=0; i<rack->numPorts; i++) {
+      port = rack->port[i];
+      if ((port->op.status == BSL_BUSY) && (port->op.deadline != 0) && (port->op.deadline <= now)) {
+        bsl_opTimeout(&(port->op));
+        rack_advance(rack, port);
+      }
+    }
+  }
+
+  return(0);
+}
+
+/**
+  close all ports of rack and the event loop
+*/
+void rack_close(Rack_t *rack) {
+  int   i;
+
+  for (i=0; i<rack->numPorts; i++) {
+    epoll_ctl(rack->fdEpoll, EPOLL_CTL_DEL, rack->port[i]->bsl.port->fd, NULL);
+    close_port(&(rack->port[i]->bsl.port));
+    free(rack->port[i]);
+  }
+  rack->numPorts = 0;
+  if (rack->fdEpoll >= 0)
+    close(rack->fdEpoll);
+  rack->fdEpoll = -1;
+}
+
+#endif // __linux__
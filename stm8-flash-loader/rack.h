@@ -0,0 +1,47 @@
+#ifndef _RACK_H_
+#define _RACK_H_
+
+#include <stdint.h>
+#include "bootloader.h"
+
+#define RACK_MAXPORTS     256       // max. ports of a rack
+#define RACK_MAXEVENTS    64        // max. port events handled per wakeup
+
+typedef struct RackPort_s RackPort_t;
+
+// callback when the operation of a port is done (status in op.status). Start the next
+// operation (bsl_op*()) from here, else the port is finished
+typedef void (*RackDone_t)(RackPort_t *port, void *arg);
+
+// port of a rack with its BSL session and current non-blocking operation
+struct RackPort_s {
+  char          name[100];          // name of port
+  Bsl_t         bsl;                // BSL session on port
+  BslOp_t       op;                 // current operation, see bsl_opSync() etc.
+  uint8_t       active;             // operation in progress, done not yet reported
+  uint8_t       waitTx;             // output pending, wait until port is writable
+  RackDone_t    done;               // called when operation is done
+  void          *arg;               // argument of done callback
+};
+
+// ports served by one event loop in one thread (Linux epoll), see rack_run()
+typedef struct {
+  int           fdEpoll;            // epoll instance
+  int           numPorts;           // number of open ports
+  RackPort_t    *port[RACK_MAXPORTS]; // open ports
+  char          error[200];         // message of last error
+} Rack_t;
+
+/// init empty rack. Return 0 on success, 1 on failure
+uint8_t     rack_init(Rack_t *rack);
+
+/// open port with known UART mode and add it to rack. Return NULL on failure
+RackPort_t  *rack_open(Rack_t *rack, const char *portname, uint32_t baudrate, uint8_t uartMode, uint32_t timeout, RackDone_t done, void *arg);
+
+/// advance operations of all ports as their bytes arrive, until all are done. Return 0 on success, 1 on failure
+uint8_t     rack_run(Rack_t *rack);
+
+/// close all ports of rack
+void        rack_close(Rack_t *rack);
+
+#endif // _RACK_H_
@@ -1,15 +1,28 @@
 #include "serial_comm.h"
+#include "trace.h"
+
+/**
+  record baudrate change in trace (NULL: none), see trace.c
+*/
+static void trace_baudrate(Trace_t *trace, uint32_t baudrate) {
+  char      buf[4];
+
+  buf[0] = (char) baudrate;
+  buf[1] = (char) (baudrate >> 8);
+  buf[2] = (char) (baudrate >> 16);
+  buf[3] = (char) (baudrate >> 24);
+  trace_record(trace, TRACE_BAUD, buf, 4);
+}
+
+#if defined(WIN32) || defined(WIN64)
 
 /**
   open comm port for communication, set properties (baudrate, timeout,...).
-  Note: baudrate must be supported by COM port driver.
+  Note: baudrate must be supported by COM port driver. Return NULL on failure
 */
 HANDLE init_port(const char *port, uint32_t baudrate, uint32_t timeout, uint8_t numBits, uint8_t parity, uint8_t numStop, uint8_t RTS, uint8_t DTR) {
   char          port_tmp[100];
   HANDLE        fpCom = NULL;
-  DCB           fDCB;
-  BOOL          fSuccess;
-  COMMTIMEOUTS  fTimeout;
 
   // required to allow COM ports >COM9
   sprintf(port_tmp,"\\\\.\\%s", port);
@@ -23,64 +36,13 @@ HANDLE init_port(const char *port, uint32_t baudrate, uint32_t timeout, uint8_t
                      0,    // not overlapped I/O
                      NULL  // hTemplate must be NULL for comm devices
                     );
-  if (fpCom == INVALID_HANDLE_VALUE) {
-    fpCom = NULL;
-    fprintf(stderr, "\n\nerror in 'init_port(%s)': open port failed with code %d, exit!\n\n", port, (int) GetLastError());
-    exit(1);
-  }
-
-  // reset COM port error buffer
-  PurgeComm(fpCom, PURGE_RXABORT | PURGE_RXCLEAR | PURGE_TXABORT | PURGE_TXCLEAR);
+  if (fpCom == INVALID_HANDLE_VALUE)
+    return(NULL);
 
-  // get the current port configuration
-  fSuccess = GetCommState(fpCom, &fDCB);
-  if (!fSuccess) {
-    fprintf(stderr, "\n\nerror in 'init_port(%s)': get port attributes failed with code %d, exit!\n\n", port, (int) GetLastError());
-    exit(1);
-  }
-
-
-  // change port settings
-  fDCB.BaudRate = baudrate;         // set the baud rate (19200, 57600, 115200)
-  fDCB.ByteSize = numBits;          // number of data bits per byte
-  if (parity) {
-    fDCB.fParity = TRUE;            // Enable parity checking
-    fDCB.Parity  = parity;          // 0-4=no,odd,even,mark,space
-  } else {
-    fDCB.fParity  = FALSE;          // disable parity checking
-    fDCB.Parity   = NOPARITY;       // just to make sure
-  }
-  if (numStop == 1)
-    fDCB.StopBits = ONESTOPBIT;     // one stop bit
-  else if (numStop == 2)
-    fDCB.StopBits = TWOSTOPBITS;    // two stop bit
-  else
-    fDCB.StopBits = ONE5STOPBITS;   // 1.5 stop bit
-  fDCB.fRtsControl = (RTS != 0);    // RTS off(=0=-12V) or on(=1=+12V)
-  fDCB.fDtrControl = (DTR != 0);    // DTR off(=0=-12V) or on(=1=+12V)
-
-  // set new COM state
-  fSuccess = SetCommState(fpCom, &fDCB);
-  if (!fSuccess) {
-    fprintf(stderr, "\n\nerror in 'init_port(%s)': set port attributes failed with code %d, exit!\n\n", port, (int) GetLastError());
-    exit(1);
-  }
-
-
-  // set timeouts for port to avoid hanging of program. For simplicity set all timeouts to same value.
-  // For timeout=0 set values to query for buffer content
-  if (timeout == 0)
-    fTimeout.ReadIntervalTimeout        = MAXDWORD;    // --> no read timeout
-  else
-    fTimeout.ReadIntervalTimeout        = 0;           // max. ms between following read bytes (0=not used)
-  fTimeout.ReadTotalTimeoutMultiplier   = 0;           // time per read byte (use contant timeout instead)
-  fTimeout.ReadTotalTimeoutConstant     = timeout;     // total read timeout in ms
-  fTimeout.WriteTotalTimeoutMultiplier  = 0;           // time per write byte (use contant timeout instead)
-  fTimeout.WriteTotalTimeoutConstant    = timeout;
-  fSuccess = SetCommTimeouts(fpCom, &fTimeout);
-  if (!fSuccess) {
-    fprintf(stderr, "\n\nerror in 'init_port(%s)': set port timeout failed with code %d, exit!\n\n", port, (int) GetLastError());
-    exit(1);
+  // set port attributes (also purges port buffers)
+  if (set_port_attribute(fpCom, baudrate, timeout, numBits, parity, numStop, RTS, DTR) != 0) {
+    CloseHandle(fpCom);
+    return(NULL);
   }
 
   // return hande
@@ -88,36 +50,32 @@ HANDLE init_port(const char *port, uint32_t baudrate, uint32_t timeout, uint8_t
 }
 
 /**
-  close & release comm port.
+  close & release comm port. Return 0 on success, 1 on failure
 */
-void close_port(HANDLE *fpCom) {
+uint8_t close_port(HANDLE *fpCom) {
   BOOL      fSuccess;
 
   if (*fpCom != NULL) {
     fSuccess = CloseHandle(*fpCom);
-    if (!fSuccess) {
-      *fpCom = NULL;
-      fprintf(stderr, "\n\nerror in 'close_port': close port failed with code %d, exit!\n\n", (int) GetLastError());
-      exit(1);
-    }
+    *fpCom = NULL;
+    return(!fSuccess);
   }
   *fpCom = NULL;
+  return(0);
 }
 
 /**
-  get current attributes of an already open comm port.
+  get current attributes of an already open comm port. Return 0 on success, 1 on failure
 */
-void get_port_attribute(HANDLE fpCom, uint32_t *baudrate, uint32_t *timeout, uint8_t *numBits, uint8_t *parity, uint8_t *numStop, uint8_t *RTS, uint8_t *DTR) {
+uint8_t get_port_attribute(HANDLE fpCom, uint32_t *baudrate, uint32_t *timeout, uint8_t *numBits, uint8_t *parity, uint8_t *numStop, uint8_t *RTS, uint8_t *DTR) {
   DCB           fDCB;
   COMMTIMEOUTS  fTimeout;
   BOOL          fSuccess;
 
   // get the current port configuration
   fSuccess = GetCommState(fpCom, &fDCB);
-  if (!fSuccess) {
-    fprintf(stderr, "\n\nerror in 'get_port_attribute': GetCommState() failed with code %d, exit!\n\n", (int) GetLastError());
-    exit(1);
-  }
+  if (!fSuccess)
+    return(1);
 
   // get port settings
   *baudrate = fDCB.BaudRate;        // baud rate (19200, 57600, 115200)
@@ -135,17 +93,17 @@ void get_port_attribute(HANDLE fpCom, uint32_t *baudrate, uint32_t *timeout, uin
 
   // get port timeout
   fSuccess = GetCommTimeouts(fpCom, &fTimeout);
-  if (!fSuccess) {
-    fprintf(stderr, "\n\nerror in 'get_port_attribute': GetCommTimeouts() failed with code %d, exit!\n\n", (int) GetLastError());
-    exit(1);
-  }
+  if (!fSuccess)
+    return(1);
   *timeout = fTimeout.ReadTotalTimeoutConstant;       // this parameter fits also for timeout=0
+
+  return(0);
 }
 
 /**
-  change attributes of an already open comm port.
+  change attributes of an already open comm port. Return 0 on success, 1 on failure
 */
-void set_port_attribute(HANDLE fpCom, uint32_t baudrate, uint32_t timeout, uint8_t numBits, uint8_t parity, uint8_t numStop, uint8_t RTS, uint8_t DTR) {
+uint8_t set_port_attribute(HANDLE fpCom, uint32_t baudrate, uint32_t timeout, uint8_t numBits, uint8_t parity, uint8_t numStop, uint8_t RTS, uint8_t DTR) {
   DCB           fDCB;
   BOOL          fSuccess;
   COMMTIMEOUTS  fTimeout;
@@ -155,10 +113,8 @@ void set_port_attribute(HANDLE fpCom, uint32_t baudrate, uint32_t timeout, uint8
 
   // get the current port configuration
   fSuccess = GetCommState(fpCom, &fDCB);
-  if (!fSuccess) {
-    fprintf(stderr, "\n\nerror in 'set_port_attribute()': get port attributes failed with code %d, exit!\n\n", (int) GetLastError());
-    exit(1);
-  }
+  if (!fSuccess)
+    return(1);
 
   // change port settings
   fDCB.BaudRate = baudrate;         // set the baud rate (19200, 57600, 115200)
@@ -181,10 +137,8 @@ void set_port_attribute(HANDLE fpCom, uint32_t baudrate, uint32_t timeout, uint8
 
   // set new COM state
   fSuccess = SetCommState(fpCom, &fDCB);
-  if (!fSuccess) {
-    fprintf(stderr, "\n\nerror in 'set_port_attribute()': set port attributes failed with code %d, exit!\n\n", (int) GetLastError());
-    exit(1);
-  }
+  if (!fSuccess)
+    return(1);
 
   // set timeouts for port to avoid hanging of program. For simplicity set all timeouts to same value.
   // For timeout=0 set values to query for buffer content
@@ -197,39 +151,37 @@ void set_port_attribute(HANDLE fpCom, uint32_t baudrate, uint32_t timeout, uint8
   fTimeout.WriteTotalTimeoutMultiplier  = 0;           // time per write byte (use contant timeout instead)
   fTimeout.WriteTotalTimeoutConstant    = timeout;
   fSuccess = SetCommTimeouts(fpCom, &fTimeout);
-  if (!fSuccess) {
-    fprintf(stderr, "\n\nerror in 'set_port_attribute()': set port timeout failed with code %d, exit!\n\n", (int) GetLastError());
-    exit(1);
-  }
+  if (!fSuccess)
+    return(1);
+
+  return(0);
 }
 
 /**
-  set new baudrate for an already open comm port. Baudrate must be supported by PC driver.
+  set new baudrate for an already open comm port. Return 0 on success, 1 if baudrate is not supported by PC driver
 */
-void set_baudrate(HANDLE fpCom, uint32_t baudrate) {
+uint8_t set_baudrate(HANDLE fpCom, Trace_t *trace, uint32_t baudrate) {
   DCB       fDCB;
   BOOL      fSuccess;
 
   // get the current port configuration
   fSuccess = GetCommState(fpCom, &fDCB);
-  if (!fSuccess) {
-    fprintf(stderr, "\n\nerror in 'set_baudrate(%d)': get port attributes failed with code %d, exit!\n\n", (int) baudrate, (int) GetLastError());
-    exit(1);
-  }
+  if (!fSuccess)
+    return(1);
 
   // change port settings
   fDCB.BaudRate = baudrate;     // set the baud rate (19200, 57600, 115200)
   fSuccess = SetCommState(fpCom, &fDCB);
-  if (!fSuccess) {
-    fprintf(stderr, "\n\nerror in 'set_baudrate(%d)': set port attributes failed with code %d, exit!\n\n", (int) baudrate, (int) GetLastError());
-    exit(1);
-  }
+  if (!fSuccess)
+    return(1);
+  trace_baudrate(trace, baudrate);
+  return(0);
 }
 
 /**
-  set new timeout for an already open comm port
+  set new timeout for an already open comm port. Return 0 on success, 1 on failure
 */
-void set_timeout(HANDLE fpCom, uint32_t timeout) {
+uint8_t set_timeout(HANDLE fpCom, uint32_t timeout) {
   BOOL          fSuccess;
   COMMTIMEOUTS  fTimeout;
 
@@ -244,16 +196,16 @@ void set_timeout(HANDLE fpCom, uint32_t timeout) {
   fTimeout.WriteTotalTimeoutMultiplier  = 0;           // time per write byte (use contant timeout instead)
   fTimeout.WriteTotalTimeoutConstant    = timeout;
   fSuccess = SetCommTimeouts(fpCom, &fTimeout);
-  if (!fSuccess) {
-    fprintf(stderr, "\n\nerror in 'set_timeout(%d)': set timeout failed with code %d, exit!\n\n", (int) timeout, (int) GetLastError());
-    exit(1);
-  }
+  if (!fSuccess)
+    return(1);
+
+  return(0);
 }
 
 /**
   send data via comm port.
 */
-uint32_t send_port(HANDLE fpCom, uint32_t lenTx, char *Tx) {
+uint32_t send_port(HANDLE fpCom, Trace_t *trace, uint32_t lenTx, char *Tx) {
 
   // for reading back LIN echo
   char      Rx[1000];
@@ -264,6 +216,7 @@ uint32_t send_port(HANDLE fpCom, uint32_t lenTx, char *Tx) {
   // send data & return number of sent bytes
   PurgeComm(fpCom, PURGE_RXABORT | PURGE_RXCLEAR | PURGE_TXABORT | PURGE_TXCLEAR);
   WriteFile(fpCom, Tx, lenTx, &numChars, NULL);
+  trace_record(trace, TRACE_TX, Tx, (uint32_t) numChars);
 
   // return number of sent bytes
   return((uint32_t) numChars);
@@ -271,20 +224,31 @@ uint32_t send_port(HANDLE fpCom, uint32_t lenTx, char *Tx) {
 }
 
 /**
-  receive data via comm port. 
-  (UART reply mode with 2-wire interface), reply each byte from STM8 -> SLOW
+  receive data via comm port.
+  In duplex mode read complete response in one call. In UART reply mode
+  (2-wire interface) reply each byte from STM8 -> SLOW
 */
-uint32_t receive_port(HANDLE fpCom, uint32_t lenRx, char *Rx) {
+uint32_t receive_port(HANDLE fpCom, Trace_t *trace, uint8_t uartMode, uint32_t lenRx, char *Rx) {
   DWORD     numChars, numTmp;
   uint32_t  i;
 
-  // echo each byte as it is received
+  // duplex mode: read complete response, bounded by total timeout
+  if (uartMode == UART_MODE_DUPLEX) {
+    numChars = 0;
+    ReadFile(fpCom, Rx, lenRx, &numChars, NULL);
+    trace_record(trace, TRACE_RX, Rx, (uint32_t) numChars);
+    return((uint32_t) numChars);
+  }
+
+  // reply mode: echo each byte as it is received. No purge required for echo
   numChars = 0;
   for (i=0; i<lenRx; i++) {
     ReadFile(fpCom, Rx+i, 1, &numTmp, NULL);
     if (numTmp == 1) {
       numChars++;
-      send_port(fpCom, 1, Rx+i);
+      trace_record(trace, TRACE_RX, Rx+i, 1);
+      WriteFile(fpCom, Rx+i, 1, &numTmp, NULL);
+      trace_record(trace, TRACE_TX, Rx+i, (uint32_t) numTmp);
     } else
       break;
   }
@@ -296,7 +260,307 @@ uint32_t receive_port(HANDLE fpCom, uint32_t lenRx, char *Rx) {
 /**
   flush port input & output buffer.
 */
-void flush_port(HANDLE fpCom) {
+void flush_port(HANDLE fpCom, Trace_t *trace) {
   // purge all port buffers (see http://msdn.microsoft.com/en-us/library/windows/desktop/aa363428%28v=vs.85%29.aspx)
   PurgeComm(fpCom, PURGE_RXABORT | PURGE_RXCLEAR | PURGE_TXABORT | PURGE_TXCLEAR);
+  trace_record(trace, TRACE_FLUSH, NULL, 0);
+}
+
+#elif defined(__APPLE__) || defined(__unix__)
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+
+/**
+  convert baudrate to termios speed constant. Return B0 on unsupported baudrate
+*/
+static speed_t baud_to_speed(uint32_t baudrate) {
+
+  switch (baudrate) {
+    case 4800:    return(B4800);
+    case 9600:    return(B9600);
+    case 19200:   return(B19200);
+    case 38400:   return(B38400);
+    case 57600:   return(B57600);
+    case 115200:  return(B115200);
+    case 230400:  return(B230400);
+    #if defined(B460800)
+    case 460800:  return(B460800);
+    #endif
+    #if defined(B921600)
+    case 921600:  return(B921600);
+    #endif
+    default:      return(B0);
+  }
+}
+
+/**
+  convert termios speed constant back to baudrate
+*/
+static uint32_t speed_to_baud(speed_t speed) {
+
+  switch (speed) {
+    case B4800:   return(4800);
+    case B9600:   return(9600);
+    case B19200:  return(19200);
+    case B38400:  return(38400);
+    case B57600:  return(57600);
+    case B115200: return(115200);
+    case B230400: return(230400);
+    #if defined(B460800)
+    case B460800: return(460800);
+    #endif
+    #if defined(B921600)
+    case B921600: return(921600);
+    #endif
+    default:      return(0);
+  }
+}
+
+/**
+  open comm port for communication, set properties (baudrate, timeout,...).
+  Note: baudrate must be supported by termios. Return NULL on failure
+*/
+HANDLE init_port(const char *port, uint32_t baudrate, uint32_t timeout, uint8_t numBits, uint8_t parity, uint8_t numStop, uint8_t RTS, uint8_t DTR) {
+  HANDLE        fpCom;
+
+  if ((fpCom = (HANDLE) malloc(sizeof(Port_t))) == NULL)
+    return(NULL);
+
+  // open port in blocking mode. Don't become controlling terminal
+  fpCom->fd = open(port, O_RDWR | O_NOCTTY);
+  if (fpCom->fd < 0) {
+    free(fpCom);
+    return(NULL);
+  }
+
+  // set port attributes (also purges port buffers)
+  if (set_port_attribute(fpCom, baudrate, timeout, numBits, parity, numStop, RTS, DTR) != 0) {
+    close(fpCom->fd);
+    free(fpCom);
+    return(NULL);
+  }
+
+  // return handle
+  return(fpCom);
+}
+
+/**
+  close & release comm port. Return 0 on success, 1 on failure
+*/
+uint8_t close_port(HANDLE *fpCom) {
+  int       result = 0;
+
+  if (*fpCom != NULL) {
+    result = close((*fpCom)->fd);
+    free(*fpCom);
+  }
+  *fpCom = NULL;
+  return(result != 0);
 }
+
+/**
+  get current attributes of an already open comm port. Return 0 on success, 1 on failure
+*/
+uint8_t get_port_attribute(HANDLE fpCom, uint32_t *baudrate, uint32_t *timeout, uint8_t *numBits, uint8_t *parity, uint8_t *numStop, uint8_t *RTS, uint8_t *DTR) {
+  struct termios  toptions;
+  int             status = 0;
+
+  // get the current port configuration
+  if (tcgetattr(fpCom->fd, &toptions) != 0)
+    return(1);
+
+  // get port settings
+  *baudrate = speed_to_baud(cfgetospeed(&toptions));
+  switch (toptions.c_cflag & CSIZE) {
+    case CS5: *numBits = 5; break;
+    case CS6: *numBits = 6; break;
+    case CS7: *numBits = 7; break;
+    default:  *numBits = 8;
+  }
+  if (!(toptions.c_cflag & PARENB))
+    *parity = 0;                       // none
+  else if (toptions.c_cflag & PARODD)
+    *parity = 1;                       // odd
+  else
+    *parity = 2;                       // even
+  *numStop  = (toptions.c_cflag & CSTOPB) ? 2 : 1;
+
+  // RTS/DTR are not available on all devices, e.g. pseudo terminals
+  ioctl(fpCom->fd, TIOCMGET, &status);
+  *RTS      = ((status & TIOCM_RTS) != 0);
+  *DTR      = ((status & TIOCM_DTR) != 0);
+
+  // timeout is kept with the handle [ms]
+  *timeout  = fpCom->timeout;
+
+  return(0);
+}
+
+/**
+  change attributes of an already open comm port. Return 0 on success, 1 on failure
+*/
+uint8_t set_port_attribute(HANDLE fpCom, uint32_t baudrate, uint32_t timeout, uint8_t numBits, uint8_t parity, uint8_t numStop, uint8_t RTS, uint8_t DTR) {
+  struct termios  toptions;
+  int             flags;
+
+  // baudrate must be supported by termios
+  if (baud_to_speed(baudrate) == B0)
+    return(1);
+
+  // reset COM port error buffer
+  tcflush(fpCom->fd, TCIOFLUSH);
+
+  // get the current port configuration
+  if (tcgetattr(fpCom->fd, &toptions) != 0)
+    return(1);
+
+  // raw mode, i.e. no echo, no line editing, no character translation
+  cfmakeraw(&toptions);
+  toptions.c_cflag |= (CLOCAL | CREAD);
+  toptions.c_cflag &= ~CRTSCTS;
+
+  // change port settings
+  cfsetispeed(&toptions, baud_to_speed(baudrate));
+  cfsetospeed(&toptions, baud_to_speed(baudrate));
+  toptions.c_cflag &= ~CSIZE;
+  switch (numBits) {
+    case 5:  toptions.c_cflag |= CS5; break;
+    case 6:  toptions.c_cflag |= CS6; break;
+    case 7:  toptions.c_cflag |= CS7; break;
+    default: toptions.c_cflag |= CS8;
+  }
+  toptions.c_cflag &= ~(PARENB | PARODD);
+  if (parity == 1)
+    toptions.c_cflag |= (PARENB | PARODD);    // odd
+  else if (parity == 2)
+    toptions.c_cflag |= PARENB;               // even
+  if (numStop == 2)
+    toptions.c_cflag |= CSTOPB;               // two stop bits
+  else
+    toptions.c_cflag &= ~CSTOPB;              // one stop bit
+
+  // read returns the available data without waiting (VMIN=VTIME=0). The timeout
+  // is applied via poll() in receive_port() with ms resolution
+  toptions.c_cc[VMIN]  = 0;
+  toptions.c_cc[VTIME] = 0;
+  fpCom->timeout = timeout;
+
+  // set new port state
+  if (tcsetattr(fpCom->fd, TCSANOW, &toptions) != 0)
+    return(1);
+
+  // set RTS and DTR. Ignore failure, e.g. for pseudo terminals
+  flags = TIOCM_RTS;
+  ioctl(fpCom->fd, RTS ? TIOCMBIS : TIOCMBIC, &flags);
+  flags = TIOCM_DTR;
+  ioctl(fpCom->fd, DTR ? TIOCMBIS : TIOCMBIC, &flags);
+
+  return(0);
+}
+
+/**
+  set new baudrate for an already open comm port. Return 0 on success, 1 if baudrate is not supported by termios
+*/
+uint8_t set_baudrate(HANDLE fpCom, Trace_t *trace, uint32_t baudrate) {
+  struct termios  toptions;
+
+  // get the current port configuration
+  if ((baud_to_speed(baudrate) == B0) || (tcgetattr(fpCom->fd, &toptions) != 0))
+    return(1);
+
+  // change port settings
+  cfsetispeed(&toptions, baud_to_speed(baudrate));
+  cfsetospeed(&toptions, baud_to_speed(baudrate));
+  if (tcsetattr(fpCom->fd, TCSANOW, &toptions) != 0)
+    return(1);
+  trace_baudrate(trace, baudrate);
+  return(0);
+}
+
+/**
+  set new timeout for an already open comm port. Return 0 on success, 1 on failure
+*/
+uint8_t set_timeout(HANDLE fpCom, uint32_t timeout) {
+
+  // timeout is applied by receive_port(), see set_port_attribute()
+  if (fpCom == NULL)
+    return(1);
+  fpCom->timeout = timeout;
+
+  return(0);
+}
+
+/**
+  send data via comm port.
+*/
+uint32_t send_port(HANDLE fpCom, Trace_t *trace, uint32_t lenTx, char *Tx) {
+  uint32_t  numChars;
+  ssize_t   numTmp;
+
+  // write until all data is queued (write may return early, e.g. on signals)
+  numChars = 0;
+  while (numChars < lenTx) {
+    numTmp = write(fpCom->fd, Tx+numChars, lenTx-numChars);
+    if (numTmp < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    numChars += (uint32_t) numTmp;
+  }
+  trace_record(trace, TRACE_TX, Tx, numChars);
+
+  // return number of sent bytes
+  return(numChars);
+}
+
+/**
+  receive data via comm port.
+  Each read returns all bytes available up to lenRx, after waiting up to the timeout
+  of the port [ms] for data (poll). In duplex mode a complete response is usually read
+  in one call. In UART reply mode (2-wire interface) the STM8 waits for every echo, so
+  a chunk is echoed before the next read
+*/
+uint32_t receive_port(HANDLE fpCom, Trace_t *trace, uint8_t uartMode, uint32_t lenRx, char *Rx) {
+  struct pollfd   pfd;
+  uint32_t        numChars;
+  ssize_t         numTmp;
+  int             result;
+
+  pfd.fd     = fpCom->fd;
+  pfd.events = POLLIN;
+  numChars = 0;
+  while (numChars < lenRx) {
+    result = poll(&pfd, 1, (int) fpCom->timeout);
+    if ((result < 0) && (errno == EINTR))
+      continue;
+    if (result <= 0)
+      break;                                // timeout or error
+    numTmp = read(fpCom->fd, Rx+numChars, lenRx-numChars);
+    if ((numTmp < 0) && (errno == EINTR))
+      continue;
+    if (numTmp <= 0)
+      break;                                // timeout or error
+    trace_record(trace, TRACE_RX, Rx+numChars, (uint32_t) numTmp);
+    if (uartMode == UART_MODE_REPLY)
+      send_port(fpCom, trace, (uint32_t) numTmp, Rx+numChars);
+    numChars += (uint32_t) numTmp;
+  }
+
+  // return number of bytes received
+  return(numChars);
+}
+
+/**
+  flush port input & output buffer.
+*/
+void flush_port(HANDLE fpCom, Trace_t *trace) {
+  tcflush(fpCom->fd, TCIOFLUSH);
+  trace_record(trace, TRACE_FLUSH, NULL, 0);
+}
+
+#endif // WIN32 || WIN64
@@ -5,35 +5,57 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include "trace.h"
+
+#if defined(WIN32) || defined(WIN64)
+  #include <windows.h>
+  #include <conio.h>
+#elif defined(__APPLE__) || defined(__unix__)
+  #include <termios.h>
+  #include <unistd.h>
+
+  // POSIX port: file descriptor and receive timeout [ms]. Reads are bounded via poll(),
+  // as the termios timeout (VTIME) only has a resolution of 100ms
+  typedef struct {
+    int       fd;                   // file descriptor of port
+    uint32_t  timeout;              // receive timeout [ms], max. gap within a response
+  } Port_t;
+  typedef Port_t *HANDLE;           // NULL: not open
+#else
+  #error OS not supported
+#endif
+
+// UART modes of STM8 BSL
+#define UART_MODE_DUPLEX  0       // full duplex, receive complete responses as one block
+#define UART_MODE_REPLY   1       // reply mode, echo each byte received from STM8
 
-#include <windows.h>
-#include <conio.h>
+// functions moving bytes or changing the baudrate record to trace (NULL: none), see trace.c
 
-/// init comm port
+/// init comm port, return 0 (NULL) on failure
 HANDLE      init_port(const char *port, uint32_t baudrate, uint32_t timeout, uint8_t numBits, uint8_t parity, uint8_t numStop, uint8_t RTS, uint8_t DTR);
 
 /// close comm port
-void        close_port(HANDLE *fpCom);
+uint8_t     close_port(HANDLE *fpCom);
 
 /// get comm port settings
-void        get_port_attribute(HANDLE fpCom, uint32_t *baudrate, uint32_t *timeout, uint8_t *numBits, uint8_t *parity, uint8_t *numStop, uint8_t *RTS, uint8_t *DTR);
+uint8_t     get_port_attribute(HANDLE fpCom, uint32_t *baudrate, uint32_t *timeout, uint8_t *numBits, uint8_t *parity, uint8_t *numStop, uint8_t *RTS, uint8_t *DTR);
 
 /// modify comm port settings
-void        set_port_attribute(HANDLE fpCom, uint32_t baudrate, uint32_t timeout, uint8_t numBits, uint8_t parity, uint8_t numStop, uint8_t RTS, uint8_t DTR);
+uint8_t     set_port_attribute(HANDLE fpCom, uint32_t baudrate, uint32_t timeout, uint8_t numBits, uint8_t parity, uint8_t numStop, uint8_t RTS, uint8_t DTR);
 
-/// modify comm port baudrate
-void        set_baudrate(HANDLE fpCom, uint32_t baudrate);
+/// modify comm port baudrate, return 1 if not supported
+uint8_t     set_baudrate(HANDLE fpCom, Trace_t *trace, uint32_t baudrate);
 
 /// modify comm port timeout
-void        set_timeout(HANDLE fpCom, uint32_t timeout);
+uint8_t     set_timeout(HANDLE fpCom, uint32_t timeout);
 
 /// send data
-uint32_t    send_port(HANDLE fpCom, uint32_t lenTx, char *Tx);
+uint32_t    send_port(HANDLE fpCom, Trace_t *trace, uint32_t lenTx, char *Tx);
 
-/// receive data
-uint32_t    receive_port(HANDLE fpCom, uint32_t lenRx, char *Rx);
+/// receive data, echo each byte in UART reply mode
+uint32_t    receive_port(HANDLE fpCom, Trace_t *trace, uint8_t uartMode, uint32_t lenRx, char *Rx);
 
 /// flush port buffers
-void        flush_port(HANDLE fpCom);
+void        flush_port(HANDLE fpCom, Trace_t *trace);
 
 #endif
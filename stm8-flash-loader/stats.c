@@ -0,0 +1,208 @@
+/**
+  protocol statistics of a run, i.e. of one BSL session (Stats_t, see Bsl_t): latency
+  of each phase of the BSL transactions (see bsl_* in bootloader.c) as log2 histogram,
+  payload throughput (per time spent in transactions, i.e. without reset and sleeps) and
+  retries. Written as JSON report to find slow adapters or boards, format:
+    {"ports": [
+      {"port": ..., "result": "pass"|"fail", "baudrate": ..., "duration_us": ..., "busy_us": ...,
+       "payload": {"read_bytes": ..., "write_bytes": ..., "throughput_Bps": ...},
+       "retries": {"sync": ..., "baudrate": ..., "block": ...},
+       "transactions": {"READ": {"count": ..., "phases": {"send": {"count": ..., "sum_us": ...,
+         "min_us": ..., "max_us": ..., "hist_log2_us": [...]}, ...}}, ...}}
+    ]}
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "misc.h"
+#include "stats.h"
+
+// names in report
+static const char *CMD_NAME[STAT_NUM_CMD]     = {"SYNC", "GET", "READ", "WRITE", "ERASE", "GO"};
+static const char *PHASE_NAME[STAT_NUM_PHASE] = {"send", "ack1", "ack2", "data"};
+static const char *RETRY_NAME[STAT_NUM_RETRY] = {"sync", "baudrate", "block"};
+
+/**
+  reset statistics and start run on port. Result is 'fail' until set
+*/
+void stats_init(Stats_t *stats, const char *portname) {
+
+  memset(stats, 0, sizeof(Stats_t));
+  strncpy(stats->port, portname, sizeof(stats->port)-1);
+  stats->result = 1;
+  stats->start  = micros();
+  stats->mark   = stats->start;
+}
+
+/**
+  set baudrate of run
+*/
+void stats_setBaudrate(Stats_t *stats, uint32_t baudrate) {
+  if (stats != NULL)
+    stats->baudrate = baudrate;
+}
+
+/**
+  set result of run (0=pass)
+*/
+void stats_setResult(Stats_t *stats, int result) {
+  if (stats != NULL)
+    stats->result = result;
+}
+
+/**
+  start BSL transaction cmd (STAT_*)
+*/
+void stats_begin(Stats_t *stats, uint8_t cmd) {
+  if (stats == NULL)
+    return;
+  stats->cmd  = cmd;
+  stats->mark = micros();
+  stats->count[cmd]++;
+}
+
+/**
+  end phase (PHASE_*) of current transaction: record time since start of transaction or
+  end of previous phase
+*/
+void stats_phase(Stats_t *stats, uint8_t phase) {
+  uint64_t  t;
+  uint32_t  dt;
+  Phase_t   *p;
+  int       bin;
+
+  if (stats == NULL)
+    return;
+  t  = micros();
+  dt = (uint32_t) (t - stats->mark);
+  stats->mark  = t;
+  stats->busy += dt;
+
+  p = &(stats->phase[stats->cmd][phase]);
+  if ((p->count == 0) || (dt < p->min))
+    p->min = dt;
+  if (dt > p->max)
+    p->max = dt;
+  p->count++;
+  p->sum += dt;
+  for (bin=0; (bin < STAT_NUM_BIN-1) && (dt >> (bin+1)); bin++);
+  p->hist[bin]++;
+}
+
+/**
+  add payload bytes of current READ or WRITE transaction
+*/
+void stats_payload(Stats_t *stats, uint32_t numBytes) {
+  if (stats == NULL)
+    return;
+  if (stats->cmd == STAT_READ)
+    stats->bytesRead += numBytes;
+  else
+    stats->bytesWritten += numBytes;
+}
+
+/**
+  count retry of type (RETRY_*)
+*/
+void stats_retry(Stats_t *stats, uint8_t type) {
+  if (stats != NULL)
+    stats->retry[type]++;
+}
+
+/**
+  write JSON object of run (without ports list)
+*/
+static void stats_report(const Stats_t *stats, FILE *fp) {
+  uint64_t  duration;
+  const Phase_t *p;
+  int       cmd, phase, i, j, numBin, first;
+
+  duration = micros() - stats->start;
+
+  // port name as JSON string, e.g. '\\.\COM10' on Windows
+  fprintf(fp, "  {\"port\": \"");
+  for (i=0; stats->port[i] != '\0'; i++)
+    fprintf(fp, ((stats->port[i] == '\\') || (stats->port[i] == '"')) ? "\\%c" : "%c", stats->port[i]);
+  fprintf(fp, "\", \"result\": \"%s\", \"baudrate\": %u, \"duration_us\": %llu, \"busy_us\": %llu,\n",
+    stats->result ? "fail" : "pass", (unsigned) stats->baudrate, (unsigned long long) duration, (unsigned long long) stats->busy);
+  fprintf(fp, "   \"payload\": {\"read_bytes\": %llu, \"write_bytes\": %llu, \"throughput_Bps\": %.0f},\n",
+    (unsigned long long) stats->bytesRead, (unsigned long long) stats->bytesWritten,
+    stats->busy ? (stats->bytesRead + stats->bytesWritten) * 1e6 / stats->busy : 0.0);
+  fprintf(fp, "   \"retries\": {");
+  for (i=0; i<STAT_NUM_RETRY; i++)
+    fprintf(fp, "%s\"%s\": %u", i ? ", " : "", RETRY_NAME[i], (unsigned) stats->retry[i]);
+  fprintf(fp, "},\n");
+
+  // transactions with at least one sample
+  fprintf(fp, "   \"transactions\": {");
+  first = 1;
+  for (cmd=0; cmd<STAT_NUM_CMD; cmd++) {
+    if (stats->count[cmd] == 0)
+      continue;
+    fprintf(fp, "%s\n    \"%s\": {\"count\": %u, \"phases\": {", first ? "" : ",", CMD_NAME[cmd], (unsigned) stats->count[cmd]);
+    first = 0;
+    for (phase=0, i=0; phase<STAT_NUM_PHASE; phase++) {
+      p = &(stats->phase[cmd][phase]);
+      if (p->count == 0)
+        continue;
+      for (numBin=STAT_NUM_BIN; (numBin > 1) && (p->hist[numBin-1] == 0); numBin--);
+      fprintf(fp, "%s\n      \"%s\": {\"count\": %u, \"sum_us\": %llu, \"min_us\": %u, \"max_us\": %u, \"hist_log2_us\": [",
+        i++ ? "," : "", PHASE_NAME[phase], (unsigned) p->count, (unsigned long long) p->sum, (unsigned) p->min, (unsigned) p->max);
+      for (j=0; j<numBin; j++)
+        fprintf(fp, "%s%u", j ? ", " : "", (unsigned) p->hist[j]);
+      fprintf(fp, "]}");
+    }
+    fprintf(fp, "}}");
+  }
+  fprintf(fp, "}}");
+}
+
+/**
+  write JSON report of run to file. Return 0 on failure
+*/
+uint8_t stats_write(const Stats_t *stats, const char *filename) {
+  FILE  *fp;
+
+  if ((fp = fopen(filename, "w")) == NULL)
+    return(0);
+  fprintf(fp, "{\"ports\": [\n");
+  stats_report(stats, fp);
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+
+  return(1);
+}
+
+/**
+  merge JSON reports of several runs (see stats_write()) into one report. Missing reports
+  are skipped. Return 0 on failure
+*/
+uint8_t stats_merge(const char *filename, char **files, int numFiles) {
+  FILE  *fp, *fpIn;
+  char  line[1000];
+  int   i, numRuns, numLines;
+
+  if ((fp = fopen(filename, "w")) == NULL)
+    return(0);
+  fprintf(fp, "{\"ports\": [\n");
+  numRuns = 0;
+  for (i=0; i<numFiles; i++) {
+    if ((fpIn = fopen(files[i], "r")) == NULL)
+      continue;
+
+    // copy run object, i.e. skip first and last line
+    if (fgets(line, sizeof(line), fpIn) != NULL) {
+      numLines = 0;
+      while ((fgets(line, sizeof(line), fpIn) != NULL) && (strcmp(line, "]}\n") != 0)) {
+        line[strcspn(line, "\n")] = '\0';
+        fprintf(fp, "%s%s", numLines++ ? "\n" : (numRuns++ ? ",\n" : ""), line);
+      }
+    }
+    fclose(fpIn);
+  }
+  fprintf(fp, "\n]}\n");
+
+  return(fclose(fp) == 0);
+}
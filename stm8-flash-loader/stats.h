@@ -0,0 +1,84 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// BSL transactions
+#define STAT_SYNC         0         // SYNCH
+#define STAT_GET          1         // GET
+#define STAT_READ         2         // READ
+#define STAT_WRITE        3         // WRITE
+#define STAT_ERASE        4         // ERASE
+#define STAT_GO           5         // GO
+#define STAT_NUM_CMD      6
+
+// phases of a transaction
+#define PHASE_SEND        0         // send command, address or data
+#define PHASE_ACK1        1         // wait for ACK1 after command
+#define PHASE_ACK2        2         // wait for ACK2 after address or parameter
+#define PHASE_DATA        3         // wait for ACK3 after data, or for read data
+#define STAT_NUM_PHASE    4
+
+// retry counters
+#define RETRY_SYNC        0         // repeated SYNCH
+#define RETRY_BAUD        1         // baudrate rejected during negotiation
+#define RETRY_BLOCK       2         // READ or WRITE frame resent after NACK or timeout
+#define STAT_NUM_RETRY    3
+
+// latency histogram with log2 bins: bin i counts latencies in [2^i, 2^(i+1)) us, last bin open
+#define STAT_NUM_BIN      24
+
+// latency of one phase
+typedef struct {
+  uint32_t  count;                  // number of samples
+  uint64_t  sum;                    // sum of latencies [us]
+  uint32_t  min, max;               // min. and max. latency [us]
+  uint32_t  hist[STAT_NUM_BIN];     // log2 histogram
+} Phase_t;
+
+// statistics of a run, i.e. of one session (see Bsl_t in bootloader.h). The recording
+// functions do nothing for stats NULL
+typedef struct {
+  char      port[1000];             // name of port
+  int       result;                 // result of run (0=pass)
+  uint32_t  baudrate;               // communication baudrate
+  uint64_t  start;                  // start of run [us]
+  uint64_t  mark;                   // end of last phase [us]
+  uint64_t  busy;                   // time in transactions [us]
+  uint8_t   cmd;                    // current transaction
+  uint32_t  count[STAT_NUM_CMD];    // number of transactions
+  uint64_t  bytesRead;              // payload read
+  uint64_t  bytesWritten;           // payload written
+  uint32_t  retry[STAT_NUM_RETRY];  // retry counters
+  Phase_t   phase[STAT_NUM_CMD][STAT_NUM_PHASE];
+} Stats_t;
+
+/// reset statistics and start run on port
+void    stats_init(Stats_t *stats, const char *portname);
+
+/// set baudrate of run
+void    stats_setBaudrate(Stats_t *stats, uint32_t baudrate);
+
+/// set result of run (0=pass)
+void    stats_setResult(Stats_t *stats, int result);
+
+/// start BSL transaction
+void    stats_begin(Stats_t *stats, uint8_t cmd);
+
+/// end phase of current transaction, i.e. record time since last mark
+void    stats_phase(Stats_t *stats, uint8_t phase);
+
+/// add payload bytes of current transaction
+void    stats_payload(Stats_t *stats, uint32_t numBytes);
+
+/// count retry
+void    stats_retry(Stats_t *stats, uint8_t type);
+
+/// write JSON report of run to file. Return 0 on failure
+uint8_t stats_write(const Stats_t *stats, const char *filename);
+
+/// merge JSON reports of several runs into one report. Return 0 on failure
+uint8_t stats_merge(const char *filename, char **files, int numFiles);
+
+#endif // _STATS_H_
@@ -0,0 +1,621 @@
+/**
+  emulator of the STM8 ROM bootloader (UART BSL) behind a pseudo terminal, to test and
+  benchmark the loader without hardware (POSIX only). Prints the name of the pty for the
+  loader (-p), then serves until killed.
+  Supports SYNCH, GET, READ, WRITE, ERASE (mass and sectors) and GO with the command and
+  return codes of bootloader.h, duplex and reply mode (every byte sent by the BSL is
+  echoed by the host) and the '##reset##' command of the STM8 application.
+  Memory map: RAM, D-flash, option bytes, registers, BSL ROM and P-flash of configurable
+  size, other addresses are NACKed. As on a real device, flash WRITE and ERASE require
+  an E_W routine (see STM8_Routines/E_W_ROUTINEs.h) in RAM. GO to the CRC16 routine (if
+  resident) calculates the CRC and re-enters the BSL, GO to other addresses leaves it.
+  Faults can be injected with given probabilities to measure retry and timeout paths.
+  On GO to the application, command counters and wire statistics (bytes in both
+  directions, round trips) are printed in one line starting with 'GO'.
+  Usage: bsl_emu [options]
+    -m mode     UART mode: 0=duplex, 1=reply (default 0)
+    -f kB       P-flash size (default 32)
+    -V version  BSL version for GET in hex (default 13)
+    -g          no ERASE in GET response, ERASE is NACKed (limited BSL)
+    -b baud     max. baudrate, above the BSL responds with garbage (default none)
+    -w us       flash/EEPROM programming time per 128B block (default 6000)
+    -e us       erase time per 1kB sector (default 24000)
+    -d p        drop each byte sent by BSL with probability p
+    -n p        respond NACK instead of ACK with probability p
+    -s p        stall before a response with probability p ...
+    -t ms       ... for this time (default 500)
+    -r seed     seed for fault injection (default 1)
+    -c          emulate wire time of each byte at the current baudrate (10 bit per byte)
+    -v          print each command
+*/
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "misc.h"
+#include "bootloader.h"
+#include "flash.h"
+#include "E_W_ROUTINEs.h"
+#include "crc16_routine.h"
+
+// memory map
+#define RAM_END           0x17FF    // end of RAM (6kB)
+#define OPTION_END        0x487F    // end of option bytes
+#define REG_START         0x5000    // IO registers
+#define REG_END           0x57FF
+#define ROM_START         0x6000    // BSL ROM
+#define ROM_END           0x67FF
+#define MEM_SIZE          (PFLASH_MAXEND+1)
+
+#define ECHO_TIMEOUT      1000      // max. wait for echo in reply mode [ms]
+#define CMD_TIMEOUT       1000      // max. wait for remainder of command [ms]
+#define WIRE_IDLE         1000      // wire is idle after this gap [us]
+
+// configuration
+static struct {
+  uint8_t   mode;                   // UART mode
+  uint32_t  flashEnd;               // last P-flash address
+  uint8_t   version;                // BSL version
+  uint8_t   noErase;                // ERASE not supported
+  uint32_t  maxBaud;                // max. baudrate (0=none)
+  uint32_t  timeWrite;              // programming time per flash block [us]
+  uint32_t  timeErase;              // erase time per sector [us]
+  double    probDrop;               // probability to drop sent byte
+  double    probNack;               // probability to NACK instead of ACK
+  double    probStall;              // probability to stall before response
+  uint32_t  timeStall;              // stall time [ms]
+  uint8_t   wireTime;               // emulate wire time
+  uint8_t   verbose;                // print commands
+} g_cfg;
+
+// state
+static int      g_fdMaster, g_fdSlave;
+static uint8_t  g_mem[MEM_SIZE];    // memory content
+static uint8_t  g_synced;           // BSL is synchronized (i.e. after SYNCH)
+static uint8_t  g_echoError;        // echo in reply mode missing or wrong
+static uint64_t g_wire;             // end of transfer of last byte on wire [us]
+static uint8_t  g_lastRx;           // last byte on wire was received
+
+// statistics
+static struct {
+  uint32_t  sync, get, read, write, erase, go, reset, nack;
+  uint32_t  dropped, nackInjected, stalled;
+  uint32_t  bytesRx, bytesTx, turns;
+} g_num;
+
+
+/**
+  random number in [0,1)
+*/
+static double rnd(void) {
+  return(rand() / (RAND_MAX + 1.0));
+}
+
+/**
+  current baudrate of pty as set by the loader
+*/
+static uint32_t get_baud(void) {
+  struct termios  toptions;
+  speed_t         speed;
+
+  if (tcgetattr(g_fdSlave, &toptions) != 0)
+    return(0);
+  speed = cfgetispeed(&toptions);
+  switch (speed) {
+    case B4800:   return(4800);
+    case B9600:   return(9600);
+    case B19200:  return(19200);
+    case B38400:  return(38400);
+    case B57600:  return(57600);
+    case B115200: return(115200);
+    case B230400: return(230400);
+    #if defined(B460800)
+    case B460800: return(460800);
+    #endif
+    #if defined(B921600)
+    case B921600: return(921600);
+    #endif
+    default:      return(0);
+  }
+}
+
+/**
+  account byte on wire. With wire time emulation, the byte occupies the wire for 10 bit
+  times after the previous one, or from now if the wire was idle. Short delays (e.g.
+  oversleeping) are caught up. Only sent bytes wait for the wire, as the host only
+  sees the timing of responses
+*/
+static void wire_byte(uint8_t rx) {
+  uint64_t  t;
+  uint32_t  baud;
+
+  if (rx)
+    g_num.bytesRx++;
+  else {
+    g_num.bytesTx++;
+    g_num.turns += g_lastRx;
+  }
+  g_lastRx = rx;
+
+  if ((!g_cfg.wireTime) || ((baud = get_baud()) == 0))
+    return;
+  t = micros();
+  g_wire = ((g_wire + WIRE_IDLE > t) ? g_wire : t) + 10000000 / baud;
+  if (rx)
+    return;
+  while ((t = micros()) < g_wire) {
+    if (g_wire - t > 200)
+      usleep(g_wire - t - 100);
+  }
+}
+
+/**
+  receive byte from host with timeout [ms] (<0: wait forever). Return -1 on timeout
+*/
+static int get_byte(int timeout) {
+  struct pollfd   pfd;
+  uint8_t         c;
+  ssize_t         num;
+
+  pfd.fd     = g_fdMaster;
+  pfd.events = POLLIN;
+  while (1) {
+    if (poll(&pfd, 1, timeout) <= 0)
+      return(-1);
+    num = read(g_fdMaster, &c, 1);
+    if ((num < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+      continue;
+    if (num != 1) {
+      SLEEP(10);          // no host connected (EIO)
+      continue;
+    }
+    wire_byte(1);
+    return(c);
+  }
+}
+
+/**
+  receive numBytes from host. Return 0 on timeout
+*/
+static uint8_t get_bytes(uint8_t *buf, int numBytes) {
+  int   i, c;
+
+  for (i=0; i<numBytes; i++) {
+    if ((c = get_byte(CMD_TIMEOUT)) < 0)
+      return(0);
+    buf[i] = (uint8_t) c;
+  }
+  return(1);
+}
+
+/**
+  send bytes to host, with fault injection. In reply mode wait for echo of each byte
+*/
+static void send_bytes(const uint8_t *buf, int numBytes) {
+  int   i, c;
+
+  // stall before response
+  if ((g_cfg.probStall > 0) && (rnd() < g_cfg.probStall)) {
+    g_num.stalled++;
+    SLEEP(g_cfg.timeStall);
+  }
+
+  for (i=0; i<numBytes; i++) {
+    if ((g_cfg.probDrop > 0) && (rnd() < g_cfg.probDrop)) {
+      g_num.dropped++;
+      continue;
+    }
+    wire_byte(0);
+    if (write(g_fdMaster, buf+i, 1) != 1)
+      continue;
+    if (g_cfg.mode == UART_MODE_REPLY) {
+      c = get_byte(ECHO_TIMEOUT);
+      if (c != buf[i]) {
+        g_echoError = 1;
+        return;
+      }
+    }
+  }
+}
+
+/**
+  send single response byte
+*/
+static void send_byte(uint8_t c) {
+  send_bytes(&c, 1);
+}
+
+/**
+  send ACK, or NACK if injected. Return 1 if ACK was sent
+*/
+static uint8_t send_ack(void) {
+  if ((g_cfg.probNack > 0) && (rnd() < g_cfg.probNack)) {
+    g_num.nackInjected++;
+    send_byte(NACK);
+    return(0);
+  }
+  send_byte(ACK);
+  return(!g_echoError);
+}
+
+/**
+  send NACK
+*/
+static void send_nack(void) {
+  g_num.nack++;
+  send_byte(NACK);
+}
+
+/**
+  address exists in memory map
+*/
+static uint8_t addr_valid(uint32_t addr) {
+  return((addr <= RAM_END) || ((addr >= DFLASH_START) && (addr <= OPTION_END)) ||
+         ((addr >= REG_START) && (addr <= REG_END)) || ((addr >= ROM_START) && (addr <= ROM_END)) ||
+         ((addr >= PFLASH_START) && (addr <= g_cfg.flashEnd)));
+}
+
+/**
+  memory image is resident in RAM
+*/
+static uint8_t image_resident(const MemImage_t *image) {
+  int   i;
+
+  for (i=0; i<image->numSegments; i++) {
+    if (memcmp(g_mem + image->segment[i].addrStart, image->segment[i].data, image->segment[i].numBytes) != 0)
+      return(0);
+  }
+  return(1);
+}
+
+/**
+  E_W routine for flash programming is resident in RAM
+*/
+static uint8_t routine_resident(void) {
+  int   i;
+
+  for (i=0; i<NUM_E_W_ROUTINES; i++) {
+    if (image_resident(E_W_ROUTINES[i].image))
+      return(1);
+  }
+  return(0);
+}
+
+/**
+  receive address and checksum, send ACK if valid. Return 0 on error
+*/
+static uint8_t get_addr(uint32_t *addr) {
+  uint8_t   buf[5];
+
+  if (!get_bytes(buf, 5))
+    return(0);
+  if ((buf[0] ^ buf[1] ^ buf[2] ^ buf[3]) != buf[4]) {
+    send_nack();
+    return(0);
+  }
+  *addr = ((uint32_t) buf[0] << 24) | ((uint32_t) buf[1] << 16) | ((uint32_t) buf[2] << 8) | buf[3];
+  if (!addr_valid(*addr)) {
+    send_nack();
+    return(0);
+  }
+  return(send_ack());
+}
+
+/**
+  GET: number of bytes, version and supported commands
+*/
+static void cmd_get(void) {
+  uint8_t   buf[] = {5, 0x00, GET, READ, GO, WRITE, ERASE};
+
+  g_num.get++;
+  buf[1] = g_cfg.version;
+  if (g_cfg.noErase)
+    buf[0]--;                       // ERASE is last in list
+  if (!send_ack())
+    return;
+  send_bytes(buf, buf[0] + 2);
+  send_byte(ACK);
+}
+
+/**
+  READ: address, number of bytes, data
+*/
+static void cmd_read(void) {
+  uint32_t  addr;
+  uint8_t   buf[2];
+  int       numBytes;
+
+  g_num.read++;
+  if ((!send_ack()) || (!get_addr(&addr)) || (!get_bytes(buf, 2)))
+    return;
+  numBytes = buf[0] + 1;
+  if (((buf[0] ^ buf[1]) != 0xFF) || (!addr_valid(addr + numBytes - 1))) {
+    send_nack();
+    return;
+  }
+  if (!send_ack())
+    return;
+  send_bytes(g_mem + addr, numBytes);
+}
+
+/**
+  WRITE: address, number of bytes, data and checksum. Flash requires E_W routine
+*/
+static void cmd_write(void) {
+  uint32_t  addr;
+  uint8_t   buf[260], chk;
+  int       numBytes, i;
+
+  g_num.write++;
+  if ((!send_ack()) || (!get_addr(&addr)) || (!get_bytes(buf, 1)))
+    return;
+  numBytes = buf[0] + 1;
+  if ((numBytes > 128) || (!get_bytes(buf+1, numBytes+1)))
+    return;
+  for (chk=0, i=0; i<numBytes+1; i++)
+    chk ^= buf[i];
+  if ((chk != buf[numBytes+1]) || (!addr_valid(addr + numBytes - 1)) || ((addr >= ROM_START) && (addr <= ROM_END))) {
+    send_nack();
+    return;
+  }
+
+  // flash, EEPROM and option bytes: via E_W routine, programming time per block
+  if (addr >= DFLASH_START) {
+    if (((addr <= OPTION_END) || (addr >= PFLASH_START)) && !routine_resident()) {
+      send_nack();
+      return;
+    }
+    if ((addr <= OPTION_END) || (addr >= PFLASH_START))
+      usleep(g_cfg.timeWrite);
+  }
+  memcpy(g_mem + addr, buf+1, numBytes);
+  send_ack();
+}
+
+/**
+  erase sector: 0x00.. P-flash sectors of 1kB from PFLASH_START, 0x80.. D-flash. Return 0 if not present
+*/
+static uint8_t erase_sector(uint8_t code) {
+  uint32_t  addr;
+
+  addr = (code < 0x80) ? (PFLASH_START + code*1024) : (DFLASH_START + (code-0x80)*1024);
+  if ((code < 0x80) ? (addr > g_cfg.flashEnd) : (addr > DFLASH_END))
+    return(0);
+  memset(g_mem + addr, 0x00, 1024);
+  usleep(g_cfg.timeErase);
+  return(1);
+}
+
+/**
+  ERASE: 0xFF 0x00 for mass erase, else number of sectors, sector codes and checksum.
+  Requires E_W routine
+*/
+static void cmd_erase(void) {
+  uint8_t   buf[260], chk;
+  int       numSectors, i;
+
+  g_num.erase++;
+  if ((!send_ack()) || (!get_bytes(buf, 2)))
+    return;
+
+  // mass erase
+  if (buf[0] == 0xFF) {
+    if ((buf[1] != 0x00) || !routine_resident()) {
+      send_nack();
+      return;
+    }
+    for (i=0; PFLASH_START + i*1024 <= g_cfg.flashEnd; i++)
+      erase_sector(i);
+    for (i=0; DFLASH_START + i*1024 <= DFLASH_END; i++)
+      erase_sector(0x80 + i);
+    send_ack();
+    return;
+  }
+
+  // sector erase: 2nd byte is first sector code
+  numSectors = buf[0] + 1;
+  if (!get_bytes(buf+2, numSectors))
+    return;
+  for (chk=0, i=0; i<numSectors+1; i++)
+    chk ^= buf[i];
+  if ((chk != buf[numSectors+1]) || !routine_resident()) {
+    send_nack();
+    return;
+  }
+  for (i=0; i<numSectors; i++) {
+    if (!erase_sector(buf[1+i])) {
+      send_nack();
+      return;
+    }
+  }
+  send_ack();
+}
+
+/**
+  GO: address. CRC16 routine calculates CRC and re-enters BSL, else BSL is left
+*/
+static void cmd_go(void) {
+  uint32_t  addr, start, numBytes;
+  uint16_t  crc;
+
+  g_num.go++;
+  if ((!send_ack()) || (!get_addr(&addr)))
+    return;
+  g_synced = 0;
+
+  // CRC16 routine, approx. 3us per byte
+  if ((addr == CRC_ROUTINE) && image_resident(&STM8_Routines_crc16_routine)) {
+    start    = ((uint32_t) g_mem[CRC_PARAM] << 8) | g_mem[CRC_PARAM+1];
+    numBytes = ((uint32_t) g_mem[CRC_PARAM+2] << 8) | g_mem[CRC_PARAM+3];
+    if (numBytes == 0)
+      numBytes = 0x10000;
+    if (start + numBytes > 0x10000)
+      numBytes = 0x10000 - start;
+    crc = crc16((const char*) g_mem + start, numBytes, 0xFFFF);
+    g_mem[CRC_PARAM+4] = (uint8_t) (crc >> 8);
+    g_mem[CRC_PARAM+5] = (uint8_t) crc;
+    g_mem[CRC_PARAM+6] = 0xA5;
+    usleep(3 * numBytes);
+    return;
+  }
+
+  // application started
+  printf("GO 0x%04x: %u sync, %u get, %u read, %u write, %u erase, %u reset, %u nack, injected %u dropped, %u nack, %u stall, wire %u rx, %u tx, %u turns\n",
+    (unsigned) addr, g_num.sync, g_num.get, g_num.read, g_num.write, g_num.erase, g_num.reset, g_num.nack,
+    g_num.dropped, g_num.nackInjected, g_num.stalled, g_num.bytesRx, g_num.bytesTx, g_num.turns);
+  fflush(stdout);
+  memset(&g_num, 0, sizeof(g_num));
+}
+
+/**
+  serve host: wait for reset, SYNCH and commands
+*/
+static void serve(void) {
+  const char  *reset = "##reset##";
+  uint8_t     buf[16];
+  uint32_t    baud;
+  int         c, c2;
+
+  while (1) {
+    c = get_byte(-1);
+    g_echoError = 0;
+
+    // reset command from application: restart BSL
+    if (c == reset[0]) {
+      if (get_bytes(buf, strlen(reset)-1) && (memcmp(buf, reset+1, strlen(reset)-1) == 0)) {
+        g_num.reset++;
+        g_synced = 0;
+        if (g_cfg.verbose)
+          printf("reset\n");
+      }
+      continue;
+    }
+
+    // BSL can't receive above max. baudrate
+    baud = get_baud();
+    if ((g_cfg.maxBaud > 0) && (baud > g_cfg.maxBaud)) {
+      buf[0] = 0xFE;
+      wire_byte(0);
+      if (write(g_fdMaster, buf, 1) != 1)
+        continue;
+      continue;
+    }
+
+    // synchronize. SYNCH is never echoed. When synchronized, the BSL responds with NACK
+    if (c == SYNCH) {
+      g_num.sync++;
+      buf[0] = g_synced ? NACK : ACK;
+      g_synced = 1;
+      wire_byte(0);
+      if (write(g_fdMaster, buf, 1) != 1)
+        continue;
+      continue;
+    }
+    if (!g_synced)
+      continue;
+
+    // command with complement
+    if ((c2 = get_byte(CMD_TIMEOUT)) < 0)
+      continue;
+    if (g_cfg.verbose)
+      printf("command 0x%02x (%u Baud)\n", c, (unsigned) baud);
+    if ((c ^ c2) != 0xFF) {
+      send_nack();
+      continue;
+    }
+    switch (c) {
+      case GET:   cmd_get();    break;
+      case READ:  cmd_read();   break;
+      case WRITE: cmd_write();  break;
+      case ERASE:
+        if (g_cfg.noErase)
+          send_nack();
+        else
+          cmd_erase();
+        break;
+      case GO:    cmd_go();     break;
+      default:    send_nack();  break;
+    }
+    fflush(stdout);
+  }
+}
+
+
+int main(int argc, char **argv) {
+  struct termios  toptions;
+  int             i;
+  unsigned        seed = 1;
+
+  // default configuration
+  memset(&g_cfg, 0, sizeof(g_cfg));
+  g_cfg.mode      = UART_MODE_DUPLEX;
+  g_cfg.flashEnd  = PFLASH_START + 32*1024 - 1;
+  g_cfg.version   = 0x13;
+  g_cfg.timeWrite = 6000;
+  g_cfg.timeErase = 24000;
+  g_cfg.timeStall = 500;
+
+  for (i=1; i<argc; i++) {
+    if ((!strcmp(argv[i], "-m")) && (i+1<argc))
+      g_cfg.mode = atoi(argv[++i]);
+    else if ((!strcmp(argv[i], "-f")) && (i+1<argc))
+      g_cfg.flashEnd = PFLASH_START + atoi(argv[++i])*1024 - 1;
+    else if ((!strcmp(argv[i], "-V")) && (i+1<argc))
+      g_cfg.version = strtoul(argv[++i], NULL, 16);
+    else if ((!strcmp(argv[i], "-b")) && (i+1<argc))
+      g_cfg.maxBaud = atoi(argv[++i]);
+    else if ((!strcmp(argv[i], "-w")) && (i+1<argc))
+      g_cfg.timeWrite = atoi(argv[++i]);
+    else if ((!strcmp(argv[i], "-e")) && (i+1<argc))
+      g_cfg.timeErase = atoi(argv[++i]);
+    else if ((!strcmp(argv[i], "-d")) && (i+1<argc))
+      g_cfg.probDrop = atof(argv[++i]);
+    else if ((!strcmp(argv[i], "-n")) && (i+1<argc))
+      g_cfg.probNack = atof(argv[++i]);
+    else if ((!strcmp(argv[i], "-s")) && (i+1<argc))
+      g_cfg.probStall = atof(argv[++i]);
+    else if ((!strcmp(argv[i], "-t")) && (i+1<argc))
+      g_cfg.timeStall = atoi(argv[++i]);
+    else if ((!strcmp(argv[i], "-r")) && (i+1<argc))
+      seed = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-g"))
+      g_cfg.noErase = 1;
+    else if (!strcmp(argv[i], "-c"))
+      g_cfg.wireTime = 1;
+    else if (!strcmp(argv[i], "-v"))
+      g_cfg.verbose = 1;
+    else {
+      fprintf(stderr, "usage: %s [-m mode] [-f kB] [-V version] [-g] [-b baud] [-w us] [-e us] [-d p] [-n p] [-s p] [-t ms] [-r seed] [-c] [-v]\n", argv[0]);
+      exit(1);
+    }
+  }
+  if ((g_cfg.flashEnd < PFLASH_START) || (g_cfg.flashEnd > PFLASH_MAXEND)) {
+    fprintf(stderr, "\n\nerror in 'bsl_emu': flash size must be 1..%dkB, exit!\n\n", (PFLASH_MAXEND+1-PFLASH_START)/1024);
+    exit(1);
+  }
+  srand(seed);
+
+  // open pty. Keep slave open, else the master is hung up when the loader closes the port
+  if (((g_fdMaster = posix_openpt(O_RDWR | O_NOCTTY)) < 0) || (grantpt(g_fdMaster) != 0) || (unlockpt(g_fdMaster) != 0) ||
+      ((g_fdSlave = open(ptsname(g_fdMaster), O_RDWR | O_NOCTTY)) < 0)) {
+    fprintf(stderr, "\n\nerror in 'bsl_emu': cannot open pty (code %d), exit!\n\n", errno);
+    exit(1);
+  }
+  tcgetattr(g_fdSlave, &toptions);
+  cfmakeraw(&toptions);
+  tcsetattr(g_fdSlave, TCSANOW, &toptions);
+  printf("%s\n", ptsname(g_fdMaster));
+  fflush(stdout);
+
+  serve();
+
+  return(0);
+}
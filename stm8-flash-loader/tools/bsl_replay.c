@@ -0,0 +1,209 @@
+/**
+  replay tool: play the target (STM8 BSL) side of a protocol trace (see trace.c, option
+  -t) back over a pseudo terminal, to reproduce and benchmark slow or failing sessions
+  offline against new loader builds (POSIX only).
+  Bytes sent by the host are read and compared to the trace, bytes received by the host
+  are sent with the recorded latency (scaled by -s). Stops with an error if the host
+  diverges from the trace. The loader has to run with the same options and cache state
+  (e.g. cached baudrate, see get_cache_file()) as the recorded run.
+  Usage: bsl_replay [-s speed] trace       replay, prints name of pty for the loader (-p)
+         bsl_replay -d trace               dump trace as text
+*/
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "misc.h"
+#include "trace.h"
+
+#define HOST_TIMEOUT      10000     // max. wait for bytes from host [ms]
+#define MAX_RECORD        65536     // max. data per record
+
+// names of record types
+static const char *TYPE_NAME[] = {"TX", "RX", "BAUD", "FLUSH"};
+
+
+/**
+  exit if trace_next() found a truncated or corrupt record after numRecords records
+*/
+static void check_record(int result, uint32_t numRecords) {
+
+  if (result < 0) {
+    fprintf(stderr, "\n\nerror in 'bsl_replay': truncated or corrupt record %u, exit!\n\n", (unsigned) (numRecords+1));
+    exit(1);
+  }
+}
+
+/**
+  dump trace as text: time [us], type, length and data
+*/
+static void dump_trace(FILE *fp) {
+  static char buf[MAX_RECORD];
+  uint64_t    delta, t = 0, numBytes[2] = {0, 0};
+  uint32_t    len, i, numRecords = 0;
+  uint8_t     type;
+  int         result;
+
+  while ((result = trace_next(fp, &delta, &type, &len, buf, sizeof(buf))) > 0) {
+    t += delta;
+    numRecords++;
+    printf("%10.3fms  %-5s %5u ", t*1e-3, (type <= TRACE_FLUSH) ? TYPE_NAME[type] : "?", (unsigned) len);
+    if (type == TRACE_BAUD)
+      printf(" %u Baud", (unsigned) ((uint8_t) buf[0] | ((uint8_t) buf[1] << 8) | ((uint8_t) buf[2] << 16) | ((uint32_t) (uint8_t) buf[3] << 24)));
+    else {
+      for (i=0; (i<len) && (i<16); i++)
+        printf(" %02x", (uint8_t) buf[i]);
+      if (len > 16)
+        printf(" ...");
+    }
+    printf("\n");
+    if (type <= TRACE_RX)
+      numBytes[type] += len;
+  }
+  check_record(result, numRecords);
+  printf("%u records, %.3fms, host sent %llu bytes, received %llu bytes\n", (unsigned) numRecords, t*1e-3,
+    (unsigned long long) numBytes[TRACE_TX], (unsigned long long) numBytes[TRACE_RX]);
+}
+
+/**
+  read exactly len bytes from host. Return number of bytes read (less on timeout or close)
+*/
+static uint32_t read_host(int fd, char *buf, uint32_t len) {
+  struct pollfd   pfd;
+  uint32_t        num = 0;
+  ssize_t         numTmp;
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+  while (num < len) {
+    if (poll(&pfd, 1, HOST_TIMEOUT) <= 0)
+      break;
+    numTmp = read(fd, buf+num, len-num);
+    if ((numTmp < 0) && (errno == EINTR))
+      continue;
+    if (numTmp <= 0)
+      break;
+    num += (uint32_t) numTmp;
+  }
+
+  return(num);
+}
+
+/**
+  replay target side of trace via pty master fd. Exits on divergence
+*/
+static void replay_trace(FILE *fp, int fd, double speed) {
+  static char buf[MAX_RECORD], bufHost[MAX_RECORD];
+  uint64_t    delta, tRecorded = 0, tStart, tLast, tDue, offset = 0;
+  uint32_t    len, num, i, numRecords = 0;
+  uint8_t     type;
+  int         result;
+
+  // timing starts with first byte of host
+  tStart = tLast = 0;
+  while ((result = trace_next(fp, &delta, &type, &len, buf, sizeof(buf))) > 0) {
+    tRecorded += delta;
+    numRecords++;
+
+    // host sends: compare with trace
+    if (type == TRACE_TX) {
+      num = read_host(fd, bufHost, len);
+      if (tStart == 0)
+        tStart = micros();
+      for (i=0; (i<num) && (bufHost[i] == buf[i]); i++);
+      if (i < len) {
+        fprintf(stderr, "\n\nerror in 'bsl_replay': host diverged at record %u (host byte %llu): ", (unsigned) numRecords, (unsigned long long) (offset+i));
+        if (i < num)
+          fprintf(stderr, "expect 0x%02x, got 0x%02x, exit!\n\n", (uint8_t) buf[i], (uint8_t) bufHost[i]);
+        else
+          fprintf(stderr, "expect 0x%02x, got timeout, exit!\n\n", (uint8_t) buf[i]);
+        exit(1);
+      }
+      offset += len;
+      tLast = micros();
+    }
+
+    // target sends: wait recorded latency, then send
+    else if (type == TRACE_RX) {
+      tDue = tLast + (uint64_t) (delta * speed);
+      while (micros() < tDue) {
+        if (tDue - micros() > 2000)
+          SLEEP(1);
+      }
+      if (write(fd, buf, len) != (ssize_t) len) {
+        fprintf(stderr, "\n\nerror in 'bsl_replay': write to host failed with code %d, exit!\n\n", errno);
+        exit(1);
+      }
+      tLast = micros();
+    }
+  }
+  check_record(result, numRecords);
+
+  printf("replayed %u records, %llu host bytes: %.1fms (recorded %.1fms)\n", (unsigned) numRecords,
+    (unsigned long long) offset, tStart ? (micros()-tStart)*1e-3 : 0.0, tRecorded*1e-3);
+  fflush(stdout);
+}
+
+
+int main(int argc, char **argv) {
+  FILE      *fp;
+  char      *filename = NULL;
+  double    speed = 1.0;
+  uint8_t   dump = 0;
+  int       fdMaster, fdSlave, i;
+  char      buf[1], error[TRACE_ERRLEN];
+  struct termios  toptions;
+
+  for (i=1; i<argc; i++) {
+    if (!strcmp(argv[i], "-d"))
+      dump = 1;
+    else if ((!strcmp(argv[i], "-s")) && (i+1<argc))
+      speed = atof(argv[++i]);
+    else
+      filename = argv[i];
+  }
+  if (filename == NULL) {
+    fprintf(stderr, "usage: %s [-s speed] trace\n       %s -d trace\n", argv[0], argv[0]);
+    exit(1);
+  }
+
+  if ((fp = trace_open(filename, error)) == NULL) {
+    fprintf(stderr, "\n\n%s, exit!\n\n", error);
+    exit(1);
+  }
+  if (dump) {
+    dump_trace(fp);
+    fclose(fp);
+    return(0);
+  }
+
+  // open pty. Keep slave open, else the master is hung up when the loader reopens the port
+  if (((fdMaster = posix_openpt(O_RDWR | O_NOCTTY)) < 0) || (grantpt(fdMaster) != 0) || (unlockpt(fdMaster) != 0) ||
+      ((fdSlave = open(ptsname(fdMaster), O_RDWR | O_NOCTTY)) < 0)) {
+    fprintf(stderr, "\n\nerror in 'bsl_replay': cannot open pty (code %d), exit!\n\n", errno);
+    exit(1);
+  }
+  tcgetattr(fdSlave, &toptions);
+  cfmakeraw(&toptions);
+  tcsetattr(fdSlave, TCSANOW, &toptions);
+  printf("%s\n", ptsname(fdMaster));
+  fflush(stdout);
+
+  replay_trace(fp, fdMaster, speed);
+  fclose(fp);
+
+  // wait until host has read the last response and closed the port
+  close(fdSlave);
+  while (read_host(fdMaster, buf, 1) == 1);
+  close(fdMaster);
+
+  return(0);
+}
@@ -0,0 +1,137 @@
+/**
+  build tool: convert Motorola S19 file (RAM routine for the STM8) to C header with the
+  binary segments as constant memory image, i.e. no S19 parsing at runtime. Record
+  checksums are checked during conversion. For each segment the load address, length
+  and CRC16 (as calculated by bsl_memCrc()) are emitted.
+  Usage: s19toh file.s19 > file.h. The identifier is derived from the path like 'xxd -i'
+  does, without extension. The includer has to include memimage.h before the header.
+  Usage: s19toh -r E_W_ROUTINEs_*.s19 > E_W_ROUTINEs.h creates the registry of E_W
+  routine variants (see Routine_t in flash.h) from the file names
+  E_W_ROUTINEs_<size>K_ver[L]_<major>.<minor>.s19
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "misc.h"
+#include "memimage.h"
+#include "hexfile.h"
+
+/**
+  C identifier from path without extension
+*/
+static void get_identifier(const char *path, char *name, int len) {
+  int   i;
+
+  strncpy(name, path, len-1);
+  name[len-1] = '\0';
+  if (strrchr(name, '.') != NULL)
+    *strrchr(name, '.') = '\0';
+  for (i=0; name[i] != '\0'; i++) {
+    if (!isalnum((unsigned char) name[i]))
+      name[i] = '_';
+  }
+}
+
+/**
+  print registry of E_W routine variants. Flash size, family and version are parsed
+  from the file names
+*/
+static void print_registry(int numFiles, char **files) {
+  char        name[1000];
+  const char  *base, *p;
+  unsigned    sizeKB, major, minor;
+  char        family;
+  int         i, n;
+
+  printf("// generated by tools/s19toh -r, don't edit. Requires Routine_t from flash.h\n\n");
+  for (i=0; i<numFiles; i++) {
+    base = (strrchr(files[i], '/') != NULL) ? strrchr(files[i], '/')+1 : files[i];
+    printf("#include \"%.*s.h\"\n", (int) (strrchr(base, '.') - base), base);
+  }
+
+  printf("\n// E_W routine variants: flash size [kB], family ('L'=low density), BSL version\n");
+  printf("static const Routine_t E_W_ROUTINES[%d] = {\n", numFiles);
+  for (i=0; i<numFiles; i++) {
+    base = (strrchr(files[i], '/') != NULL) ? strrchr(files[i], '/')+1 : files[i];
+    n = 0;
+    if ((sscanf(base, "E_W_ROUTINEs_%uK_ver%n", &sizeKB, &n) != 1) || (n == 0)) {
+      fprintf(stderr, "\n\nerror in 's19toh': cannot parse routine name '%s', exit!\n\n", base);
+      exit(1);
+    }
+    p = base + n;
+    family = 'S';
+    if (*p == 'L') {
+      family = 'L';
+      p++;
+    }
+    if (sscanf(p, "_%u.%u", &major, &minor) != 2) {
+      fprintf(stderr, "\n\nerror in 's19toh': cannot parse routine version '%s', exit!\n\n", base);
+      exit(1);
+    }
+    get_identifier(files[i], name, sizeof(name));
+    printf("  { %3u, '%c', 0x%X%X, \"%.*s\", &%s },\n", sizeKB, family, major, minor,
+      (int) (strrchr(base, '.') - base) - 13, base + 13, name);
+  }
+  printf("};\n\n");
+  printf("#define NUM_E_W_ROUTINES  %d\n", numFiles);
+}
+
+
+int main(int argc, char **argv) {
+  char        name[1000];
+  char        error[HEXFILE_ERRLEN];
+  MemImage_t  image;
+  int         i, j;
+
+  if ((argc > 2) && (!strcmp(argv[1], "-r"))) {
+    print_registry(argc-2, argv+2);
+    return(0);
+  }
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s file.s19 > file.h\n       %s -r E_W_ROUTINEs_*.s19 > E_W_ROUTINEs.h\n", argv[0], argv[0]);
+    exit(1);
+  }
+
+  // identifier from path without extension
+  get_identifier(argv[1], name, sizeof(name));
+
+  // convert S19 file, exit on syntax or checksum error
+  image_init(&image);
+  if (load_image(argv[1], &image, error)) {
+    fprintf(stderr, "\n\n%s, exit!\n\n", error);
+    exit(1);
+  }
+
+  printf("// generated from %s by tools/s19toh, don't edit\n\n", argv[1]);
+
+  // segment data
+  for (i=0; i<image.numSegments; i++) {
+    printf("static const char %s_data%d[%u] = {", name, i, (unsigned) image.segment[i].numBytes);
+    for (j=0; j<(int) image.segment[i].numBytes; j++)
+      printf("%s0x%02x,", (j % 12) ? " " : "\n  ", (uint8_t) image.segment[i].data[j]);
+    printf("\n};\n\n");
+  }
+
+  // segment table and image
+  printf("static const MemSegment_t %s_segment[%d] = {\n", name, image.numSegments);
+  for (i=0; i<image.numSegments; i++)
+    printf("  { 0x%04x, %u, %u, (char*) %s_data%d },\n", (unsigned) image.segment[i].addrStart,
+      (unsigned) image.segment[i].numBytes, (unsigned) image.segment[i].numBytes, name, i);
+  printf("};\n\n");
+  printf("static const MemImage_t %s = { %d, %d, (MemSegment_t*) %s_segment };\n\n", name, image.numSegments, image.numSegments, name);
+
+  // CRC16 per segment
+  printf("// CRC16 of segments in memory, see bsl_memCrc()\n");
+  printf("static const uint16_t %s_crc16[%d] = {", name, image.numSegments);
+  for (i=0; i<image.numSegments; i++)
+    printf("%s0x%04x", i ? ", " : " ", crc16(image.segment[i].data, image.segment[i].numBytes, 0xFFFF));
+  printf(" };\n");
+
+  image_free(&image);
+
+  return(0);
+}
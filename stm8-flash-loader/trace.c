@@ -0,0 +1,129 @@
+/**
+  protocol trace: record every byte moved by send_port() and receive_port() with
+  timestamp and direction, to reproduce field sessions offline (see tools/bsl_replay.c).
+  Compact binary format: TRACE_MAGIC, then per record
+    varint    time since previous record [us]
+    uint8     type (TRACE_*)
+    varint    number of data bytes
+    data
+  Varints are little endian base 128, i.e. 1 byte for the usual small values. The file
+  is buffered and written by trace_stop() or at exit, also if the run is aborted on error
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "misc.h"
+#include "trace.h"
+
+
+/**
+  write varint
+*/
+static void trace_putVarint(FILE *fp, uint64_t val) {
+  while (val >= 0x80) {
+    putc((int) (val & 0x7F) | 0x80, fp);
+    val >>= 7;
+  }
+  putc((int) val, fp);
+}
+
+/**
+  read varint. Return 0 at end of file
+*/
+static uint8_t trace_getVarint(FILE *fp, uint64_t *val) {
+  int   c, shift;
+
+  *val  = 0;
+  shift = 0;
+  do {
+    if (((c = getc(fp)) == EOF) || (shift > 63))
+      return(0);
+    *val |= (uint64_t) (c & 0x7F) << shift;
+    shift += 7;
+  } while (c & 0x80);
+
+  return(1);
+}
+
+/**
+  start recording all bytes via port to trace file. Return 0 on failure
+*/
+uint8_t trace_start(Trace_t *trace, const char *filename) {
+
+  if ((trace->fp = fopen(filename, "wb")) == NULL)
+    return(0);
+  setvbuf(trace->fp, NULL, _IOFBF, 1024*1024);
+  fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), trace->fp);
+  trace->timeLast = micros();
+
+  return(1);
+}
+
+/**
+  record bytes or event of type (TRACE_*), if recording (trace not NULL and started)
+*/
+void trace_record(Trace_t *trace, uint8_t type, const char *buf, uint32_t len) {
+  uint64_t  t;
+
+  if ((trace == NULL) || (trace->fp == NULL))
+    return;
+
+  t = micros();
+  trace_putVarint(trace->fp, t - trace->timeLast);
+  putc(type, trace->fp);
+  trace_putVarint(trace->fp, len);
+  fwrite(buf, 1, len, trace->fp);
+  trace->timeLast = t;
+}
+
+/**
+  stop recording, i.e. write buffered records and close trace file
+*/
+void trace_stop(Trace_t *trace) {
+
+  if (trace->fp != NULL)
+    fclose(trace->fp);
+  trace->fp = NULL;
+}
+
+/**
+  open trace file for reading and check magic. Return NULL on error (message in error,
+  TRACE_ERRLEN bytes)
+*/
+FILE *trace_open(const char *filename, char *error) {
+  FILE  *fp;
+  char  magic[sizeof(TRACE_MAGIC)];
+
+  if ((fp = fopen(filename, "rb")) == NULL) {
+    snprintf(error, TRACE_ERRLEN, "error in 'trace_open()': cannot open trace '%s'", filename);
+    return(NULL);
+  }
+  if ((fread(magic, 1, strlen(TRACE_MAGIC), fp) != strlen(TRACE_MAGIC)) || (strncmp(magic, TRACE_MAGIC, strlen(TRACE_MAGIC)) != 0)) {
+    snprintf(error, TRACE_ERRLEN, "error in 'trace_open()': '%s' is no trace file", filename);
+    fclose(fp);
+    return(NULL);
+  }
+
+  return(fp);
+}
+
+/**
+  read next record from trace file: time since previous record [us], type and data (max.
+  size bytes stored in buf). Return 1 for a record, 0 at end of trace and -1 for a
+  truncated or corrupt record
+*/
+int trace_next(FILE *fp, uint64_t *delta, uint8_t *type, uint32_t *len, char *buf, uint32_t size) {
+  uint64_t  val;
+  int       c;
+
+  if (!trace_getVarint(fp, delta))
+    return(0);
+  if (((c = getc(fp)) == EOF) || (!trace_getVarint(fp, &val)) || (val > size) || (fread(buf, 1, val, fp) != val))
+    return(-1);
+  *type = (uint8_t) c;
+  *len  = (uint32_t) val;
+
+  return(1);
+}
@@ -0,0 +1,41 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// start of trace file
+#define TRACE_MAGIC       "STM8TRC1"
+
+// size of error message buffer passed to trace_open()
+#define TRACE_ERRLEN      200
+
+// record types
+#define TRACE_TX          0         // bytes sent by host
+#define TRACE_RX          1         // bytes received by host
+#define TRACE_BAUD        2         // baudrate changed (4 bytes, little endian)
+#define TRACE_FLUSH       3         // port buffers flushed (no data)
+
+// trace of a session while recording, see trace_start(). Passed to the port functions
+// (see serial_comm.h), NULL: no recording
+typedef struct {
+  FILE      *fp;                    // trace file (NULL: not recording)
+  uint64_t  timeLast;               // time of last record [us]
+} Trace_t;
+
+/// start recording all bytes via port to trace file. Return 0 on failure
+uint8_t   trace_start(Trace_t *trace, const char *filename);
+
+/// record bytes or event, if recording
+void      trace_record(Trace_t *trace, uint8_t type, const char *buf, uint32_t len);
+
+/// stop recording and close trace file
+void      trace_stop(Trace_t *trace);
+
+/// open trace file for reading, NULL on error
+FILE      *trace_open(const char *filename, char *error);
+
+/// read next record from trace file. Return 0 at end of trace, -1 for corrupt record
+int       trace_next(FILE *fp, uint64_t *delta, uint8_t *type, uint32_t *len, char *buf, uint32_t size);
+
+#endif // _TRACE_H_